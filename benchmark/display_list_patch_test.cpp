@@ -0,0 +1,41 @@
+// Checks that patching a word of a display list after the renderer compiled it makes the renderer compile it again.
+// Patches are registered the way the resource bridge and gfx_run_dl register them, and the compiled display list is
+// current only while the revision it recorded matches DisplayList::Revision.
+
+#include <stdio.h>
+#include <memory>
+
+#include <StrHash64.h>
+#include "resource/type/DisplayList.h"
+
+static int sFailures = 0;
+
+static void Check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAIL: %s\n", what);
+        sFailures++;
+    }
+}
+
+int main() {
+    auto dl = std::make_shared<Ship::DisplayList>();
+    dl->Type = Ship::ResourceType::DisplayList;
+    dl->Path = "objects/test/gTestDL";
+    dl->Instructions = { gsDPPipeSync(), gsSPEndDisplayList() };
+
+    // What the renderer records when it compiles the display list the first time it runs
+    uint32_t compiledRevision = dl->Revision;
+
+    Gfx* word = &dl->Instructions[0];
+    uintptr_t original = word->words.w1;
+    word->words.w1 = 0x12345678;
+    dl->RegisterResourceAddressPatch(CRC64(dl->Path.c_str()), 0, original);
+    Check(dl->Revision != compiledRevision, "patching a word after the first compile recompiles the display list");
+
+    compiledRevision = dl->Revision;
+    dl->RegisterResourceAddressPatch(CRC64(dl->Path.c_str()), 1, dl->Instructions[1].words.w1);
+    Check(dl->Revision != compiledRevision, "every patch recompiles the display list");
+
+    printf("%s\n", sFailures == 0 ? "ok" : "failed");
+    return sFailures == 0 ? 0 : 1;
+}
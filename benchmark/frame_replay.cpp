@@ -0,0 +1,73 @@
+// Replays a frame captured with the capture_frame console command through gfx_run and reports how long each run took.
+// Frames are drawn with the backend selected in the configuration file; set Window.GfxBackend to "headless" to time
+// the interpreter on its own.
+//
+// Usage: frame_replay <capture> [runs]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "core/Window.h"
+#include "graphic/Fast3D/gfx_frame_capture.h"
+#include "graphic/Fast3D/gfx_headless.h"
+#include "graphic/Fast3D/gfx_pc.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <capture> [runs]\n", argv[0]);
+        return 1;
+    }
+    const int runs = argc > 2 ? std::max(1, atoi(argv[2])) : 100;
+
+    std::shared_ptr<Ship::Window> window = Ship::Window::CreateInstance("frame_replay");
+
+    GfxFrameReplay replay;
+    if (!gfx_frame_replay_load(&replay, argv[1])) {
+        return 1;
+    }
+
+    gfx_headless_reset_stats();
+    std::vector<double> times;
+    GfxTextureDecodeStats decodes = {};
+    GfxTextureCacheStats cache = {};
+    for (int i = 0; i < runs; i++) {
+        window->StartFrame();
+        auto start = std::chrono::steady_clock::now();
+        gfx_run(replay.commands.data(), replay.mtx_replacements);
+        auto end = std::chrono::steady_clock::now();
+        gfx_end_frame();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        if (i == 0) {
+            decodes = *gfx_get_texture_decode_stats();
+            cache = *gfx_get_texture_cache_stats();
+        }
+    }
+
+    // The first run uploads every texture and compiles every shader, so it is reported on its own.
+    double first = times[0];
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (double t : times) {
+        total += t;
+    }
+    printf("%zu commands, %d runs\n", replay.commands.size(), runs);
+    printf("first %.3f ms, min %.3f ms, median %.3f ms, mean %.3f ms, max %.3f ms\n", first, times.front(),
+           times[times.size() / 2], total / runs, times.back());
+    printf("first run: %u texture decodes (%u async), %.3f ms decoding, %.3f ms waiting\n", decodes.decodes,
+           decodes.async_decodes, decodes.decode_ms, decodes.wait_ms);
+    printf("first run: %u texture cache hits, %u shared, %u misses, %u evicted, %.1f KB shared textures\n", cache.hits,
+           cache.content_hits, cache.misses, cache.evictions, cache.resident_bytes / 1024.0);
+
+    if (gfx_get_current_rendering_api() == &gfx_headless_api) {
+        const GfxHeadlessStats* stats = gfx_headless_get_stats();
+        printf("per run: %.1f draw calls, %.1f triangles, %.1f texture uploads, %.1f shader binds\n",
+               (double)stats->draw_calls / runs, (double)stats->triangles / runs,
+               (double)stats->texture_uploads / runs, (double)stats->shader_binds / runs);
+        printf("per run: %.1f KB vertices, %.1f KB indices\n", stats->vertex_bytes / 1024.0 / runs,
+               stats->index_bytes / 1024.0 / runs);
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+// Compares the texture converters in gfx_texture_decode against the per-texel conversion loops Fast3D used before
+// them, on texture sizes that are typical for N64 games.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "graphic/Fast3D/gfx_texture_decode.h"
+#include "libultraship/libultra/gbi.h"
+
+#define SCALE_5_8(VAL_) (((VAL_)*0xFF) / 0x1F)
+#define SCALE_4_8(VAL_) ((VAL_)*0x11)
+#define SCALE_3_8(VAL_) ((VAL_)*0x24)
+
+namespace reference {
+static void rgba16(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes) {
+    for (uint32_t i = 0; i < size_bytes / 2; i++) {
+        uint16_t col16 = (addr[2 * i] << 8) | addr[2 * i + 1];
+        uint8_t a = col16 & 1;
+        uint8_t r = col16 >> 11;
+        uint8_t g = (col16 >> 6) & 0x1f;
+        uint8_t b = (col16 >> 1) & 0x1f;
+        dst[4 * i + 0] = SCALE_5_8(r);
+        dst[4 * i + 1] = SCALE_5_8(g);
+        dst[4 * i + 2] = SCALE_5_8(b);
+        dst[4 * i + 3] = a ? 255 : 0;
+    }
+}
+
+static void ia4(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes) {
+    for (uint32_t i = 0; i < size_bytes * 2; i++) {
+        uint8_t byte = addr[i / 2];
+        uint8_t part = (byte >> (4 - (i % 2) * 4)) & 0xf;
+        uint8_t intensity = part >> 1;
+        uint8_t alpha = part & 1;
+        dst[4 * i + 0] = SCALE_3_8(intensity);
+        dst[4 * i + 1] = SCALE_3_8(intensity);
+        dst[4 * i + 2] = SCALE_3_8(intensity);
+        dst[4 * i + 3] = alpha ? 255 : 0;
+    }
+}
+
+static void ia8(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes) {
+    for (uint32_t i = 0; i < size_bytes; i++) {
+        uint8_t intensity = addr[i] >> 4;
+        uint8_t alpha = addr[i] & 0xf;
+        dst[4 * i + 0] = SCALE_4_8(intensity);
+        dst[4 * i + 1] = SCALE_4_8(intensity);
+        dst[4 * i + 2] = SCALE_4_8(intensity);
+        dst[4 * i + 3] = SCALE_4_8(alpha);
+    }
+}
+
+static void ia16(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes) {
+    for (uint32_t i = 0; i < size_bytes / 2; i++) {
+        dst[4 * i + 0] = addr[2 * i];
+        dst[4 * i + 1] = addr[2 * i];
+        dst[4 * i + 2] = addr[2 * i];
+        dst[4 * i + 3] = addr[2 * i + 1];
+    }
+}
+
+static void i4(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes) {
+    for (uint32_t i = 0; i < size_bytes * 2; i++) {
+        uint8_t byte = addr[i / 2];
+        uint8_t intensity = (byte >> (4 - (i % 2) * 4)) & 0xf;
+        dst[4 * i + 0] = SCALE_4_8(intensity);
+        dst[4 * i + 1] = SCALE_4_8(intensity);
+        dst[4 * i + 2] = SCALE_4_8(intensity);
+        dst[4 * i + 3] = SCALE_4_8(intensity);
+    }
+}
+
+static void i8(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes) {
+    for (uint32_t i = 0; i < size_bytes; i++) {
+        dst[4 * i + 0] = addr[i];
+        dst[4 * i + 1] = addr[i];
+        dst[4 * i + 2] = addr[i];
+        dst[4 * i + 3] = addr[i];
+    }
+}
+
+static void ci4(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes, const uint8_t* palette) {
+    for (uint32_t i = 0; i < size_bytes * 2; i++) {
+        uint8_t byte = addr[i / 2];
+        uint8_t idx = (byte >> (4 - (i % 2) * 4)) & 0xf;
+        uint16_t col16 = (palette[idx * 2] << 8) | palette[idx * 2 + 1];
+        dst[4 * i + 0] = SCALE_5_8(col16 >> 11);
+        dst[4 * i + 1] = SCALE_5_8((col16 >> 6) & 0x1f);
+        dst[4 * i + 2] = SCALE_5_8((col16 >> 1) & 0x1f);
+        dst[4 * i + 3] = (col16 & 1) ? 255 : 0;
+    }
+}
+
+static void ci8(uint8_t* dst, const uint8_t* addr, uint32_t size_bytes, const uint8_t* const palettes[2]) {
+    for (uint32_t i = 0; i < size_bytes; i++) {
+        uint8_t idx = addr[i];
+        uint16_t col16 = (palettes[idx / 128][(idx % 128) * 2] << 8) | palettes[idx / 128][(idx % 128) * 2 + 1];
+        dst[4 * i + 0] = SCALE_5_8(col16 >> 11);
+        dst[4 * i + 1] = SCALE_5_8((col16 >> 6) & 0x1f);
+        dst[4 * i + 2] = SCALE_5_8((col16 >> 1) & 0x1f);
+        dst[4 * i + 3] = (col16 & 1) ? 255 : 0;
+    }
+}
+} // namespace reference
+
+using Converter = void (*)(uint8_t*, const uint8_t*, uint32_t);
+
+static const uint8_t* sPalettes[2];
+static const uint16_t sPaletteEntries[2] = { 128, 128 };
+
+static void ReferenceCi4(uint8_t* dst, const uint8_t* src, uint32_t sizeBytes) {
+    reference::ci4(dst, src, sizeBytes, sPalettes[0]);
+}
+
+static void ReferenceCi8(uint8_t* dst, const uint8_t* src, uint32_t sizeBytes) {
+    reference::ci8(dst, src, sizeBytes, sPalettes);
+}
+
+static void DecodeCi4(uint8_t* dst, const uint8_t* src, uint32_t sizeBytes) {
+    gfx_decode_texture_ci4(dst, src, sizeBytes, sPalettes[0]);
+}
+
+static void DecodeCi8(uint8_t* dst, const uint8_t* src, uint32_t sizeBytes) {
+    gfx_decode_texture_ci8(dst, src, sizeBytes, sizeBytes, sizeBytes, sPalettes, sPaletteEntries);
+}
+
+static uint32_t TextureSizeBytes(uint8_t siz, uint32_t width, uint32_t height) {
+    switch (siz) {
+        case G_IM_SIZ_4b:
+            return width * height / 2;
+        case G_IM_SIZ_8b:
+            return width * height;
+        default:
+            return width * height * 2;
+    }
+}
+
+static double TimeConverter(Converter convert, uint8_t* dst, const uint8_t* src, uint32_t sizeBytes) {
+    // Scale the iteration count so every case converts roughly the same number of bytes.
+    const int iterations = std::max(1, (int)(64 * 1024 * 1024 / sizeBytes / 8));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        convert(dst, src, sizeBytes);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+static bool Run(const char* name, uint8_t siz, uint32_t width, uint32_t height, Converter reference,
+                Converter converter, const std::vector<uint8_t>& src) {
+    uint32_t sizeBytes = TextureSizeBytes(siz, width, height);
+    size_t decodedSize = gfx_decoded_texture_size(siz, sizeBytes);
+    std::vector<uint8_t> expected(decodedSize), actual(decodedSize);
+
+    reference(expected.data(), src.data(), sizeBytes);
+    converter(actual.data(), src.data(), sizeBytes);
+    bool matches = expected == actual;
+
+    double referenceNs = TimeConverter(reference, expected.data(), src.data(), sizeBytes);
+    double converterNs = TimeConverter(converter, actual.data(), src.data(), sizeBytes);
+
+    printf("%-7s %4ux%-4u %10.0f ns %10.0f ns %6.2fx %s\n", name, width, height, referenceNs, converterNs,
+           referenceNs / converterNs, matches ? "" : "MISMATCH");
+    return matches;
+}
+
+// A 128 entry TLUT only loads the lower half, so a CI8 texture indexing just that half must decode without reading the
+// upper one, which here is not loaded at all.
+static bool CheckCi8LowerHalfTlut(const std::vector<uint8_t>& src) {
+    const uint32_t sizeBytes = 32 * 32;
+    std::vector<uint8_t> texels(sizeBytes);
+    for (uint32_t i = 0; i < sizeBytes; i++) {
+        texels[i] = src[1024 + i] & 0x7f;
+    }
+
+    const uint8_t* palettes[2] = { &src[0], nullptr };
+    const uint16_t paletteEntries[2] = { 128, 0 };
+    std::vector<uint8_t> expected(sizeBytes * 4), actual(sizeBytes * 4);
+    reference::ci8(expected.data(), texels.data(), sizeBytes, palettes);
+    gfx_decode_texture_ci8(actual.data(), texels.data(), sizeBytes, sizeBytes, sizeBytes, palettes, paletteEntries);
+
+    bool matches = expected == actual;
+    printf("ci8 with a 128 entry TLUT %s\n", matches ? "matches" : "MISMATCH");
+    return matches;
+}
+
+int main() {
+    std::mt19937 rng(0x5eed);
+    std::vector<uint8_t> src(320 * 240 * 4);
+    for (auto& byte : src) {
+        byte = (uint8_t)rng();
+    }
+
+    sPalettes[0] = &src[0];
+    sPalettes[1] = &src[256];
+    const uint32_t sizes[][2] = { { 32, 32 }, { 64, 32 }, { 64, 64 }, { 128, 64 }, { 320, 240 } };
+    bool ok = true;
+
+    ok &= CheckCi8LowerHalfTlut(src);
+
+    printf("%-7s %9s %13s %13s %7s\n", "format", "size", "reference", "converter", "speedup");
+
+    for (const auto& size : sizes) {
+        uint32_t w = size[0], h = size[1];
+
+        ok &= Run("rgba16", G_IM_SIZ_16b, w, h, reference::rgba16, gfx_decode_texture_rgba16, src);
+        ok &= Run("ia4", G_IM_SIZ_4b, w, h, reference::ia4, gfx_decode_texture_ia4, src);
+        ok &= Run("ia8", G_IM_SIZ_8b, w, h, reference::ia8, gfx_decode_texture_ia8, src);
+        ok &= Run("ia16", G_IM_SIZ_16b, w, h, reference::ia16, gfx_decode_texture_ia16, src);
+        ok &= Run("i4", G_IM_SIZ_4b, w, h, reference::i4, gfx_decode_texture_i4, src);
+        ok &= Run("i8", G_IM_SIZ_8b, w, h, reference::i8, gfx_decode_texture_i8, src);
+        ok &= Run("ci4", G_IM_SIZ_4b, w, h, ReferenceCi4, DecodeCi4, src);
+        ok &= Run("ci8", G_IM_SIZ_8b, w, h, ReferenceCi8, DecodeCi8, src);
+    }
+
+    return ok ? 0 : 1;
+}
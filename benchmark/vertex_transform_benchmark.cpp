@@ -0,0 +1,134 @@
+// Compares the batched vertex transform in gfx_vertex_transform against its scalar path, for G_VTX loads of the sizes
+// games issue, with lighting, texture generation and fog toggled.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "graphic/Fast3D/gfx_vertex_transform.h"
+
+using Transform = void (*)(LoadedVertex*, const Vtx*, size_t, const GfxVertexTransformState*);
+
+struct Scene {
+    float mp_matrix[4][4];
+    Light_t lights[8];
+    float lights_coeffs[7][3];
+    float lookat_coeffs[2][3];
+};
+
+static void RandomUnitVector(std::mt19937& rng, float v[3]) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    v[0] = dist(rng);
+    v[1] = dist(rng);
+    v[2] = dist(rng);
+    float s = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    v[0] /= s;
+    v[1] /= s;
+    v[2] /= s;
+}
+
+static void MakeScene(std::mt19937& rng, Scene& scene) {
+    // A random matrix with a large translation row, so vertices land on both sides of every clip plane and of w = 0.
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            scene.mp_matrix[i][j] = dist(rng) * (i == 3 ? 400.0f : 1.0f);
+        }
+    }
+    for (auto& light : scene.lights) {
+        for (int c = 0; c < 3; c++) {
+            light.col[c] = (uint8_t)rng();
+        }
+    }
+    for (auto& coeffs : scene.lights_coeffs) {
+        RandomUnitVector(rng, coeffs);
+    }
+    for (auto& coeffs : scene.lookat_coeffs) {
+        RandomUnitVector(rng, coeffs);
+    }
+}
+
+static bool SameVertex(const LoadedVertex& a, const LoadedVertex& b) {
+    return memcmp(&a.x, &b.x, sizeof(float) * 6) == 0 && memcmp(&a.color, &b.color, sizeof(a.color)) == 0 &&
+           a.clip_rej == b.clip_rej;
+}
+
+static double TimeTransform(Transform transform, LoadedVertex* dst, const std::vector<Vtx>& src, size_t count,
+                            const GfxVertexTransformState* state) {
+    const int iterations = std::max(1, (int)(4 * 1024 * 1024 / count));
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        transform(dst, &src[(i * count) % (src.size() - count)], count, state);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+static bool Run(const char* name, uint32_t geometryMode, uint8_t numLights, size_t count, const Scene& scene,
+                const std::vector<Vtx>& src) {
+    GfxVertexTransformState state;
+    state.mp_matrix = scene.mp_matrix;
+    state.adjust_x_for_aspect_ratio = true;
+    state.aspect_ratio = 16.0f / 9.0f;
+    state.geometry_mode = geometryMode;
+    state.num_lights = numLights;
+    state.lights = scene.lights;
+    state.lights_coeffs = scene.lights_coeffs;
+    state.lookat_coeffs = scene.lookat_coeffs;
+    state.texture_scaling_s = 0xFFFF;
+    state.texture_scaling_t = 0x8000;
+    state.fog_mul = 0x1200;
+    state.fog_offset = -0x1100;
+
+    std::vector<LoadedVertex> expected(count), actual(count);
+    bool matches = true;
+    for (size_t offset = 0; offset + count <= src.size(); offset += count) {
+        gfx_transform_vertices_scalar(expected.data(), &src[offset], count, &state);
+        gfx_transform_vertices(actual.data(), &src[offset], count, &state);
+        matches &= std::equal(expected.begin(), expected.end(), actual.begin(), SameVertex);
+    }
+
+    double scalarNs = TimeTransform(gfx_transform_vertices_scalar, expected.data(), src, count, &state);
+    double batchedNs = TimeTransform(gfx_transform_vertices, actual.data(), src, count, &state);
+    printf("%-12s %5zu %10.0f ns %10.0f ns %6.2fx %s\n", name, count, scalarNs, batchedNs, scalarNs / batchedNs,
+           matches ? "" : "MISMATCH");
+    return matches;
+}
+
+int main() {
+    std::mt19937 rng(0x5eed);
+    Scene scene;
+    MakeScene(rng, scene);
+
+    std::vector<Vtx> src(64 * 1024);
+    for (auto& vtx : src) {
+        memset(&vtx, 0, sizeof(vtx));
+        for (int c = 0; c < 3; c++) {
+            vtx.v.ob[c] = (short)(rng() % 2048) - 1024;
+        }
+        vtx.v.tc[0] = (short)rng();
+        vtx.v.tc[1] = (short)rng();
+        for (int c = 0; c < 4; c++) {
+            vtx.v.cn[c] = (uint8_t)rng();
+        }
+    }
+
+    const size_t counts[] = { 3, 16, 32, 64 };
+    bool ok = true;
+    printf("%-12s %5s %13s %13s %7s\n", "mode", "verts", "scalar", "batched", "speedup");
+    for (size_t count : counts) {
+        ok &= Run("unlit", 0, 2, count, scene, src);
+        ok &= Run("fog", G_FOG, 2, count, scene, src);
+        ok &= Run("lit 1", G_LIGHTING, 2, count, scene, src);
+        ok &= Run("lit 7", G_LIGHTING, 8, count, scene, src);
+        ok &= Run("lit fog", G_LIGHTING | G_FOG, 3, count, scene, src);
+        ok &= Run("texgen", G_LIGHTING | G_TEXTURE_GEN, 3, count, scene, src);
+        ok &= Run("texgen lin", G_LIGHTING | G_TEXTURE_GEN | G_TEXTURE_GEN_LINEAR, 3, count, scene, src);
+    }
+    return ok ? 0 : 1;
+}
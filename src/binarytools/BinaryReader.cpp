@@ -15,6 +15,11 @@ Ship::BinaryReader::BinaryReader(std::shared_ptr<Stream> nStream) {
     mStream = nStream;
 }
 
+Ship::BinaryReader::BinaryReader(std::shared_ptr<MemorySpanStream> nStream) {
+    mStream = nStream;
+    mSpanStream = nStream.get();
+}
+
 void Ship::BinaryReader::Close() {
     mStream->Close();
 }
@@ -40,20 +45,24 @@ void Ship::BinaryReader::Read(int32_t length) {
 }
 
 void Ship::BinaryReader::Read(char* buffer, int32_t length) {
-    mStream->Read(buffer, length);
+    ReadBytes(buffer, length);
 }
 
 char Ship::BinaryReader::ReadChar() {
-    return (char)mStream->ReadByte();
+    return (char)ReadInt8();
 }
 
 int8_t Ship::BinaryReader::ReadInt8() {
+    if (mSpanStream != nullptr) {
+        return *mSpanStream->Consume(1);
+    }
+
     return mStream->ReadByte();
 }
 
 int16_t Ship::BinaryReader::ReadInt16() {
     int16_t result = 0;
-    mStream->Read((char*)&result, sizeof(int16_t));
+    ReadBytes((char*)&result, sizeof(int16_t));
     if (mEndianness != Endianness::Native) {
         result = BSWAP16(result);
     }
@@ -64,7 +73,7 @@ int16_t Ship::BinaryReader::ReadInt16() {
 int32_t Ship::BinaryReader::ReadInt32() {
     int32_t result = 0;
 
-    mStream->Read((char*)&result, sizeof(int32_t));
+    ReadBytes((char*)&result, sizeof(int32_t));
 
     if (mEndianness != Endianness::Native) {
         result = BSWAP32(result);
@@ -74,13 +83,13 @@ int32_t Ship::BinaryReader::ReadInt32() {
 }
 
 uint8_t Ship::BinaryReader::ReadUByte() {
-    return (uint8_t)mStream->ReadByte();
+    return (uint8_t)ReadInt8();
 }
 
 uint16_t Ship::BinaryReader::ReadUInt16() {
     uint16_t result = 0;
 
-    mStream->Read((char*)&result, sizeof(uint16_t));
+    ReadBytes((char*)&result, sizeof(uint16_t));
 
     if (mEndianness != Endianness::Native) {
         result = BSWAP16(result);
@@ -92,7 +101,7 @@ uint16_t Ship::BinaryReader::ReadUInt16() {
 uint32_t Ship::BinaryReader::ReadUInt32() {
     uint32_t result = 0;
 
-    mStream->Read((char*)&result, sizeof(uint32_t));
+    ReadBytes((char*)&result, sizeof(uint32_t));
 
     if (mEndianness != Endianness::Native) {
         result = BSWAP32(result);
@@ -104,7 +113,7 @@ uint32_t Ship::BinaryReader::ReadUInt32() {
 uint64_t Ship::BinaryReader::ReadUInt64() {
     uint64_t result = 0;
 
-    mStream->Read((char*)&result, sizeof(uint64_t));
+    ReadBytes((char*)&result, sizeof(uint64_t));
 
     if (mEndianness != Endianness::Native) {
         result = BSWAP64(result);
@@ -116,7 +125,7 @@ uint64_t Ship::BinaryReader::ReadUInt64() {
 float Ship::BinaryReader::ReadFloat() {
     float result = NAN;
 
-    mStream->Read((char*)&result, sizeof(float));
+    ReadBytes((char*)&result, sizeof(float));
 
     if (mEndianness != Endianness::Native) {
         float tmp;
@@ -139,7 +148,7 @@ float Ship::BinaryReader::ReadFloat() {
 double Ship::BinaryReader::ReadDouble() {
     double result = NAN;
 
-    mStream->Read((char*)&result, sizeof(double));
+    ReadBytes((char*)&result, sizeof(double));
 
     if (mEndianness != Endianness::Native) {
         double tmp;
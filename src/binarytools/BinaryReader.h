@@ -3,12 +3,14 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <cstring>
 #include "endianness.h"
 #include "Vec2f.h"
 #include "Vec3f.h"
 #include "Vec3s.h"
 #include "Color3b.h"
 #include "Stream.h"
+#include "MemorySpanStream.h"
 
 class BinaryReader;
 
@@ -19,6 +21,7 @@ class BinaryReader {
     BinaryReader(char* nBuffer, size_t nBufferSize);
     BinaryReader(Stream* nStream);
     BinaryReader(std::shared_ptr<Stream> nStream);
+    BinaryReader(std::shared_ptr<MemorySpanStream> nStream);
 
     void Close();
 
@@ -50,7 +53,17 @@ class BinaryReader {
     std::vector<char> ToVector();
 
   protected:
+    void ReadBytes(char* dest, size_t length) {
+        if (mSpanStream != nullptr) {
+            memcpy(dest, mSpanStream->Consume(length), length);
+        } else {
+            mStream->Read(dest, length);
+        }
+    }
+
     std::shared_ptr<Stream> mStream;
+    // Set when reading straight out of a span, so primitive reads can skip the virtual Stream calls.
+    MemorySpanStream* mSpanStream = nullptr;
     Endianness mEndianness = Endianness::Native;
 };
 } // namespace Ship
@@ -0,0 +1,68 @@
+#include "MemorySpanStream.h"
+#include <stdexcept>
+
+Ship::MemorySpanStream::MemorySpanStream(char* nBuffer, size_t nBufferSize) {
+    mBuffer = nBuffer;
+    mBufferSize = nBufferSize;
+    mBaseAddress = 0;
+}
+
+Ship::MemorySpanStream::~MemorySpanStream() {
+}
+
+uint64_t Ship::MemorySpanStream::GetLength() {
+    return mBufferSize;
+}
+
+void Ship::MemorySpanStream::Seek(int32_t offset, SeekOffsetType seekType) {
+    if (seekType == SeekOffsetType::Start) {
+        mBaseAddress = offset;
+    } else if (seekType == SeekOffsetType::Current) {
+        mBaseAddress += offset;
+    } else if (seekType == SeekOffsetType::End) {
+        mBaseAddress = mBufferSize - 1 - offset;
+    }
+}
+
+std::unique_ptr<char[]> Ship::MemorySpanStream::Read(size_t length) {
+    std::unique_ptr<char[]> result = std::make_unique<char[]>(length);
+
+    memcpy(result.get(), Consume(length), length);
+
+    return result;
+}
+
+void Ship::MemorySpanStream::Read(const char* dest, size_t length) {
+    memcpy((void*)dest, Consume(length), length);
+}
+
+int8_t Ship::MemorySpanStream::ReadByte() {
+    return mBuffer[mBaseAddress++];
+}
+
+void Ship::MemorySpanStream::Write(char* srcBuffer, size_t length) {
+    if (mBaseAddress + length > mBufferSize) {
+        throw std::runtime_error("MemorySpanStream::Write(): Write past the end of the buffer");
+    }
+
+    memcpy(&mBuffer[mBaseAddress], srcBuffer, length);
+    mBaseAddress += length;
+}
+
+void Ship::MemorySpanStream::WriteByte(int8_t value) {
+    if (mBaseAddress >= mBufferSize) {
+        throw std::runtime_error("MemorySpanStream::WriteByte(): Write past the end of the buffer");
+    }
+
+    mBuffer[mBaseAddress++] = value;
+}
+
+std::vector<char> Ship::MemorySpanStream::ToVector() {
+    return std::vector<char>(mBuffer, mBuffer + mBufferSize);
+}
+
+void Ship::MemorySpanStream::Flush() {
+}
+
+void Ship::MemorySpanStream::Close() {
+}
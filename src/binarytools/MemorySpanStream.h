@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "Stream.h"
+
+namespace Ship {
+// Read stream over memory owned by someone else. Unlike MemoryStream nothing is copied, so the caller has to keep the
+// buffer alive for as long as the stream is in use. Writes are done in place and can not grow the buffer.
+class MemorySpanStream final : public Stream {
+  public:
+    MemorySpanStream(char* nBuffer, size_t nBufferSize);
+    ~MemorySpanStream();
+
+    uint64_t GetLength() override;
+
+    void Seek(int32_t offset, SeekOffsetType seekType) override;
+
+    std::unique_ptr<char[]> Read(size_t length) override;
+    void Read(const char* dest, size_t length) override;
+    int8_t ReadByte() override;
+
+    void Write(char* srcBuffer, size_t length) override;
+    void WriteByte(int8_t value) override;
+
+    std::vector<char> ToVector() override;
+
+    void Flush() override;
+    void Close() override;
+
+    // Returns a pointer to the current read position and advances past length bytes.
+    const char* Consume(size_t length) {
+        const char* result = mBuffer + mBaseAddress;
+        mBaseAddress += length;
+        return result;
+    }
+
+  protected:
+    char* mBuffer;
+    std::size_t mBufferSize;
+};
+} // namespace Ship
@@ -18,6 +18,7 @@
 #include "graphic/Fast3D/gfx_direct3d12.h"
 #include "graphic/Fast3D/gfx_wiiu.h"
 #include "graphic/Fast3D/gfx_gx2.h"
+#include "graphic/Fast3D/gfx_headless.h"
 #include "graphic/Fast3D/gfx_rendering_api.h"
 #include "graphic/Fast3D/gfx_window_manager_api.h"
 #include <spdlog/async.h>
@@ -314,6 +315,11 @@ void Window::InitializeWindowManager(std::string_view gfxBackend, std::string_vi
     // Param can override
     mGfxBackend = gfxBackend;
     mGfxApi = gfxApi;
+    if (gfxBackend == "headless") {
+        mRenderingApi = &gfx_headless_api;
+        mWindowManagerApi = &gfx_headless;
+        return;
+    }
 #ifdef ENABLE_DX11
     if (gfxBackend == "dx11") {
         mRenderingApi = &gfx_direct3d11_api;
@@ -466,6 +472,9 @@ void Window::InitializeResourceManager(const std::vector<std::string>& otrFiles,
         mResourceManager = std::make_shared<ResourceMgr>(GetInstance(), otrFiles, validHashes);
     }
 
+    mResourceManager->GetResourceLoader()->SetPredecodeTextures(mConfig->getBool("Game.Predecode Textures", false));
+    mResourceManager->SetLoaderThreadCount(mConfig->getInt("Game.Loader Threads", 0));
+
     if (!mResourceManager->DidLoadSuccessfully()) {
 #if defined(__SWITCH__)
         printf("Main OTR file not found!\n");
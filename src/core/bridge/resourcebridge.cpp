@@ -6,6 +6,7 @@
 #include <StrHash64.h>
 
 #include "resource/type/Texture.h"
+#include "graphic/Fast3D/gfx_pc.h"
 
 std::shared_ptr<Ship::Resource> LoadResource(const char* name, bool now) {
     return now ? Ship::Window::GetInstance()->GetResourceManager()->LoadResourceProcess(name)
@@ -59,6 +60,12 @@ void* GetResourceDataByName(const char* name, bool now) {
 }
 
 void* GetResourceDataByCrc(uint64_t crc, bool now) {
+    // Resources that are already loaded can be resolved straight from the CRC without building the path string.
+    auto resident = Ship::Window::GetInstance()->GetResourceManager()->GetResidentResource(crc);
+    if (resident != nullptr) {
+        return resident->GetPointer();
+    }
+
     auto name = GetResourceNameByCrc(crc);
 
     if (name == nullptr || strlen(name) == 0) {
@@ -190,13 +197,7 @@ void RegisterResourcePatchByName(const char* name, size_t index, uintptr_t origD
     auto res = LoadResource(name, now);
 
     if (res != nullptr) {
-        const auto hash = GetResourceCrcByName(name);
-        Ship::ResourceAddressPatch patch;
-        patch.ResourceCrc = hash;
-        patch.InstructionIndex = index;
-        patch.OriginalData = origData;
-
-        res->Patches.push_back(patch);
+        res->RegisterResourceAddressPatch(GetResourceCrcByName(name), index, origData);
     }
 }
 
@@ -204,12 +205,7 @@ void RegisterResourcePatchByCrc(uint64_t crc, size_t index, uintptr_t origData,
     auto res = LoadResource(crc, now);
 
     if (res != nullptr) {
-        Ship::ResourceAddressPatch patch;
-        patch.ResourceCrc = crc;
-        patch.InstructionIndex = index;
-        patch.OriginalData = origData;
-
-        res->Patches.push_back(patch);
+        res->RegisterResourceAddressPatch(crc, index, origData);
     }
 }
 
@@ -219,6 +215,9 @@ void WriteTextureDataInt16ByName(const char* name, size_t index, int16_t valueTo
     if (res != nullptr) {
         if ((index * sizeof(int16_t)) < res->ImageDataSize) {
             ((int16_t*)res->ImageData)[index] = valueToWrite;
+            // The pre-decoded copy no longer matches, so let the renderer convert the raw data again.
+            res->DecodedImageData.clear();
+            gfx_texture_cache_invalidate(&((int16_t*)res->ImageData)[index], sizeof(int16_t));
         }
     }
 }
@@ -229,7 +228,24 @@ void WriteTextureDataInt16ByCrc(uint64_t crc, size_t index, int16_t valueToWrite
     if (res != nullptr) {
         if ((index * sizeof(int16_t)) < res->ImageDataSize) {
             ((int16_t*)res->ImageData)[index] = valueToWrite;
+            // The pre-decoded copy no longer matches, so let the renderer convert the raw data again.
+            res->DecodedImageData.clear();
+            gfx_texture_cache_invalidate(&((int16_t*)res->ImageData)[index], sizeof(int16_t));
         }
     }
 }
+
+void InvalidateTextureCacheByName(const char* name) {
+    InvalidateTextureCacheByCrc(GetResourceCrcByName(name));
+}
+
+void InvalidateTextureCacheByCrc(uint64_t crc) {
+    // A texture that is not loaded has nothing in the texture cache
+    auto res = Ship::Window::GetInstance()->GetResourceManager()->GetResidentResource(crc);
+
+    if (res != nullptr && res->Type == Ship::ResourceType::Texture) {
+        auto texture = (Ship::Texture*)res;
+        gfx_texture_cache_invalidate(texture->ImageData, texture->ImageDataSize);
+    }
+}
 }
@@ -41,6 +41,8 @@ void RegisterResourcePatchByName(const char* name, size_t index, uintptr_t origD
 void RegisterResourcePatchByCrc(uint64_t crc, size_t index, uintptr_t origData, bool now);
 void WriteTextureDataInt16ByName(const char* name, size_t index, int16_t valueToWrite, bool now);
 void WriteTextureDataInt16ByCrc(uint64_t crc, size_t index, int16_t valueToWrite, bool now);
+void InvalidateTextureCacheByName(const char* name);
+void InvalidateTextureCacheByCrc(uint64_t crc);
 
 #ifdef __cplusplus
 };
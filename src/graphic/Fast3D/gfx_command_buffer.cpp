@@ -0,0 +1,636 @@
+#include "gfx_command_buffer.h"
+
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gfx_cc.h"
+#include "gfx_headless.h"
+#ifdef ENABLE_DX11
+#include "gfx_direct3d11.h"
+#endif
+
+// Recorded calls are handed over once a draw leaves this many in the chunk being recorded, so the submission thread
+// starts on a frame while the rest of it is still being interpreted.
+#define COMMAND_BUFFER_CHUNK_COMMANDS 64
+
+enum CommandBufferOp : uint8_t {
+    CB_UNLOAD_SHADER,
+    CB_LOAD_SHADER,
+    CB_CREATE_AND_LOAD_NEW_SHADER,
+    CB_NEW_TEXTURE,
+    CB_SELECT_TEXTURE,
+    CB_UPLOAD_TEXTURE,
+    CB_SET_SAMPLER_PARAMETERS,
+    CB_SET_DEPTH_TEST_AND_MASK,
+    CB_SET_ZMODE_DECAL,
+    CB_SET_VIEWPORT,
+    CB_SET_SCISSOR,
+    CB_SET_USE_ALPHA,
+    CB_DRAW_TRIANGLES,
+    CB_DRAW_INDEXED_TRIANGLES,
+    CB_SET_DRAW_CONSTANTS,
+    CB_CREATE_MESH,
+    CB_DRAW_MESH,
+    CB_DELETE_MESH,
+    CB_START_FRAME,
+    CB_START_DRAW_TO_FRAMEBUFFER,
+    CB_CLEAR_FRAMEBUFFER,
+    CB_RESOLVE_MSAA_COLOR_BUFFER,
+    CB_SELECT_TEXTURE_FB,
+    CB_DELETE_TEXTURE,
+    CB_SET_TEXTURE_FILTER,
+};
+
+// One recorded call. Arrays and structs passed by pointer are copied into the chunk's data, and n holds their offsets
+// and lengths alongside any size_t arguments.
+struct RecordedCommand {
+    uint8_t op;
+    bool b[2];
+    float f;
+    int32_t i[4];
+    size_t n[4];
+    void* ptr;
+};
+
+struct CommandChunk {
+    std::vector<RecordedCommand> commands;
+    std::vector<uint8_t> data;
+};
+
+// The recorder's stand-in for a backend shader program. The features are known up front, so shader_get_info is
+// answered without waiting for the backend to create the program.
+struct RecordedShader {
+    uint64_t shader_id0;
+    uint32_t shader_id1;
+    uint8_t num_inputs;
+    bool used_textures[2];
+    struct ShaderProgram* prg; // the backend's program, only touched by the submission thread
+};
+
+// Ids handed out by the recorder, mapped to the backend's ids by the submission thread. Freed ids are reused, which is
+// safe since the delete is replayed before the call that creates the reused id.
+struct RecordedIds {
+    uint32_t next = 1;
+    std::vector<uint32_t> free;
+    std::vector<uint32_t> backend_ids; // indexed by the recorder's id, only touched by the submission thread
+
+    uint32_t allocate() {
+        if (free.empty()) {
+            return next++;
+        }
+        uint32_t id = free.back();
+        free.pop_back();
+        return id;
+    }
+
+    void set(uint32_t id, uint32_t backend_id) {
+        if (id >= backend_ids.size()) {
+            backend_ids.resize(id + 1);
+        }
+        backend_ids[id] = backend_id;
+    }
+};
+
+static struct GfxRenderingAPI* backend;
+
+static std::map<std::pair<uint64_t, uint32_t>, RecordedShader> shader_pool;
+static RecordedIds texture_ids, mesh_ids;
+
+// Chunk being recorded by the game thread.
+static std::unique_ptr<CommandChunk> recording;
+static struct GfxSubmissionStats stats;
+
+// Shared with the submission thread.
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv, idle_cv;
+static std::deque<std::unique_ptr<CommandChunk>> queued_chunks;
+static std::vector<std::unique_ptr<CommandChunk>> free_chunks;
+static bool replaying;
+static bool stopping;
+
+static void gfx_command_buffer_thread_main(void);
+
+static struct SubmissionThread {
+    std::thread thread;
+
+    ~SubmissionThread() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                stopping = true;
+            }
+            queue_cv.notify_one();
+            thread.join();
+        }
+    }
+} submission_thread;
+
+// MARK: - Recording
+
+static RecordedCommand& gfx_command_buffer_record(uint8_t op) {
+    RecordedCommand& cmd = recording->commands.emplace_back();
+    cmd.op = op;
+    stats.commands++;
+    return cmd;
+}
+
+// Copies size bytes into the chunk's data and returns their offset, kept 16 byte aligned for the vertex arrays.
+static size_t gfx_command_buffer_copy(const void* src, size_t size) {
+    size_t offset = (recording->data.size() + 15) & ~(size_t)15;
+    recording->data.resize(offset + size);
+    memcpy(recording->data.data() + offset, src, size);
+    return offset;
+}
+
+static void gfx_command_buffer_flush(void) {
+    if (recording->commands.empty()) {
+        return;
+    }
+    std::unique_ptr<CommandChunk> next;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queued_chunks.push_back(std::move(recording));
+        if (!free_chunks.empty()) {
+            next = std::move(free_chunks.back());
+            free_chunks.pop_back();
+        }
+    }
+    queue_cv.notify_one();
+    recording = next != nullptr ? std::move(next) : std::make_unique<CommandChunk>();
+}
+
+static void gfx_command_buffer_flush_after_draw(void) {
+    if (recording->commands.size() >= COMMAND_BUFFER_CHUNK_COMMANDS) {
+        gfx_command_buffer_flush();
+    }
+}
+
+void gfx_command_buffer_sync(void) {
+    gfx_command_buffer_flush();
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (queued_chunks.empty() && !replaying) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    idle_cv.wait(lock, [] { return queued_chunks.empty() && !replaying; });
+    stats.syncs++;
+    stats.wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct GfxSubmissionStats gfx_command_buffer_take_stats(void) {
+    struct GfxSubmissionStats taken = stats;
+    stats = {};
+    return taken;
+}
+
+// MARK: - Replay
+
+template <typename T> static const T* gfx_command_buffer_data(const CommandChunk& chunk, size_t offset) {
+    return reinterpret_cast<const T*>(chunk.data.data() + offset);
+}
+
+static void gfx_command_buffer_replay(const CommandChunk& chunk) {
+    for (const RecordedCommand& cmd : chunk.commands) {
+        switch (cmd.op) {
+            case CB_UNLOAD_SHADER:
+                backend->unload_shader(cmd.ptr != nullptr ? ((RecordedShader*)cmd.ptr)->prg : nullptr);
+                break;
+            case CB_LOAD_SHADER:
+                backend->load_shader(((RecordedShader*)cmd.ptr)->prg);
+                break;
+            case CB_CREATE_AND_LOAD_NEW_SHADER: {
+                RecordedShader* shader = (RecordedShader*)cmd.ptr;
+                shader->prg = backend->create_and_load_new_shader(shader->shader_id0, shader->shader_id1);
+                break;
+            }
+            case CB_NEW_TEXTURE:
+                texture_ids.set(cmd.i[0], backend->new_texture());
+                break;
+            case CB_SELECT_TEXTURE:
+                backend->select_texture(cmd.i[0], texture_ids.backend_ids[cmd.i[1]]);
+                break;
+            case CB_UPLOAD_TEXTURE:
+                backend->upload_texture(gfx_command_buffer_data<uint8_t>(chunk, cmd.n[0]), cmd.i[0], cmd.i[1]);
+                break;
+            case CB_SET_SAMPLER_PARAMETERS:
+                backend->set_sampler_parameters(cmd.i[0], cmd.b[0], cmd.i[1], cmd.i[2]);
+                break;
+            case CB_SET_DEPTH_TEST_AND_MASK:
+                backend->set_depth_test_and_mask(cmd.b[0], cmd.b[1]);
+                break;
+            case CB_SET_ZMODE_DECAL:
+                backend->set_zmode_decal(cmd.b[0]);
+                break;
+            case CB_SET_VIEWPORT:
+                backend->set_viewport(cmd.i[0], cmd.i[1], cmd.i[2], cmd.i[3]);
+                break;
+            case CB_SET_SCISSOR:
+                backend->set_scissor(cmd.i[0], cmd.i[1], cmd.i[2], cmd.i[3]);
+                break;
+            case CB_SET_USE_ALPHA:
+                backend->set_use_alpha(cmd.b[0]);
+                break;
+            case CB_DRAW_TRIANGLES:
+                // The backend takes a mutable array, but only reads it
+                backend->draw_triangles(const_cast<float*>(gfx_command_buffer_data<float>(chunk, cmd.n[0])),
+                                        cmd.n[1], cmd.n[2]);
+                break;
+            case CB_DRAW_INDEXED_TRIANGLES:
+                backend->draw_indexed_triangles(const_cast<float*>(gfx_command_buffer_data<float>(chunk, cmd.n[0])),
+                                                cmd.n[1], gfx_command_buffer_data<uint16_t>(chunk, cmd.n[2]),
+                                                cmd.n[3]);
+                break;
+            case CB_SET_DRAW_CONSTANTS:
+                backend->set_draw_constants(gfx_command_buffer_data<GfxDrawConstants>(chunk, cmd.n[0]));
+                break;
+            case CB_CREATE_MESH:
+                mesh_ids.set(cmd.i[0], backend->create_mesh(gfx_command_buffer_data<float>(chunk, cmd.n[0]),
+                                                            cmd.n[1],
+                                                            gfx_command_buffer_data<uint32_t>(chunk, cmd.n[2]),
+                                                            cmd.n[3]));
+                break;
+            case CB_DRAW_MESH:
+                backend->draw_mesh(mesh_ids.backend_ids[cmd.i[0]], cmd.n[0], cmd.n[1], cmd.n[2],
+                                   gfx_command_buffer_data<GfxMeshTransform>(chunk, cmd.n[3]));
+                break;
+            case CB_DELETE_MESH:
+                backend->delete_mesh(mesh_ids.backend_ids[cmd.i[0]]);
+                break;
+            case CB_START_FRAME:
+                backend->start_frame();
+                break;
+            case CB_START_DRAW_TO_FRAMEBUFFER:
+                backend->start_draw_to_framebuffer(cmd.i[0], cmd.f);
+                break;
+            case CB_CLEAR_FRAMEBUFFER:
+                backend->clear_framebuffer();
+                break;
+            case CB_RESOLVE_MSAA_COLOR_BUFFER:
+                backend->resolve_msaa_color_buffer(cmd.i[0], cmd.i[1]);
+                break;
+            case CB_SELECT_TEXTURE_FB:
+                backend->select_texture_fb(cmd.i[0]);
+                break;
+            case CB_DELETE_TEXTURE:
+                backend->delete_texture(texture_ids.backend_ids[cmd.i[0]]);
+                break;
+            case CB_SET_TEXTURE_FILTER:
+                backend->set_texture_filter((FilteringMode)cmd.i[0]);
+                break;
+        }
+    }
+}
+
+static void gfx_command_buffer_thread_main(void) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_cv.wait(lock, [] { return !queued_chunks.empty() || stopping; });
+        if (stopping) {
+            return;
+        }
+        std::unique_ptr<CommandChunk> chunk = std::move(queued_chunks.front());
+        queued_chunks.pop_front();
+        replaying = true;
+        lock.unlock();
+
+        gfx_command_buffer_replay(*chunk);
+        chunk->commands.clear();
+        chunk->data.clear();
+
+        lock.lock();
+        free_chunks.push_back(std::move(chunk));
+        replaying = false;
+        if (queued_chunks.empty()) {
+            idle_cv.notify_all();
+        }
+    }
+}
+
+bool gfx_command_buffer_supported(const struct GfxRenderingAPI* api) {
+    if (api == &gfx_headless_api) {
+        return true;
+    }
+#ifdef ENABLE_DX11
+    if (api == &gfx_direct3d11_api) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+// MARK: - Rendering API
+
+static const char* gfx_command_buffer_get_name(void) {
+    return backend->get_name();
+}
+
+static struct GfxClipParameters gfx_command_buffer_get_clip_parameters(void) {
+    // Constant for the supported backends, so it does not depend on how far the replay has got
+    return backend->get_clip_parameters();
+}
+
+static void gfx_command_buffer_unload_shader(struct ShaderProgram* old_prg) {
+    gfx_command_buffer_record(CB_UNLOAD_SHADER).ptr = old_prg;
+}
+
+static void gfx_command_buffer_load_shader(struct ShaderProgram* new_prg) {
+    gfx_command_buffer_record(CB_LOAD_SHADER).ptr = new_prg;
+}
+
+static struct ShaderProgram* gfx_command_buffer_create_and_load_new_shader(uint64_t shader_id0, uint32_t shader_id1) {
+    struct CCFeatures cc_features;
+    gfx_cc_get_features(shader_id0, shader_id1, &cc_features);
+
+    RecordedShader* shader = &shader_pool[std::make_pair(shader_id0, shader_id1)];
+    shader->shader_id0 = shader_id0;
+    shader->shader_id1 = shader_id1;
+    shader->num_inputs = cc_features.num_inputs;
+    shader->used_textures[0] = cc_features.used_textures[0];
+    shader->used_textures[1] = cc_features.used_textures[1];
+    shader->prg = nullptr;
+
+    gfx_command_buffer_record(CB_CREATE_AND_LOAD_NEW_SHADER).ptr = shader;
+    return (struct ShaderProgram*)shader;
+}
+
+static struct ShaderProgram* gfx_command_buffer_lookup_shader(uint64_t shader_id0, uint32_t shader_id1) {
+    auto it = shader_pool.find(std::make_pair(shader_id0, shader_id1));
+    return it == shader_pool.end() ? nullptr : (struct ShaderProgram*)&it->second;
+}
+
+static void gfx_command_buffer_shader_get_info(struct ShaderProgram* prg, uint8_t* num_inputs,
+                                               bool used_textures[2]) {
+    RecordedShader* shader = (RecordedShader*)prg;
+    *num_inputs = shader->num_inputs;
+    used_textures[0] = shader->used_textures[0];
+    used_textures[1] = shader->used_textures[1];
+}
+
+static uint32_t gfx_command_buffer_new_texture(void) {
+    uint32_t id = texture_ids.allocate();
+    gfx_command_buffer_record(CB_NEW_TEXTURE).i[0] = id;
+    return id;
+}
+
+static void gfx_command_buffer_select_texture(int tile, uint32_t texture_id) {
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_SELECT_TEXTURE);
+    cmd.i[0] = tile;
+    cmd.i[1] = texture_id;
+}
+
+static void gfx_command_buffer_upload_texture(const uint8_t* rgba32_buf, uint32_t width, uint32_t height) {
+    size_t offset = gfx_command_buffer_copy(rgba32_buf, (size_t)width * height * 4);
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_UPLOAD_TEXTURE);
+    cmd.i[0] = width;
+    cmd.i[1] = height;
+    cmd.n[0] = offset;
+}
+
+static void gfx_command_buffer_set_sampler_parameters(int sampler, bool linear_filter, uint32_t cms, uint32_t cmt) {
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_SET_SAMPLER_PARAMETERS);
+    cmd.i[0] = sampler;
+    cmd.b[0] = linear_filter;
+    cmd.i[1] = cms;
+    cmd.i[2] = cmt;
+}
+
+static void gfx_command_buffer_set_depth_test_and_mask(bool depth_test, bool z_upd) {
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_SET_DEPTH_TEST_AND_MASK);
+    cmd.b[0] = depth_test;
+    cmd.b[1] = z_upd;
+}
+
+static void gfx_command_buffer_set_zmode_decal(bool zmode_decal) {
+    gfx_command_buffer_record(CB_SET_ZMODE_DECAL).b[0] = zmode_decal;
+}
+
+static void gfx_command_buffer_set_viewport(int x, int y, int width, int height) {
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_SET_VIEWPORT);
+    cmd.i[0] = x;
+    cmd.i[1] = y;
+    cmd.i[2] = width;
+    cmd.i[3] = height;
+}
+
+static void gfx_command_buffer_set_scissor(int x, int y, int width, int height) {
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_SET_SCISSOR);
+    cmd.i[0] = x;
+    cmd.i[1] = y;
+    cmd.i[2] = width;
+    cmd.i[3] = height;
+}
+
+static void gfx_command_buffer_set_use_alpha(bool use_alpha) {
+    gfx_command_buffer_record(CB_SET_USE_ALPHA).b[0] = use_alpha;
+}
+
+static void gfx_command_buffer_draw_triangles(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_tris) {
+    size_t offset = gfx_command_buffer_copy(buf_vbo, buf_vbo_len * sizeof(float));
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_DRAW_TRIANGLES);
+    cmd.n[0] = offset;
+    cmd.n[1] = buf_vbo_len;
+    cmd.n[2] = buf_vbo_num_tris;
+    gfx_command_buffer_flush_after_draw();
+}
+
+static void gfx_command_buffer_draw_indexed_triangles(float buf_vbo[], size_t buf_vbo_len, const uint16_t buf_ibo[],
+                                                      size_t buf_ibo_len) {
+    size_t vbo_offset = gfx_command_buffer_copy(buf_vbo, buf_vbo_len * sizeof(float));
+    size_t ibo_offset = gfx_command_buffer_copy(buf_ibo, buf_ibo_len * sizeof(uint16_t));
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_DRAW_INDEXED_TRIANGLES);
+    cmd.n[0] = vbo_offset;
+    cmd.n[1] = buf_vbo_len;
+    cmd.n[2] = ibo_offset;
+    cmd.n[3] = buf_ibo_len;
+    gfx_command_buffer_flush_after_draw();
+}
+
+static void gfx_command_buffer_set_draw_constants(const struct GfxDrawConstants* constants) {
+    size_t offset = gfx_command_buffer_copy(constants, sizeof(*constants));
+    gfx_command_buffer_record(CB_SET_DRAW_CONSTANTS).n[0] = offset;
+}
+
+static uint32_t gfx_command_buffer_create_mesh(const float buf_vbo[], size_t buf_vbo_len, const uint32_t buf_ibo[],
+                                               size_t buf_ibo_len) {
+    uint32_t id = mesh_ids.allocate();
+    size_t vbo_offset = gfx_command_buffer_copy(buf_vbo, buf_vbo_len * sizeof(float));
+    size_t ibo_offset = gfx_command_buffer_copy(buf_ibo, buf_ibo_len * sizeof(uint32_t));
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_CREATE_MESH);
+    cmd.i[0] = id;
+    cmd.n[0] = vbo_offset;
+    cmd.n[1] = buf_vbo_len;
+    cmd.n[2] = ibo_offset;
+    cmd.n[3] = buf_ibo_len;
+    return id;
+}
+
+static void gfx_command_buffer_draw_mesh(uint32_t mesh_id, size_t vbo_offset, size_t ibo_offset, size_t ibo_len,
+                                         const struct GfxMeshTransform* transform) {
+    size_t transform_offset = gfx_command_buffer_copy(transform, sizeof(*transform));
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_DRAW_MESH);
+    cmd.i[0] = mesh_id;
+    cmd.n[0] = vbo_offset;
+    cmd.n[1] = ibo_offset;
+    cmd.n[2] = ibo_len;
+    cmd.n[3] = transform_offset;
+    gfx_command_buffer_flush_after_draw();
+}
+
+static void gfx_command_buffer_delete_mesh(uint32_t mesh_id) {
+    gfx_command_buffer_record(CB_DELETE_MESH).i[0] = mesh_id;
+    mesh_ids.free.push_back(mesh_id);
+}
+
+static void gfx_command_buffer_init_backend(void) {
+    gfx_command_buffer_sync();
+    backend->init();
+}
+
+static void gfx_command_buffer_on_resize(void) {
+    gfx_command_buffer_sync();
+    backend->on_resize();
+}
+
+static void gfx_command_buffer_start_frame(void) {
+    gfx_command_buffer_record(CB_START_FRAME);
+}
+
+// Ending a frame is followed by presenting it, which the window manager does on the game thread.
+static void gfx_command_buffer_end_frame(void) {
+    gfx_command_buffer_sync();
+    backend->end_frame();
+}
+
+static void gfx_command_buffer_finish_render(void) {
+    gfx_command_buffer_sync();
+    backend->finish_render();
+}
+
+static int gfx_command_buffer_create_framebuffer() {
+    gfx_command_buffer_sync();
+    return backend->create_framebuffer();
+}
+
+// May resize the swap chain, which is left to the game thread.
+static void gfx_command_buffer_update_framebuffer_parameters(int fb_id, uint32_t width, uint32_t height,
+                                                             uint32_t msaa_level, bool opengl_invert_y,
+                                                             bool render_target, bool has_depth_buffer,
+                                                             bool can_extract_depth) {
+    gfx_command_buffer_sync();
+    backend->update_framebuffer_parameters(fb_id, width, height, msaa_level, opengl_invert_y, render_target,
+                                           has_depth_buffer, can_extract_depth);
+}
+
+static void gfx_command_buffer_start_draw_to_framebuffer(int fb_id, float noise_scale) {
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_START_DRAW_TO_FRAMEBUFFER);
+    cmd.i[0] = fb_id;
+    cmd.f = noise_scale;
+}
+
+static void gfx_command_buffer_clear_framebuffer(void) {
+    gfx_command_buffer_record(CB_CLEAR_FRAMEBUFFER);
+}
+
+static void gfx_command_buffer_resolve_msaa_color_buffer(int fb_id_target, int fb_id_source) {
+    RecordedCommand& cmd = gfx_command_buffer_record(CB_RESOLVE_MSAA_COLOR_BUFFER);
+    cmd.i[0] = fb_id_target;
+    cmd.i[1] = fb_id_source;
+}
+
+static std::unordered_map<std::pair<float, float>, uint16_t, hash_pair_ff>
+gfx_command_buffer_get_pixel_depth(int fb_id, const std::set<std::pair<float, float>>& coordinates) {
+    gfx_command_buffer_sync();
+    return backend->get_pixel_depth(fb_id, coordinates);
+}
+
+static void* gfx_command_buffer_get_framebuffer_texture_id(int fb_id) {
+    gfx_command_buffer_sync();
+    return backend->get_framebuffer_texture_id(fb_id);
+}
+
+static void gfx_command_buffer_select_texture_fb(int fb_id) {
+    gfx_command_buffer_record(CB_SELECT_TEXTURE_FB).i[0] = fb_id;
+}
+
+static void gfx_command_buffer_delete_texture(uint32_t texID) {
+    gfx_command_buffer_record(CB_DELETE_TEXTURE).i[0] = texID;
+    texture_ids.free.push_back(texID);
+}
+
+static void gfx_command_buffer_set_texture_filter(FilteringMode mode) {
+    gfx_command_buffer_record(CB_SET_TEXTURE_FILTER).i[0] = mode;
+}
+
+static FilteringMode gfx_command_buffer_get_texture_filter(void) {
+    gfx_command_buffer_sync();
+    return backend->get_texture_filter();
+}
+
+// The optional members are filled in by gfx_command_buffer_init, according to what the backend has.
+struct GfxRenderingAPI gfx_command_buffer_api = { gfx_command_buffer_get_name,
+                                                  gfx_command_buffer_get_clip_parameters,
+                                                  gfx_command_buffer_unload_shader,
+                                                  gfx_command_buffer_load_shader,
+                                                  gfx_command_buffer_create_and_load_new_shader,
+                                                  gfx_command_buffer_lookup_shader,
+                                                  gfx_command_buffer_shader_get_info,
+                                                  gfx_command_buffer_new_texture,
+                                                  gfx_command_buffer_select_texture,
+                                                  gfx_command_buffer_upload_texture,
+                                                  gfx_command_buffer_set_sampler_parameters,
+                                                  gfx_command_buffer_set_depth_test_and_mask,
+                                                  gfx_command_buffer_set_zmode_decal,
+                                                  gfx_command_buffer_set_viewport,
+                                                  gfx_command_buffer_set_scissor,
+                                                  gfx_command_buffer_set_use_alpha,
+                                                  gfx_command_buffer_draw_triangles,
+                                                  nullptr,
+                                                  nullptr,
+                                                  nullptr,
+                                                  nullptr,
+                                                  nullptr,
+                                                  nullptr,
+                                                  gfx_command_buffer_init_backend,
+                                                  gfx_command_buffer_on_resize,
+                                                  gfx_command_buffer_start_frame,
+                                                  gfx_command_buffer_end_frame,
+                                                  gfx_command_buffer_finish_render,
+                                                  gfx_command_buffer_create_framebuffer,
+                                                  gfx_command_buffer_update_framebuffer_parameters,
+                                                  gfx_command_buffer_start_draw_to_framebuffer,
+                                                  gfx_command_buffer_clear_framebuffer,
+                                                  gfx_command_buffer_resolve_msaa_color_buffer,
+                                                  gfx_command_buffer_get_pixel_depth,
+                                                  gfx_command_buffer_get_framebuffer_texture_id,
+                                                  gfx_command_buffer_select_texture_fb,
+                                                  gfx_command_buffer_delete_texture,
+                                                  gfx_command_buffer_set_texture_filter,
+                                                  gfx_command_buffer_get_texture_filter };
+
+void gfx_command_buffer_init(struct GfxRenderingAPI* backend_api) {
+    backend = backend_api;
+    recording = std::make_unique<CommandChunk>();
+
+    // Vertices are copied into the command buffer anyway, so they are not written to mapped GPU memory
+    gfx_command_buffer_api.map_vertex_buffer = nullptr;
+    gfx_command_buffer_api.draw_indexed_triangles =
+        backend->draw_indexed_triangles != nullptr ? gfx_command_buffer_draw_indexed_triangles : nullptr;
+    gfx_command_buffer_api.set_draw_constants =
+        backend->set_draw_constants != nullptr ? gfx_command_buffer_set_draw_constants : nullptr;
+    bool meshes = backend->create_mesh != nullptr;
+    gfx_command_buffer_api.create_mesh = meshes ? gfx_command_buffer_create_mesh : nullptr;
+    gfx_command_buffer_api.draw_mesh = meshes ? gfx_command_buffer_draw_mesh : nullptr;
+    gfx_command_buffer_api.delete_mesh = meshes ? gfx_command_buffer_delete_mesh : nullptr;
+
+    submission_thread.thread = std::thread(gfx_command_buffer_thread_main);
+}
@@ -0,0 +1,32 @@
+#ifndef GFX_COMMAND_BUFFER_H
+#define GFX_COMMAND_BUFFER_H
+
+#include "gfx_rendering_api.h"
+
+// Rendering API that records the calls it gets into a command buffer, which a submission thread replays into the real
+// backend while the game thread goes on interpreting display lists. State changes, texture uploads and draws are
+// copied into the buffer. Calls whose result is used straight away are answered by the recorder where it can (shader
+// info, texture and mesh ids), and otherwise wait for the submission thread to catch up and call the backend
+// directly (framebuffer ids, depth reads, ending a frame). Texture, mesh and shader ids handed out by the recorder
+// are its own, so once it is used it has to be used for every call.
+
+struct GfxSubmissionStats {
+    uint32_t commands; // calls recorded for the submission thread
+    uint32_t syncs;    // times the game thread waited for the submission thread to catch up
+    double wait_ms;    // time spent waiting
+};
+
+extern struct GfxRenderingAPI gfx_command_buffer_api;
+
+// Whether backend can be driven from the submission thread. OpenGL contexts are bound to the window's thread and
+// Metal keeps a per thread autorelease pool open for each frame, so those draw on the game thread.
+bool gfx_command_buffer_supported(const struct GfxRenderingAPI* backend);
+// Starts the submission thread, which replays into backend.
+void gfx_command_buffer_init(struct GfxRenderingAPI* backend);
+// Waits until every call recorded so far has been replayed. Until the next recorded call, the backend and anything
+// sharing its device, like ImGui, can be used from the game thread.
+void gfx_command_buffer_sync(void);
+// Submission counts since the last call.
+struct GfxSubmissionStats gfx_command_buffer_take_stats(void);
+
+#endif
@@ -1102,6 +1102,12 @@ struct GfxRenderingAPI gfx_direct3d11_api = { gfx_d3d11_get_name,
                                               gfx_d3d11_set_scissor,
                                               gfx_d3d11_set_use_alpha,
                                               gfx_d3d11_draw_triangles,
+                                              nullptr,
+                                              nullptr,
+                                              nullptr,
+                                              nullptr,
+                                              nullptr,
+                                              nullptr,
                                               gfx_d3d11_init,
                                               gfx_d3d11_on_resize,
                                               gfx_d3d11_start_frame,
@@ -0,0 +1,286 @@
+#include "gfx_frame_capture.h"
+
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+
+#include "gfx_pc.h"
+
+// File layout, all in host byte order:
+//   FileHeader
+//   Gfx commands[num_commands]
+//   uint8_t data[data_size]
+//   FileRelocation relocations[num_relocations]
+//   FileMtxReplacement mtx_replacements[num_mtx_replacements]
+//   FileFramebuffer framebuffers[num_framebuffers]
+
+#define FRAME_CAPTURE_MAGIC "F3DFRAME"
+#define FRAME_CAPTURE_VERSION 1
+#define FRAME_CAPTURE_ALIGNMENT 16
+
+enum FileRelocationKind : uint32_t {
+    RELOCATION_COMMAND,    // commands[slot].w1 = data + target
+    RELOCATION_DATA,       // *(uintptr_t*)(data + slot) = data + target
+    RELOCATION_FRAMEBUFFER // commands[slot].w1 = id of recreated framebuffers[target]
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t num_commands;
+    uint32_t num_relocations;
+    uint32_t num_mtx_replacements;
+    uint32_t num_framebuffers;
+    uint64_t data_size;
+};
+
+struct FileRelocation {
+    uint32_t kind;
+    uint32_t padding;
+    uint64_t slot;
+    uint64_t target;
+};
+
+struct FileMtxReplacement {
+    uint64_t offset;
+    MtxF mtx;
+};
+
+struct FileFramebuffer {
+    uint32_t width, height;
+};
+
+struct CapturedRegion {
+    uintptr_t begin, end;
+    uint64_t offset;
+};
+
+void gfx_frame_capture_read(struct GfxFrameCapture* capture, const void* addr, size_t size) {
+    if (addr != nullptr && size != 0) {
+        capture->reads.emplace_back((uintptr_t)addr, (uintptr_t)addr + size);
+    }
+}
+
+void gfx_frame_capture_command(struct GfxFrameCapture* capture, const Gfx* cmd, size_t count) {
+    capture->commands.insert(capture->commands.end(), cmd, cmd + count);
+}
+
+void gfx_frame_capture_fixup_command(struct GfxFrameCapture* capture, uintptr_t w0, uintptr_t target,
+                                     GfxFrameCaptureFixupKind kind) {
+    Gfx cmd;
+    cmd.words.w0 = w0;
+    cmd.words.w1 = target;
+    capture->fixups.push_back({ kind, capture->commands.size(), target });
+    capture->commands.push_back(cmd);
+}
+
+void gfx_frame_capture_data_pointer(struct GfxFrameCapture* capture, const void* slot, const void* target) {
+    capture->data_pointers.emplace_back((uintptr_t)slot, (uintptr_t)target);
+}
+
+// Merges the recorded reads into regions laid out back to back. Regions are widened to 16 byte boundaries, which never
+// crosses into another page, so relocated pointers keep their alignment and the low bit seg_addr tests stays clear.
+static std::vector<CapturedRegion> gfx_frame_capture_layout(const struct GfxFrameCapture* capture,
+                                                            uint64_t* data_size) {
+    std::vector<std::pair<uintptr_t, uintptr_t>> reads = capture->reads;
+    std::sort(reads.begin(), reads.end());
+
+    std::vector<CapturedRegion> regions;
+    uint64_t offset = 0;
+    for (auto [begin, end] : reads) {
+        begin &= ~(uintptr_t)(FRAME_CAPTURE_ALIGNMENT - 1);
+        end = (end + FRAME_CAPTURE_ALIGNMENT - 1) & ~(uintptr_t)(FRAME_CAPTURE_ALIGNMENT - 1);
+        if (!regions.empty() && begin <= regions.back().end) {
+            if (end > regions.back().end) {
+                offset += end - regions.back().end;
+                regions.back().end = end;
+            }
+            continue;
+        }
+        regions.push_back({ begin, end, offset });
+        offset += end - begin;
+    }
+
+    *data_size = offset;
+    return regions;
+}
+
+static bool gfx_frame_capture_translate(const std::vector<CapturedRegion>& regions, uintptr_t addr,
+                                        uint64_t* offset) {
+    auto it = std::upper_bound(regions.begin(), regions.end(), addr,
+                               [](uintptr_t a, const CapturedRegion& region) { return a < region.begin; });
+    if (it == regions.begin() || addr >= (it - 1)->end) {
+        return false;
+    }
+    --it;
+    *offset = it->offset + (addr - it->begin);
+    return true;
+}
+
+bool gfx_frame_capture_write(const struct GfxFrameCapture* capture, const char* path) {
+    uint64_t data_size;
+    std::vector<CapturedRegion> regions = gfx_frame_capture_layout(capture, &data_size);
+
+    std::vector<uint8_t> data(data_size);
+    for (const CapturedRegion& region : regions) {
+        memcpy(data.data() + region.offset, (const void*)region.begin, region.end - region.begin);
+    }
+
+    std::vector<Gfx> commands = capture->commands;
+    std::vector<FileRelocation> relocations;
+    for (const GfxFrameCaptureFixup& fixup : capture->fixups) {
+        uint64_t target;
+        switch (fixup.kind) {
+            case FIXUP_POINTER:
+            case FIXUP_ADDRESS:
+                if (gfx_frame_capture_translate(regions, fixup.target, &target)) {
+                    relocations.push_back({ RELOCATION_COMMAND, 0, fixup.command_index, target });
+                } else if (fixup.kind == FIXUP_POINTER) {
+                    commands[fixup.command_index].words.w1 = 0;
+                }
+                break;
+            case FIXUP_FRAMEBUFFER:
+                for (size_t i = 0; i < capture->framebuffers.size(); i++) {
+                    if ((uintptr_t)capture->framebuffers[i].id == fixup.target) {
+                        relocations.push_back({ RELOCATION_FRAMEBUFFER, 0, fixup.command_index, i });
+                        break;
+                    }
+                }
+                break;
+        }
+    }
+
+    for (auto [slot, target] : capture->data_pointers) {
+        uint64_t slot_offset, target_offset;
+        if (!gfx_frame_capture_translate(regions, slot, &slot_offset) || slot_offset + sizeof(uintptr_t) > data_size) {
+            continue;
+        }
+        if (gfx_frame_capture_translate(regions, target, &target_offset)) {
+            relocations.push_back({ RELOCATION_DATA, 0, slot_offset, target_offset });
+        } else {
+            memset(data.data() + slot_offset, 0, sizeof(uintptr_t));
+        }
+    }
+
+    std::vector<FileMtxReplacement> mtx_replacements;
+    for (const auto& [mtx, replacement] : capture->mtx_replacements) {
+        uint64_t offset;
+        if (gfx_frame_capture_translate(regions, (uintptr_t)mtx, &offset)) {
+            mtx_replacements.push_back({ offset, replacement });
+        }
+    }
+
+    std::vector<FileFramebuffer> framebuffers;
+    for (const GfxFrameCaptureFramebuffer& fb : capture->framebuffers) {
+        framebuffers.push_back({ fb.width, fb.height });
+    }
+
+    FileHeader header = {};
+    memcpy(header.magic, FRAME_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = FRAME_CAPTURE_VERSION;
+    header.pointer_size = sizeof(uintptr_t);
+    header.num_commands = commands.size();
+    header.num_relocations = relocations.size();
+    header.num_mtx_replacements = mtx_replacements.size();
+    header.num_framebuffers = framebuffers.size();
+    header.data_size = data_size;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)commands.data(), commands.size() * sizeof(Gfx));
+    file.write((const char*)data.data(), data.size());
+    file.write((const char*)relocations.data(), relocations.size() * sizeof(FileRelocation));
+    file.write((const char*)mtx_replacements.data(), mtx_replacements.size() * sizeof(FileMtxReplacement));
+    file.write((const char*)framebuffers.data(), framebuffers.size() * sizeof(FileFramebuffer));
+    if (!file.good()) {
+        SPDLOG_ERROR("Failed to write frame capture {}", path);
+        return false;
+    }
+
+    SPDLOG_INFO("Captured {} commands and {} bytes of data to {}", commands.size(), data_size, path);
+    return true;
+}
+
+template <typename T> static bool gfx_frame_replay_read(std::ifstream& file, std::vector<T>& out, size_t count) {
+    out.resize(count);
+    file.read((char*)out.data(), count * sizeof(T));
+    return file.good();
+}
+
+bool gfx_frame_replay_load(struct GfxFrameReplay* replay, const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    FileHeader header;
+    file.read((char*)&header, sizeof(header));
+    if (!file.good() || memcmp(header.magic, FRAME_CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != FRAME_CAPTURE_VERSION || header.pointer_size != sizeof(uintptr_t)) {
+        SPDLOG_ERROR("{} is not a frame capture made by this build", path);
+        return false;
+    }
+
+    std::vector<FileRelocation> relocations;
+    std::vector<FileMtxReplacement> mtx_replacements;
+    std::vector<FileFramebuffer> framebuffers;
+    replay->data.resize((header.data_size + sizeof(GfxFrameReplay::Block) - 1) / sizeof(GfxFrameReplay::Block));
+    if (!gfx_frame_replay_read(file, replay->commands, header.num_commands) ||
+        !file.read((char*)replay->data.data(), header.data_size).good() ||
+        !gfx_frame_replay_read(file, relocations, header.num_relocations) ||
+        !gfx_frame_replay_read(file, mtx_replacements, header.num_mtx_replacements) ||
+        !gfx_frame_replay_read(file, framebuffers, header.num_framebuffers)) {
+        SPDLOG_ERROR("Frame capture {} is truncated", path);
+        return false;
+    }
+
+    // The interpreter stops at the end of the outermost display list, so a capture that lost its G_ENDDL is rejected
+    // rather than run off the end of the buffer.
+    if (replay->commands.empty() || (uint8_t)(replay->commands.back().words.w0 >> 24) != (uint8_t)G_ENDDL) {
+        SPDLOG_ERROR("Frame capture {} does not end its display list", path);
+        return false;
+    }
+
+    std::vector<int> framebuffer_ids;
+    for (const FileFramebuffer& fb : framebuffers) {
+        framebuffer_ids.push_back(gfx_create_framebuffer(fb.width, fb.height));
+    }
+
+    uint8_t* data = replay->data.data()->bytes;
+    for (const FileRelocation& relocation : relocations) {
+        uintptr_t value;
+        switch (relocation.kind) {
+            case RELOCATION_COMMAND:
+            case RELOCATION_DATA:
+                if (relocation.target >= header.data_size) {
+                    continue;
+                }
+                value = (uintptr_t)(data + relocation.target);
+                break;
+            case RELOCATION_FRAMEBUFFER:
+                if (relocation.target >= framebuffer_ids.size()) {
+                    continue;
+                }
+                value = framebuffer_ids[relocation.target];
+                break;
+            default:
+                continue;
+        }
+
+        if (relocation.kind == RELOCATION_DATA) {
+            if (relocation.slot + sizeof(uintptr_t) <= header.data_size) {
+                memcpy(data + relocation.slot, &value, sizeof(value));
+            }
+        } else if (relocation.slot < replay->commands.size()) {
+            replay->commands[relocation.slot].words.w1 = value;
+        }
+    }
+
+    replay->mtx_replacements.clear();
+    for (const FileMtxReplacement& replacement : mtx_replacements) {
+        if (replacement.offset < header.data_size) {
+            replay->mtx_replacements[(Mtx*)(data + replacement.offset)] = replacement.mtx;
+        }
+    }
+
+    return true;
+}
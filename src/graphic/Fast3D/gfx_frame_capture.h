@@ -0,0 +1,75 @@
+#ifndef GFX_FRAME_CAPTURE_H
+#define GFX_FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libultraship/libultra/gbi.h"
+#include "libultraship/libultra/types.h"
+
+// A frame capture holds the commands one gfx_run executed, flattened into a single display list, and a copy of every
+// vertex, matrix, light, viewport, texture and palette the interpreter read while running them. Display list calls,
+// segmented addresses and OTR references are resolved while capturing, so a replay needs neither the game nor its
+// archives. Loading a capture relocates its pointers, after which its commands can be passed to gfx_run any number of
+// times to profile the interpreter and the rendering backends on identical input.
+
+enum GfxFrameCaptureFixupKind {
+    FIXUP_POINTER,    // w1 points at captured data, or becomes null when nothing was read there
+    FIXUP_ADDRESS,    // w1 is an address that is only compared, kept as is when nothing was read there
+    FIXUP_FRAMEBUFFER // w1 is a framebuffer id from gfx_create_framebuffer
+};
+
+struct GfxFrameCaptureFixup {
+    GfxFrameCaptureFixupKind kind;
+    size_t command_index;
+    uintptr_t target;
+};
+
+struct GfxFrameCaptureFramebuffer {
+    int id;
+    uint32_t width, height;
+};
+
+struct GfxFrameCapture {
+    std::vector<Gfx> commands;
+    std::vector<GfxFrameCaptureFixup> fixups;
+    std::vector<std::pair<uintptr_t, uintptr_t>> reads;         // [begin, end) of memory the interpreter read
+    std::vector<std::pair<uintptr_t, uintptr_t>> data_pointers; // pointers stored inside captured memory
+    std::unordered_map<const Mtx*, MtxF> mtx_replacements;
+    std::vector<GfxFrameCaptureFramebuffer> framebuffers;
+};
+
+// Records that the interpreter read size bytes at addr, so they are copied into the capture.
+void gfx_frame_capture_read(struct GfxFrameCapture* capture, const void* addr, size_t size);
+
+// Appends count command words unchanged.
+void gfx_frame_capture_command(struct GfxFrameCapture* capture, const Gfx* cmd, size_t count);
+
+// Appends a command whose w1 is replaced with target, relocated as described by kind.
+void gfx_frame_capture_fixup_command(struct GfxFrameCapture* capture, uintptr_t w0, uintptr_t target,
+                                     GfxFrameCaptureFixupKind kind);
+
+// Records that the pointer stored at slot, inside memory read with gfx_frame_capture_read, points at target.
+void gfx_frame_capture_data_pointer(struct GfxFrameCapture* capture, const void* slot, const void* target);
+
+// Copies the recorded memory and writes the capture to path. The memory must still be valid when this is called.
+bool gfx_frame_capture_write(const struct GfxFrameCapture* capture, const char* path);
+
+struct GfxFrameReplay {
+    struct alignas(16) Block {
+        uint8_t bytes[16];
+    };
+
+    std::vector<Gfx> commands;
+    std::vector<Block> data;
+    std::unordered_map<Mtx*, MtxF> mtx_replacements;
+};
+
+// Loads a capture written by gfx_frame_capture_write on the same platform and relocates it. Framebuffers the frame drew
+// to are recreated with gfx_create_framebuffer, so gfx_init must have been called first.
+bool gfx_frame_replay_load(struct GfxFrameReplay* replay, const char* path);
+
+#endif
@@ -811,6 +811,12 @@ struct GfxRenderingAPI gfx_gx2_api = { gfx_gx2_get_name,
                                        gfx_gx2_set_scissor,
                                        gfx_gx2_set_use_alpha,
                                        gfx_gx2_draw_triangles,
+                                       nullptr,
+                                       nullptr,
+                                       nullptr,
+                                       nullptr,
+                                       nullptr,
+                                       nullptr,
                                        gfx_gx2_init,
                                        gfx_gx2_on_resize,
                                        gfx_gx2_start_frame,
@@ -0,0 +1,102 @@
+#ifndef GFX_HASH_POOL_H
+#define GFX_HASH_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <utility>
+#include <vector>
+
+// Mixes the bits of a 64-bit key, so that keys differing only in their high bits (like combiner ids differing in
+// the shader options) land in different slots.
+static inline size_t gfx_hash_mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key;
+}
+
+struct GfxShaderIdHash {
+    size_t operator()(const std::pair<uint64_t, uint32_t>& ids) const {
+        return gfx_hash_mix(ids.first ^ ((uint64_t)ids.second * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+struct GfxCombinerIdHash {
+    size_t operator()(uint64_t cc_id) const {
+        return gfx_hash_mix(cc_id);
+    }
+};
+
+// Insert only map for the combiner and shader pools, which are looked up on every state change. Keys are found by
+// linear probing in one flat array, instead of by walking a tree. The values are kept in a deque, so pointers to them
+// stay valid as the pool grows, as the renderers holding on to combiners and programs expect.
+template <typename Key, typename Value, typename Hash> class GfxHashPool {
+  public:
+    Value* find(const Key& key) const {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        size_t mask = slots.size() - 1;
+        for (size_t i = Hash()(key) & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.value == nullptr) {
+                return nullptr;
+            }
+            if (slot.key == key) {
+                return slot.value;
+            }
+        }
+    }
+
+    // Returns the value for key, default constructed if the pool did not have it.
+    Value* insert(const Key& key) {
+        Value* value = find(key);
+        if (value != nullptr) {
+            return value;
+        }
+        // Kept at most half full, so probes stay short
+        if ((values.size() + 1) * 2 > slots.size()) {
+            grow();
+        }
+        value = &values.emplace_back();
+        place(key, value);
+        return value;
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+  private:
+    struct Slot {
+        Key key;
+        Value* value = nullptr; // null for an empty slot
+    };
+
+    void place(const Key& key, Value* value) {
+        size_t mask = slots.size() - 1;
+        size_t i = Hash()(key) & mask;
+        while (slots[i].value != nullptr) {
+            i = (i + 1) & mask;
+        }
+        slots[i].key = key;
+        slots[i].value = value;
+    }
+
+    void grow() {
+        std::vector<Slot> old = std::move(slots);
+        slots.assign(old.empty() ? 64 : old.size() * 2, Slot());
+        for (const Slot& slot : old) {
+            if (slot.value != nullptr) {
+                place(slot.key, slot.value);
+            }
+        }
+    }
+
+    std::vector<Slot> slots; // a power of two in size
+    std::deque<Value> values;
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include "gfx_headless.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <utility>
+
+#include "gfx_cc.h"
+#include "menu/ImGuiImpl.h"
+
+#define GFX_API_NAME "Headless"
+
+struct ShaderProgram {
+    uint8_t num_inputs;
+    bool used_textures[2];
+};
+
+static struct GfxHeadlessStats stats;
+
+static std::map<std::pair<uint64_t, uint32_t>, struct ShaderProgram> shader_program_pool;
+static uint32_t next_texture_id = 1;
+static int next_framebuffer_id = 1;
+static uint32_t next_mesh_id = 1;
+static FilteringMode texture_filter = FILTER_THREE_POINT;
+
+static uint32_t window_width, window_height;
+static bool is_running = true;
+static std::chrono::steady_clock::time_point start_time;
+
+const struct GfxHeadlessStats* gfx_headless_get_stats(void) {
+    return &stats;
+}
+
+void gfx_headless_reset_stats(void) {
+    stats = {};
+}
+
+// MARK: - Rendering API
+
+static const char* gfx_headless_get_name(void) {
+    return GFX_API_NAME;
+}
+
+static struct GfxClipParameters gfx_headless_get_clip_parameters(void) {
+    return { false, false };
+}
+
+static void gfx_headless_unload_shader(struct ShaderProgram* old_prg) {
+}
+
+static void gfx_headless_load_shader(struct ShaderProgram* new_prg) {
+    stats.shader_binds++;
+}
+
+static struct ShaderProgram* gfx_headless_create_and_load_new_shader(uint64_t shader_id0, uint32_t shader_id1) {
+    struct CCFeatures cc_features;
+    gfx_cc_get_features(shader_id0, shader_id1, &cc_features);
+
+    struct ShaderProgram* prg = &shader_program_pool[std::make_pair(shader_id0, shader_id1)];
+    prg->num_inputs = cc_features.num_inputs;
+    prg->used_textures[0] = cc_features.used_textures[0];
+    prg->used_textures[1] = cc_features.used_textures[1];
+
+    stats.shaders_created++;
+    gfx_headless_load_shader(prg);
+    return prg;
+}
+
+static struct ShaderProgram* gfx_headless_lookup_shader(uint64_t shader_id0, uint32_t shader_id1) {
+    auto it = shader_program_pool.find(std::make_pair(shader_id0, shader_id1));
+    return it == shader_program_pool.end() ? nullptr : &it->second;
+}
+
+static void gfx_headless_shader_get_info(struct ShaderProgram* prg, uint8_t* num_inputs, bool used_textures[2]) {
+    *num_inputs = prg->num_inputs;
+    used_textures[0] = prg->used_textures[0];
+    used_textures[1] = prg->used_textures[1];
+}
+
+static uint32_t gfx_headless_new_texture(void) {
+    stats.textures_created++;
+    return next_texture_id++;
+}
+
+static void gfx_headless_select_texture(int tile, uint32_t texture_id) {
+    stats.texture_binds++;
+}
+
+static void gfx_headless_upload_texture(const uint8_t* rgba32_buf, uint32_t width, uint32_t height) {
+    stats.texture_uploads++;
+    stats.texture_upload_bytes += (uint64_t)width * height * 4;
+}
+
+static void gfx_headless_set_sampler_parameters(int sampler, bool linear_filter, uint32_t cms, uint32_t cmt) {
+    stats.sampler_changes++;
+}
+
+static void gfx_headless_set_depth_test_and_mask(bool depth_test, bool z_upd) {
+    stats.state_changes++;
+}
+
+static void gfx_headless_set_zmode_decal(bool zmode_decal) {
+    stats.state_changes++;
+}
+
+static void gfx_headless_set_viewport(int x, int y, int width, int height) {
+    stats.state_changes++;
+}
+
+static void gfx_headless_set_scissor(int x, int y, int width, int height) {
+    stats.state_changes++;
+}
+
+static void gfx_headless_set_use_alpha(bool use_alpha) {
+    stats.state_changes++;
+}
+
+static void gfx_headless_draw_triangles(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_tris) {
+    stats.draw_calls++;
+    stats.triangles += buf_vbo_num_tris;
+    stats.vertex_bytes += buf_vbo_len * sizeof(float);
+}
+
+static void gfx_headless_draw_indexed_triangles(float buf_vbo[], size_t buf_vbo_len, const uint16_t buf_ibo[],
+                                                size_t buf_ibo_len) {
+    stats.draw_calls++;
+    stats.triangles += buf_ibo_len / 3;
+    stats.vertex_bytes += buf_vbo_len * sizeof(float);
+    stats.index_bytes += buf_ibo_len * sizeof(uint16_t);
+}
+
+static void gfx_headless_set_draw_constants(const struct GfxDrawConstants* constants) {
+    stats.state_changes++;
+}
+
+static uint32_t gfx_headless_create_mesh(const float buf_vbo[], size_t buf_vbo_len, const uint32_t buf_ibo[],
+                                         size_t buf_ibo_len) {
+    stats.meshes_created++;
+    stats.mesh_bytes += buf_vbo_len * sizeof(float) + buf_ibo_len * sizeof(uint32_t);
+    return next_mesh_id++;
+}
+
+static void gfx_headless_draw_mesh(uint32_t mesh_id, size_t vbo_offset, size_t ibo_offset, size_t ibo_len,
+                                   const struct GfxMeshTransform* transform) {
+    stats.draw_calls++;
+    stats.mesh_draw_calls++;
+    stats.triangles += ibo_len / 3;
+}
+
+static void gfx_headless_delete_mesh(uint32_t mesh_id) {
+}
+
+static void gfx_headless_init(void) {
+}
+
+static void gfx_headless_on_resize(void) {
+}
+
+static void gfx_headless_start_frame(void) {
+}
+
+static void gfx_headless_end_frame(void) {
+}
+
+static void gfx_headless_finish_render(void) {
+}
+
+static int gfx_headless_create_framebuffer() {
+    stats.framebuffers_created++;
+    return next_framebuffer_id++;
+}
+
+static void gfx_headless_update_framebuffer_parameters(int fb_id, uint32_t width, uint32_t height,
+                                                       uint32_t msaa_level, bool opengl_invert_y, bool render_target,
+                                                       bool has_depth_buffer, bool can_extract_depth) {
+}
+
+static void gfx_headless_start_draw_to_framebuffer(int fb_id, float noise_scale) {
+    stats.framebuffer_binds++;
+}
+
+static void gfx_headless_clear_framebuffer(void) {
+    stats.framebuffer_clears++;
+}
+
+static void gfx_headless_resolve_msaa_color_buffer(int fb_id_target, int fb_id_source) {
+}
+
+static std::unordered_map<std::pair<float, float>, uint16_t, hash_pair_ff>
+gfx_headless_get_pixel_depth(int fb_id, const std::set<std::pair<float, float>>& coordinates) {
+    // There is no depth buffer, so report every pixel as being at the far plane.
+    std::unordered_map<std::pair<float, float>, uint16_t, hash_pair_ff> res;
+    for (const auto& coord : coordinates) {
+        res.emplace(coord, 0);
+    }
+    return res;
+}
+
+static void* gfx_headless_get_framebuffer_texture_id(int fb_id) {
+    return nullptr;
+}
+
+static void gfx_headless_select_texture_fb(int fb_id) {
+    stats.texture_binds++;
+}
+
+static void gfx_headless_delete_texture(uint32_t texID) {
+}
+
+static void gfx_headless_set_texture_filter(FilteringMode mode) {
+    texture_filter = mode;
+}
+
+static FilteringMode gfx_headless_get_texture_filter(void) {
+    return texture_filter;
+}
+
+struct GfxRenderingAPI gfx_headless_api = { gfx_headless_get_name,
+                                            gfx_headless_get_clip_parameters,
+                                            gfx_headless_unload_shader,
+                                            gfx_headless_load_shader,
+                                            gfx_headless_create_and_load_new_shader,
+                                            gfx_headless_lookup_shader,
+                                            gfx_headless_shader_get_info,
+                                            gfx_headless_new_texture,
+                                            gfx_headless_select_texture,
+                                            gfx_headless_upload_texture,
+                                            gfx_headless_set_sampler_parameters,
+                                            gfx_headless_set_depth_test_and_mask,
+                                            gfx_headless_set_zmode_decal,
+                                            gfx_headless_set_viewport,
+                                            gfx_headless_set_scissor,
+                                            gfx_headless_set_use_alpha,
+                                            gfx_headless_draw_triangles,
+                                            nullptr,
+                                            gfx_headless_draw_indexed_triangles,
+                                            gfx_headless_set_draw_constants,
+                                            gfx_headless_create_mesh,
+                                            gfx_headless_draw_mesh,
+                                            gfx_headless_delete_mesh,
+                                            gfx_headless_init,
+                                            gfx_headless_on_resize,
+                                            gfx_headless_start_frame,
+                                            gfx_headless_end_frame,
+                                            gfx_headless_finish_render,
+                                            gfx_headless_create_framebuffer,
+                                            gfx_headless_update_framebuffer_parameters,
+                                            gfx_headless_start_draw_to_framebuffer,
+                                            gfx_headless_clear_framebuffer,
+                                            gfx_headless_resolve_msaa_color_buffer,
+                                            gfx_headless_get_pixel_depth,
+                                            gfx_headless_get_framebuffer_texture_id,
+                                            gfx_headless_select_texture_fb,
+                                            gfx_headless_delete_texture,
+                                            gfx_headless_set_texture_filter,
+                                            gfx_headless_get_texture_filter };
+
+// MARK: - Window Manager API
+
+static void gfx_headless_wm_init(const char* game_name, const char* gfx_api_name, bool start_in_fullscreen,
+                                 uint32_t width, uint32_t height) {
+    window_width = width;
+    window_height = height;
+    start_time = std::chrono::steady_clock::now();
+
+    SohImGui::WindowImpl window_impl;
+    window_impl.Headless = { width, height };
+    window_impl.backend = SohImGui::Backend::HEADLESS;
+    SohImGui::Init(window_impl);
+}
+
+static void gfx_headless_wm_close(void) {
+    is_running = false;
+}
+
+static void gfx_headless_wm_set_keyboard_callbacks(bool (*on_key_down)(int scancode), bool (*on_key_up)(int scancode),
+                                                   void (*on_all_keys_up)(void)) {
+}
+
+static void gfx_headless_wm_set_fullscreen_changed_callback(void (*on_fullscreen_changed)(bool is_now_fullscreen)) {
+}
+
+static void gfx_headless_wm_set_fullscreen(bool enable) {
+}
+
+static void gfx_headless_wm_get_active_window_refresh_rate(uint32_t* refresh_rate) {
+    *refresh_rate = 60;
+}
+
+static void gfx_headless_wm_set_cursor_visibility(bool visible) {
+}
+
+static void gfx_headless_wm_main_loop(void (*run_one_game_iter)(void)) {
+    while (is_running) {
+        run_one_game_iter();
+    }
+}
+
+static void gfx_headless_wm_get_dimensions(uint32_t* width, uint32_t* height) {
+    *width = window_width;
+    *height = window_height;
+}
+
+static void gfx_headless_wm_handle_events(void) {
+}
+
+static bool gfx_headless_wm_start_frame(void) {
+    return true;
+}
+
+static void gfx_headless_wm_swap_buffers_begin(void) {
+    stats.frames++;
+}
+
+static void gfx_headless_wm_swap_buffers_end(void) {
+}
+
+static double gfx_headless_wm_get_time(void) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+static void gfx_headless_wm_set_target_fps(int fps) {
+    // Frames are never throttled, so benchmarks run as fast as the CPU allows.
+}
+
+static void gfx_headless_wm_set_maximum_frame_latency(int latency) {
+}
+
+static const char* gfx_headless_wm_get_key_name(int scancode) {
+    return "";
+}
+
+struct GfxWindowManagerAPI gfx_headless = { gfx_headless_wm_init,
+                                            gfx_headless_wm_close,
+                                            gfx_headless_wm_set_keyboard_callbacks,
+                                            gfx_headless_wm_set_fullscreen_changed_callback,
+                                            gfx_headless_wm_set_fullscreen,
+                                            gfx_headless_wm_get_active_window_refresh_rate,
+                                            gfx_headless_wm_set_cursor_visibility,
+                                            gfx_headless_wm_main_loop,
+                                            gfx_headless_wm_get_dimensions,
+                                            gfx_headless_wm_handle_events,
+                                            gfx_headless_wm_start_frame,
+                                            gfx_headless_wm_swap_buffers_begin,
+                                            gfx_headless_wm_swap_buffers_end,
+                                            gfx_headless_wm_get_time,
+                                            gfx_headless_wm_set_target_fps,
+                                            gfx_headless_wm_set_maximum_frame_latency,
+                                            gfx_headless_wm_get_key_name };
@@ -0,0 +1,45 @@
+#ifndef GFX_HEADLESS_H
+#define GFX_HEADLESS_H
+
+#include <stdint.h>
+
+#include "gfx_rendering_api.h"
+#include "gfx_window_manager_api.h"
+
+// Backend that opens no window and creates no GPU context. Every call is accepted and only counted, so the Fast3D
+// interpreter can be run and profiled on machines without a GPU. Selected with Window.GfxBackend = "headless".
+
+struct GfxHeadlessStats {
+    uint64_t frames;
+
+    uint64_t draw_calls;
+    uint64_t triangles;
+    uint64_t vertex_bytes;
+    uint64_t index_bytes;
+
+    uint64_t meshes_created;
+    uint64_t mesh_bytes;      // vertices and indices uploaded for retained meshes
+    uint64_t mesh_draw_calls; // of the draw calls, the ones drawing retained meshes
+
+    uint64_t textures_created;
+    uint64_t texture_uploads;
+    uint64_t texture_upload_bytes;
+    uint64_t texture_binds;
+    uint64_t sampler_changes;
+
+    uint64_t shaders_created;
+    uint64_t shader_binds;
+
+    uint64_t state_changes; // depth, decal, viewport, scissor, blending and draw constants
+    uint64_t framebuffers_created;
+    uint64_t framebuffer_binds;
+    uint64_t framebuffer_clears;
+};
+
+extern struct GfxRenderingAPI gfx_headless_api;
+extern struct GfxWindowManagerAPI gfx_headless;
+
+const struct GfxHeadlessStats* gfx_headless_get_stats(void);
+void gfx_headless_reset_stats(void);
+
+#endif
@@ -1039,6 +1039,12 @@ struct GfxRenderingAPI gfx_metal_api = { gfx_metal_get_name,
                                          gfx_metal_set_scissor,
                                          gfx_metal_set_use_alpha,
                                          gfx_metal_draw_triangles,
+                                         nullptr,
+                                         nullptr,
+                                         nullptr,
+                                         nullptr,
+                                         nullptr,
+                                         nullptr,
                                          gfx_metal_init,
                                          gfx_metal_on_resize,
                                          gfx_metal_start_frame,
@@ -5,8 +5,13 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include <filesystem>
+#include <fstream>
 #include <map>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #ifndef _LANGUAGE_C
 #define _LANGUAGE_C
@@ -42,11 +47,13 @@
 #endif
 
 #include "gfx_cc.h"
+#include "gfx_hash_pool.h"
 #include "gfx_rendering_api.h"
 #include "menu/ImGuiImpl.h"
 #include "core/Window.h"
 #include "gfx_pc.h"
 #include <core/bridge/consolevariablebridge.h>
+#include <StrHash64.h>
 
 using namespace std;
 
@@ -54,12 +61,18 @@ struct ShaderProgram {
     GLuint opengl_program_id;
     uint8_t num_inputs;
     bool used_textures[2];
-    uint8_t num_floats;
+    uint8_t num_floats; // vertex size in 32-bit words
     GLint attrib_locations[16];
     uint8_t attrib_sizes[16];
+    GLenum attrib_types[16]; // GL_FLOAT, or GL_UNSIGNED_BYTE for normalized bytes packed into one word
     uint8_t num_attribs;
     GLint frame_count_location;
     GLint noise_scale_location;
+    GLint fog_color_location;
+    GLint grayscale_color_location;
+    GLint tex_clamp_locations[2];
+    GLint mesh_transform_location;
+    GLint mesh_fog_location;
 };
 
 struct Framebuffer {
@@ -71,8 +84,60 @@ struct Framebuffer {
     GLuint fbo, clrbuf, clrbuf_msaa, rbo;
 };
 
-static map<pair<uint64_t, uint32_t>, struct ShaderProgram> shader_program_pool;
+// Vertices are streamed through a ring buffer split into sections. A fence is placed when writing leaves a section and
+// waited on before writing enters it again, so a section is never overwritten while the GPU may still read it.
+#define VERTEX_RING_SIZE (4 * 1024 * 1024)
+#define VERTEX_RING_SECTIONS 4
+#define VERTEX_RING_SECTION_SIZE (VERTEX_RING_SIZE / VERTEX_RING_SECTIONS)
+
+struct VertexRing {
+    bool enabled;
+    bool persistent; // mapped once with ARB_buffer_storage, otherwise mapped per batch with glMapBufferRange
+    GLuint vbo;
+    uint8_t* persistent_ptr;
+    float* mapped_ptr; // memory handed out by the last map_vertex_buffer call
+    size_t head;
+    size_t section;
+    GLsync fences[VERTEX_RING_SECTIONS];
+};
+
+// Vertices and indices of a retained mesh, uploaded once and drawn with draw_mesh
+struct Mesh {
+    GLuint vbo, ibo;
+};
+
+static const float identity_transform[4][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+
+// Linked programs are appended to this file with glGetProgramBinary when gShaderCache is set, so the shaders gfx_pc
+// creates again in later sessions are loaded instead of compiled. Binaries only load into the driver that made them,
+// so the file starts with the driver's strings and is emptied when they change. Each binary is stored under a hash of
+// the GLSL it was linked from, since that depends on the texture filter and the generator as well as the shader ids.
+#define PROGRAM_BINARY_CACHE_FILE "shader_cache_opengl.bin"
+#define PROGRAM_BINARY_CACHE_MAGIC "LUSGLPB2"
+
+struct ProgramBinaryHeader {
+    uint64_t source_hash; // of the vertex shader followed by the fragment shader
+    uint32_t format;
+    uint32_t length; // of the binary that follows
+};
+
+struct ProgramBinaryCache {
+    bool enabled;
+    unordered_map<uint64_t, pair<GLenum, vector<uint8_t>>> binaries; // read from the file and not yet used
+    unordered_set<uint64_t> stored; // sources the file has a binary for, which are not appended again
+    ofstream file;
+};
+
+static GfxHashPool<pair<uint64_t, uint32_t>, struct ShaderProgram, GfxShaderIdHash> shader_program_pool;
+static struct ProgramBinaryCache program_binary_cache;
+static unordered_map<uint32_t, struct Mesh> meshes;
+static uint32_t next_mesh_id = 1;
 static GLuint opengl_vbo;
+static GLuint opengl_ibo;
+static struct VertexRing vertex_ring;
+static struct ShaderProgram* current_program;
+static size_t current_attribs_offset;
+static struct GfxDrawConstants draw_constants;
 #ifdef __APPLE__
 static GLuint opengl_vao;
 #endif
@@ -96,21 +161,39 @@ static struct GfxClipParameters gfx_opengl_get_clip_parameters(void) {
     return { false, framebuffers[current_framebuffer].invert_y };
 }
 
-static void gfx_opengl_vertex_array_set_attribs(struct ShaderProgram* prg) {
+static void gfx_opengl_vertex_array_set_attribs(struct ShaderProgram* prg, size_t offset) {
     size_t num_floats = prg->num_floats;
     size_t pos = 0;
 
     for (int i = 0; i < prg->num_attribs; i++) {
+        bool is_float = prg->attrib_types[i] == GL_FLOAT;
         glEnableVertexAttribArray(prg->attrib_locations[i]);
-        glVertexAttribPointer(prg->attrib_locations[i], prg->attrib_sizes[i], GL_FLOAT, GL_FALSE,
-                              num_floats * sizeof(float), (void*)(pos * sizeof(float)));
-        pos += prg->attrib_sizes[i];
+        glVertexAttribPointer(prg->attrib_locations[i], prg->attrib_sizes[i], prg->attrib_types[i],
+                              is_float ? GL_FALSE : GL_TRUE, num_floats * sizeof(float),
+                              (void*)(offset + pos * sizeof(float)));
+        pos += is_float ? prg->attrib_sizes[i] : 1;
+    }
+    current_attribs_offset = offset;
+}
+
+static void gfx_opengl_set_draw_constant_uniforms(struct ShaderProgram* prg) {
+    if (prg->fog_color_location != -1) {
+        glUniform3fv(prg->fog_color_location, 1, draw_constants.fog_color);
+    }
+    if (prg->grayscale_color_location != -1) {
+        glUniform4fv(prg->grayscale_color_location, 1, draw_constants.grayscale_color);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (prg->tex_clamp_locations[i] != -1) {
+            glUniform2fv(prg->tex_clamp_locations[i], 1, draw_constants.tex_clamp[i]);
+        }
     }
 }
 
 static void gfx_opengl_set_uniforms(struct ShaderProgram* prg) {
     glUniform1i(prg->frame_count_location, frame_count);
     glUniform1f(prg->noise_scale_location, current_noise_scale);
+    gfx_opengl_set_draw_constant_uniforms(prg);
 }
 
 static void gfx_opengl_unload_shader(struct ShaderProgram* old_prg) {
@@ -124,7 +207,8 @@ static void gfx_opengl_unload_shader(struct ShaderProgram* old_prg) {
 static void gfx_opengl_load_shader(struct ShaderProgram* new_prg) {
     // if (!new_prg) return;
     glUseProgram(new_prg->opengl_program_id);
-    gfx_opengl_vertex_array_set_attribs(new_prg);
+    gfx_opengl_vertex_array_set_attribs(new_prg, vertex_ring.enabled ? vertex_ring.head : 0);
+    current_program = new_prg;
     gfx_opengl_set_uniforms(new_prg);
 }
 
@@ -238,11 +322,91 @@ static void append_formula(char* buf, size_t* len, uint8_t c[2][4], bool do_sing
     }
 }
 
+static GLuint gfx_opengl_compile_program(const GLchar* sources[2], const GLint lengths[2]) {
+    GLint success;
+
+    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertex_shader, 1, &sources[0], &lengths[0]);
+    glCompileShader(vertex_shader);
+    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        GLint max_length = 0;
+        glGetShaderiv(vertex_shader, GL_INFO_LOG_LENGTH, &max_length);
+        char error_log[1024];
+        // fprintf(stderr, "Vertex shader compilation failed\n");
+        glGetShaderInfoLog(vertex_shader, max_length, &max_length, &error_log[0]);
+        // fprintf(stderr, "%s\n", &error_log[0]);
+        abort();
+    }
+
+    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment_shader, 1, &sources[1], &lengths[1]);
+    glCompileShader(fragment_shader);
+    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        GLint max_length = 0;
+        glGetShaderiv(fragment_shader, GL_INFO_LOG_LENGTH, &max_length);
+        char error_log[1024];
+        fprintf(stderr, "Fragment shader compilation failed\n");
+        glGetShaderInfoLog(fragment_shader, max_length, &max_length, &error_log[0]);
+        fprintf(stderr, "%s\n", &error_log[0]);
+        abort();
+    }
+
+    GLuint shader_program = glCreateProgram();
+    glAttachShader(shader_program, vertex_shader);
+    glAttachShader(shader_program, fragment_shader);
+    if (program_binary_cache.enabled) {
+        glProgramParameteri(shader_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(shader_program);
+    return shader_program;
+}
+
+// Links a program from the binary cached for the source, if there is one the driver accepts. Returns 0 otherwise.
+static GLuint gfx_opengl_load_program_binary(uint64_t source_hash) {
+    auto it = program_binary_cache.binaries.find(source_hash);
+    if (it == program_binary_cache.binaries.end()) {
+        return 0;
+    }
+    GLuint shader_program = glCreateProgram();
+    glProgramBinary(shader_program, it->second.first, it->second.second.data(), it->second.second.size());
+    program_binary_cache.binaries.erase(it);
+
+    GLint success;
+    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(shader_program);
+        program_binary_cache.stored.erase(source_hash);
+        return 0;
+    }
+    return shader_program;
+}
+
+static void gfx_opengl_save_program_binary(uint64_t source_hash, GLuint shader_program) {
+    if (!program_binary_cache.file.is_open() || !program_binary_cache.stored.insert(source_hash).second) {
+        return;
+    }
+    GLint length = 0;
+    glGetProgramiv(shader_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    vector<uint8_t> binary(length);
+    GLenum format;
+    glGetProgramBinary(shader_program, length, &length, &format, binary.data());
+
+    struct ProgramBinaryHeader header = { source_hash, format, (uint32_t)length };
+    program_binary_cache.file.write((const char*)&header, sizeof(header));
+    program_binary_cache.file.write((const char*)binary.data(), length);
+    program_binary_cache.file.flush();
+}
+
 static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shader_id0, uint32_t shader_id1) {
     struct CCFeatures cc_features;
     gfx_cc_get_features(shader_id0, shader_id1, &cc_features);
 
-    char vs_buf[1024];
+    char vs_buf[2048];
     char fs_buf[3000];
     size_t vs_len = 0;
     size_t fs_len = 0;
@@ -266,41 +430,20 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
             vs_len += sprintf(vs_buf + vs_len, "varying vec2 vTexCoord%d;\n", i);
 #endif
             num_floats += 2;
-            for (int j = 0; j < 2; j++) {
-                if (cc_features.clamp[i][j]) {
-#ifdef __APPLE__
-                    vs_len += sprintf(vs_buf + vs_len, "in float aTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-                    vs_len += sprintf(vs_buf + vs_len, "out float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-#else
-                    vs_len += sprintf(vs_buf + vs_len, "attribute float aTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-                    vs_len += sprintf(vs_buf + vs_len, "varying float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-#endif
-                    num_floats += 1;
-                }
-            }
         }
     }
     if (cc_features.opt_fog) {
 #ifdef __APPLE__
-        append_line(vs_buf, &vs_len, "in vec4 aFog;");
-        append_line(vs_buf, &vs_len, "out vec4 vFog;");
+        append_line(vs_buf, &vs_len, "in vec2 aFogFactor;");
+        append_line(vs_buf, &vs_len, "out float vFogFactor;");
 #else
-        append_line(vs_buf, &vs_len, "attribute vec4 aFog;");
-        append_line(vs_buf, &vs_len, "varying vec4 vFog;");
+        append_line(vs_buf, &vs_len, "attribute vec2 aFogFactor;");
+        append_line(vs_buf, &vs_len, "varying float vFogFactor;");
 #endif
-        num_floats += 4;
-    }
-
-    if (cc_features.opt_grayscale) {
-#ifdef __APPLE__
-        append_line(vs_buf, &vs_len, "in vec4 aGrayscaleColor;");
-        append_line(vs_buf, &vs_len, "out vec4 vGrayscaleColor;");
-#else
-        append_line(vs_buf, &vs_len, "attribute vec4 aGrayscaleColor;");
-        append_line(vs_buf, &vs_len, "varying vec4 vGrayscaleColor;");
-#endif
-        num_floats += 4;
+        append_line(vs_buf, &vs_len, "uniform vec2 uMeshFog;");
+        num_floats += 1;
     }
+    append_line(vs_buf, &vs_len, "uniform mat4 uMeshTransform;");
 
     for (int i = 0; i < cc_features.num_inputs; i++) {
 #ifdef __APPLE__
@@ -310,30 +453,29 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
         vs_len += sprintf(vs_buf + vs_len, "attribute vec%d aInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
         vs_len += sprintf(vs_buf + vs_len, "varying vec%d vInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
 #endif
-        num_floats += cc_features.opt_alpha ? 4 : 3;
+        num_floats += 1;
     }
     append_line(vs_buf, &vs_len, "void main() {");
     for (int i = 0; i < 2; i++) {
         if (cc_features.used_textures[i]) {
             vs_len += sprintf(vs_buf + vs_len, "vTexCoord%d = aTexCoord%d;\n", i, i);
-            for (int j = 0; j < 2; j++) {
-                if (cc_features.clamp[i][j]) {
-                    vs_len += sprintf(vs_buf + vs_len, "vTexClamp%s%d = aTexClamp%s%d;\n", j == 0 ? "S" : "T", i,
-                                      j == 0 ? "S" : "T", i);
-                }
-            }
         }
     }
-    if (cc_features.opt_fog) {
-        append_line(vs_buf, &vs_len, "vFog = aFog;");
-    }
-    if (cc_features.opt_grayscale) {
-        append_line(vs_buf, &vs_len, "vGrayscaleColor = aGrayscaleColor;");
-    }
     for (int i = 0; i < cc_features.num_inputs; i++) {
         vs_len += sprintf(vs_buf + vs_len, "vInput%d = aInput%d;\n", i + 1, i + 1);
     }
-    append_line(vs_buf, &vs_len, "gl_Position = aVtxPos;");
+    append_line(vs_buf, &vs_len, "gl_Position = uMeshTransform * aVtxPos;");
+    if (cc_features.opt_fog) {
+        // Mesh vertices flagged in the second byte get their fog factor computed here, the way gfx_pc does on the CPU
+        append_line(vs_buf, &vs_len, "if (aFogFactor.y > 0.5) {");
+        append_line(vs_buf, &vs_len, "    float w = abs(gl_Position.w) < 0.001 ? 0.001 : gl_Position.w;");
+        append_line(vs_buf, &vs_len, "    float winv = w < 0.0 ? 32767.0 : 1.0 / w;");
+        append_line(vs_buf, &vs_len, "    float fog = gl_Position.z * winv * uMeshFog.x + uMeshFog.y;");
+        append_line(vs_buf, &vs_len, "    vFogFactor = floor(clamp(fog, 0.0, 255.0)) / 255.0;");
+        append_line(vs_buf, &vs_len, "} else {");
+        append_line(vs_buf, &vs_len, "    vFogFactor = aFogFactor.x;");
+        append_line(vs_buf, &vs_len, "}");
+    }
     append_line(vs_buf, &vs_len, "}");
 
     // Fragment shader
@@ -350,30 +492,21 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
 #else
             fs_len += sprintf(fs_buf + fs_len, "varying vec2 vTexCoord%d;\n", i);
 #endif
-            for (int j = 0; j < 2; j++) {
-                if (cc_features.clamp[i][j]) {
-#ifdef __APPLE__
-                    fs_len += sprintf(fs_buf + fs_len, "in float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-#else
-                    fs_len += sprintf(fs_buf + fs_len, "varying float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-#endif
-                }
+            if (cc_features.clamp[i][0] || cc_features.clamp[i][1]) {
+                fs_len += sprintf(fs_buf + fs_len, "uniform vec2 uTexClamp%d;\n", i);
             }
         }
     }
     if (cc_features.opt_fog) {
 #ifdef __APPLE__
-        append_line(fs_buf, &fs_len, "in vec4 vFog;");
+        append_line(fs_buf, &fs_len, "in float vFogFactor;");
 #else
-        append_line(fs_buf, &fs_len, "varying vec4 vFog;");
+        append_line(fs_buf, &fs_len, "varying float vFogFactor;");
 #endif
+        append_line(fs_buf, &fs_len, "uniform vec3 uFogColor;");
     }
     if (cc_features.opt_grayscale) {
-#ifdef __APPLE__
-        append_line(fs_buf, &fs_len, "in vec4 vGrayscaleColor;");
-#else
-        append_line(fs_buf, &fs_len, "varying vec4 vGrayscaleColor;");
-#endif
+        append_line(fs_buf, &fs_len, "uniform vec4 uGrayscaleColor;");
     }
     for (int i = 0; i < cc_features.num_inputs; i++) {
 #ifdef __APPLE__
@@ -447,17 +580,17 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
                 if (s && t) {
                     fs_len += sprintf(fs_buf + fs_len,
                                       "vec4 texVal%d = hookTexture2D(uTex%d, clamp(vTexCoord%d, 0.5 / texSize%d, "
-                                      "vec2(vTexClampS%d, vTexClampT%d)), texSize%d);\n",
-                                      i, i, i, i, i, i, i);
+                                      "uTexClamp%d), texSize%d);\n",
+                                      i, i, i, i, i, i);
                 } else if (s) {
                     fs_len += sprintf(fs_buf + fs_len,
                                       "vec4 texVal%d = hookTexture2D(uTex%d, vec2(clamp(vTexCoord%d.s, 0.5 / "
-                                      "texSize%d.s, vTexClampS%d), vTexCoord%d.t), texSize%d);\n",
+                                      "texSize%d.s, uTexClamp%d.s), vTexCoord%d.t), texSize%d);\n",
                                       i, i, i, i, i, i, i);
                 } else {
                     fs_len += sprintf(fs_buf + fs_len,
                                       "vec4 texVal%d = hookTexture2D(uTex%d, vec2(vTexCoord%d.s, clamp(vTexCoord%d.t, "
-                                      "0.5 / texSize%d.t, vTexClampT%d)), texSize%d);\n",
+                                      "0.5 / texSize%d.t, uTexClamp%d.t)), texSize%d);\n",
                                       i, i, i, i, i, i, i);
                 }
             }
@@ -492,9 +625,9 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
     // TODO discard if alpha is 0?
     if (cc_features.opt_fog) {
         if (cc_features.opt_alpha) {
-            append_line(fs_buf, &fs_len, "texel = vec4(mix(texel.rgb, vFog.rgb, vFog.a), texel.a);");
+            append_line(fs_buf, &fs_len, "texel = vec4(mix(texel.rgb, uFogColor, vFogFactor), texel.a);");
         } else {
-            append_line(fs_buf, &fs_len, "texel = mix(texel, vFog.rgb, vFog.a);");
+            append_line(fs_buf, &fs_len, "texel = mix(texel, uFogColor, vFogFactor);");
         }
     }
 
@@ -510,8 +643,8 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
 
     if (cc_features.opt_grayscale) {
         append_line(fs_buf, &fs_len, "float intensity = (texel.r + texel.g + texel.b) / 3.0;");
-        append_line(fs_buf, &fs_len, "vec3 new_texel = vGrayscaleColor.rgb * intensity;");
-        append_line(fs_buf, &fs_len, "texel.rgb = mix(texel.rgb, new_texel, vGrayscaleColor.a);");
+        append_line(fs_buf, &fs_len, "vec3 new_texel = uGrayscaleColor.rgb * intensity;");
+        append_line(fs_buf, &fs_len, "texel.rgb = mix(texel.rgb, new_texel, uGrayscaleColor.a);");
     }
 
     if (cc_features.opt_alpha) {
@@ -546,46 +679,23 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
 
     const GLchar* sources[2] = { vs_buf, fs_buf };
     const GLint lengths[2] = { (GLint)vs_len, (GLint)fs_len };
-    GLint success;
-
-    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &sources[0], &lengths[0]);
-    glCompileShader(vertex_shader);
-    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        GLint max_length = 0;
-        glGetShaderiv(vertex_shader, GL_INFO_LOG_LENGTH, &max_length);
-        char error_log[1024];
-        // fprintf(stderr, "Vertex shader compilation failed\n");
-        glGetShaderInfoLog(vertex_shader, max_length, &max_length, &error_log[0]);
-        // fprintf(stderr, "%s\n", &error_log[0]);
-        abort();
+    uint64_t source_hash = 0;
+    GLuint shader_program = 0;
+    if (program_binary_cache.enabled) {
+        source_hash = update_crc64(fs_buf, fs_len, update_crc64(vs_buf, vs_len, INITIAL_CRC64));
+        shader_program = gfx_opengl_load_program_binary(source_hash);
     }
-
-    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &sources[1], &lengths[1]);
-    glCompileShader(fragment_shader);
-    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        GLint max_length = 0;
-        glGetShaderiv(fragment_shader, GL_INFO_LOG_LENGTH, &max_length);
-        char error_log[1024];
-        fprintf(stderr, "Fragment shader compilation failed\n");
-        glGetShaderInfoLog(fragment_shader, max_length, &max_length, &error_log[0]);
-        fprintf(stderr, "%s\n", &error_log[0]);
-        abort();
+    if (shader_program == 0) {
+        shader_program = gfx_opengl_compile_program(sources, lengths);
+        gfx_opengl_save_program_binary(source_hash, shader_program);
     }
 
-    GLuint shader_program = glCreateProgram();
-    glAttachShader(shader_program, vertex_shader);
-    glAttachShader(shader_program, fragment_shader);
-    glLinkProgram(shader_program);
-
     size_t cnt = 0;
 
-    struct ShaderProgram* prg = &shader_program_pool[make_pair(shader_id0, shader_id1)];
+    struct ShaderProgram* prg = shader_program_pool.insert(make_pair(shader_id0, shader_id1));
     prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aVtxPos");
     prg->attrib_sizes[cnt] = 4;
+    prg->attrib_types[cnt] = GL_FLOAT;
     ++cnt;
 
     for (int i = 0; i < 2; i++) {
@@ -594,28 +704,15 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
             sprintf(name, "aTexCoord%d", i);
             prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, name);
             prg->attrib_sizes[cnt] = 2;
+            prg->attrib_types[cnt] = GL_FLOAT;
             ++cnt;
-
-            for (int j = 0; j < 2; j++) {
-                if (cc_features.clamp[i][j]) {
-                    sprintf(name, "aTexClamp%s%d", j == 0 ? "S" : "T", i);
-                    prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, name);
-                    prg->attrib_sizes[cnt] = 1;
-                    ++cnt;
-                }
-            }
         }
     }
 
     if (cc_features.opt_fog) {
-        prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aFog");
-        prg->attrib_sizes[cnt] = 4;
-        ++cnt;
-    }
-
-    if (cc_features.opt_grayscale) {
-        prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aGrayscaleColor");
-        prg->attrib_sizes[cnt] = 4;
+        prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aFogFactor");
+        prg->attrib_sizes[cnt] = 2;
+        prg->attrib_types[cnt] = GL_UNSIGNED_BYTE;
         ++cnt;
     }
 
@@ -624,6 +721,7 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
         sprintf(name, "aInput%d", i + 1);
         prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, name);
         prg->attrib_sizes[cnt] = cc_features.opt_alpha ? 4 : 3;
+        prg->attrib_types[cnt] = GL_UNSIGNED_BYTE;
         ++cnt;
     }
 
@@ -633,9 +731,20 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
     prg->used_textures[1] = cc_features.used_textures[1];
     prg->num_floats = num_floats;
     prg->num_attribs = cnt;
+    prg->frame_count_location = glGetUniformLocation(shader_program, "frame_count");
+    prg->noise_scale_location = glGetUniformLocation(shader_program, "noise_scale");
+    prg->fog_color_location = glGetUniformLocation(shader_program, "uFogColor");
+    prg->grayscale_color_location = glGetUniformLocation(shader_program, "uGrayscaleColor");
+    prg->tex_clamp_locations[0] = glGetUniformLocation(shader_program, "uTexClamp0");
+    prg->tex_clamp_locations[1] = glGetUniformLocation(shader_program, "uTexClamp1");
+    prg->mesh_transform_location = glGetUniformLocation(shader_program, "uMeshTransform");
+    prg->mesh_fog_location = glGetUniformLocation(shader_program, "uMeshFog");
 
     gfx_opengl_load_shader(prg);
 
+    // Vertices streamed by draw_triangles are already in clip space
+    glUniformMatrix4fv(prg->mesh_transform_location, 1, GL_FALSE, &identity_transform[0][0]);
+
     if (cc_features.used_textures[0]) {
         GLint sampler_location = glGetUniformLocation(shader_program, "uTex0");
         glUniform1i(sampler_location, 0);
@@ -645,15 +754,11 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
         glUniform1i(sampler_location, 1);
     }
 
-    prg->frame_count_location = glGetUniformLocation(shader_program, "frame_count");
-    prg->noise_scale_location = glGetUniformLocation(shader_program, "noise_scale");
-
     return prg;
 }
 
 static struct ShaderProgram* gfx_opengl_lookup_shader(uint64_t shader_id0, uint32_t shader_id1) {
-    auto it = shader_program_pool.find(make_pair(shader_id0, shader_id1));
-    return it == shader_program_pool.end() ? nullptr : &it->second;
+    return shader_program_pool.find(make_pair(shader_id0, shader_id1));
 }
 
 static void gfx_opengl_shader_get_info(struct ShaderProgram* prg, uint8_t* num_inputs, bool used_textures[2]) {
@@ -761,6 +866,13 @@ static void gfx_opengl_set_scissor(int x, int y, int width, int height) {
     glScissor(x, y, width, height);
 }
 
+static void gfx_opengl_set_draw_constants(const struct GfxDrawConstants* constants) {
+    draw_constants = *constants;
+    if (current_program != nullptr) {
+        gfx_opengl_set_draw_constant_uniforms(current_program);
+    }
+}
+
 static void gfx_opengl_set_use_alpha(bool use_alpha) {
     if (use_alpha) {
         glEnable(GL_BLEND);
@@ -769,10 +881,264 @@ static void gfx_opengl_set_use_alpha(bool use_alpha) {
     }
 }
 
+static void gfx_opengl_vertex_ring_wait(size_t section) {
+    GLsync fence = vertex_ring.fences[section];
+    if (fence == 0) {
+        return;
+    }
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(fence);
+    vertex_ring.fences[section] = 0;
+}
+
+static void gfx_opengl_vertex_ring_enter_section(size_t section) {
+    vertex_ring.fences[vertex_ring.section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    vertex_ring.section = section;
+    gfx_opengl_vertex_ring_wait(section);
+}
+
+static float* gfx_opengl_map_vertex_buffer(size_t max_buf_vbo_len) {
+    if (!vertex_ring.enabled) {
+        return nullptr;
+    }
+
+    size_t size = max_buf_vbo_len * sizeof(float);
+    if (vertex_ring.head + size > VERTEX_RING_SIZE) {
+        gfx_opengl_vertex_ring_enter_section(0);
+        vertex_ring.head = 0;
+    }
+    size_t last_section = (vertex_ring.head + size - 1) / VERTEX_RING_SECTION_SIZE;
+    while (vertex_ring.section < last_section) {
+        gfx_opengl_vertex_ring_enter_section(vertex_ring.section + 1);
+    }
+
+    if (vertex_ring.persistent) {
+        vertex_ring.mapped_ptr = (float*)(vertex_ring.persistent_ptr + vertex_ring.head);
+    } else {
+        // Sections still in use are protected by the fences, so the driver does not need to synchronize
+        vertex_ring.mapped_ptr = (float*)glMapBufferRange(GL_ARRAY_BUFFER, vertex_ring.head, size,
+                                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                                              GL_MAP_FLUSH_EXPLICIT_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (vertex_ring.mapped_ptr == nullptr) {
+            // Stream with glBufferData from now on
+            vertex_ring.enabled = false;
+            glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
+            if (current_program != nullptr) {
+                gfx_opengl_vertex_array_set_attribs(current_program, 0);
+            }
+        }
+    }
+    return vertex_ring.mapped_ptr;
+}
+
+// Makes buf_vbo the source of the next draw. Returns how far the ring head must move once the draw is issued.
+static size_t gfx_opengl_prepare_vertices(float buf_vbo[], size_t buf_vbo_len) {
+    size_t size = sizeof(float) * buf_vbo_len;
+    if (vertex_ring.enabled && buf_vbo == vertex_ring.mapped_ptr) {
+        if (!vertex_ring.persistent) {
+            glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, size);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        vertex_ring.mapped_ptr = nullptr;
+
+        // The vertices start part way into the buffer, so point the attributes there instead of passing a first
+        // vertex, since the offset need not be a multiple of the vertex size
+        if (current_attribs_offset != vertex_ring.head) {
+            gfx_opengl_vertex_array_set_attribs(current_program, vertex_ring.head);
+        }
+        return (size + 15) & ~(size_t)15;
+    }
+
+    // Bound again, since the ring or another buffer may have been bound since the last draw streamed through it
+    glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
+    glBufferData(GL_ARRAY_BUFFER, size, buf_vbo, GL_STREAM_DRAW);
+    return 0;
+}
+
 static void gfx_opengl_draw_triangles(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_tris) {
     // printf("flushing %d tris\n", buf_vbo_num_tris);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * buf_vbo_len, buf_vbo, GL_STREAM_DRAW);
+    size_t ring_used = gfx_opengl_prepare_vertices(buf_vbo, buf_vbo_len);
     glDrawArrays(GL_TRIANGLES, 0, 3 * buf_vbo_num_tris);
+    vertex_ring.head += ring_used;
+}
+
+static void gfx_opengl_draw_indexed_triangles(float buf_vbo[], size_t buf_vbo_len, const uint16_t buf_ibo[],
+                                              size_t buf_ibo_len) {
+    size_t ring_used = gfx_opengl_prepare_vertices(buf_vbo, buf_vbo_len);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * buf_ibo_len, buf_ibo, GL_STREAM_DRAW);
+    glDrawElements(GL_TRIANGLES, buf_ibo_len, GL_UNSIGNED_SHORT, nullptr);
+    vertex_ring.head += ring_used;
+}
+
+// Rebinds the buffers draw_triangles and draw_indexed_triangles stream through
+static void gfx_opengl_bind_stream_buffers(void) {
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_ring.enabled ? vertex_ring.vbo : opengl_vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, opengl_ibo);
+}
+
+static GLenum gfx_cull_mode_to_opengl(enum GfxCullMode mode) {
+    switch (mode) {
+        case GFX_CULL_CW:
+            return GL_BACK;
+        case GFX_CULL_CCW:
+            return GL_FRONT;
+        default:
+            return GL_FRONT_AND_BACK;
+    }
+}
+
+static uint32_t gfx_opengl_create_mesh(const float buf_vbo[], size_t buf_vbo_len, const uint32_t buf_ibo[],
+                                       size_t buf_ibo_len) {
+    struct Mesh mesh;
+    glGenBuffers(1, &mesh.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * buf_vbo_len, buf_vbo, GL_STATIC_DRAW);
+    glGenBuffers(1, &mesh.ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * buf_ibo_len, buf_ibo, GL_STATIC_DRAW);
+    gfx_opengl_bind_stream_buffers();
+
+    meshes[next_mesh_id] = mesh;
+    return next_mesh_id++;
+}
+
+static void gfx_opengl_draw_mesh(uint32_t mesh_id, size_t vbo_offset, size_t ibo_offset, size_t ibo_len,
+                                 const struct GfxMeshTransform* transform) {
+    auto it = meshes.find(mesh_id);
+    if (it == meshes.end()) {
+        return;
+    }
+
+    size_t stream_attribs_offset = current_attribs_offset;
+    glBindBuffer(GL_ARRAY_BUFFER, it->second.vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, it->second.ibo);
+    gfx_opengl_vertex_array_set_attribs(current_program, sizeof(float) * vbo_offset);
+
+    glUniformMatrix4fv(current_program->mesh_transform_location, 1, GL_FALSE, &transform->matrix[0][0]);
+    if (current_program->mesh_fog_location != -1) {
+        glUniform2f(current_program->mesh_fog_location, transform->fog_mul, transform->fog_offset);
+    }
+    if (transform->cull != GFX_CULL_NONE) {
+        glEnable(GL_CULL_FACE);
+        glFrontFace(GL_CCW);
+        glCullFace(gfx_cull_mode_to_opengl(transform->cull));
+    }
+
+    glDrawElements(GL_TRIANGLES, ibo_len, GL_UNSIGNED_INT, (void*)(sizeof(uint32_t) * ibo_offset));
+
+    if (transform->cull != GFX_CULL_NONE) {
+        glDisable(GL_CULL_FACE);
+    }
+    glUniformMatrix4fv(current_program->mesh_transform_location, 1, GL_FALSE, &identity_transform[0][0]);
+    gfx_opengl_bind_stream_buffers();
+    gfx_opengl_vertex_array_set_attribs(current_program, stream_attribs_offset);
+}
+
+static void gfx_opengl_delete_mesh(uint32_t mesh_id) {
+    auto it = meshes.find(mesh_id);
+    if (it != meshes.end()) {
+        glDeleteBuffers(1, &it->second.vbo);
+        glDeleteBuffers(1, &it->second.ibo);
+        meshes.erase(it);
+    }
+}
+
+static void gfx_opengl_init_vertex_ring(void) {
+#if defined(__SWITCH__)
+    bool has_sync = true;
+    bool has_map_buffer_range = true;
+#else
+    bool has_sync = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+    bool has_map_buffer_range = GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+#endif
+    if (!has_sync || !has_map_buffer_range) {
+        return;
+    }
+
+    glGenBuffers(1, &vertex_ring.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_ring.vbo);
+
+#if defined(GL_MAP_PERSISTENT_BIT) && !defined(__SWITCH__)
+    if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+        // Coherent, so vertices written through the mapping are visible to draws without a barrier
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, VERTEX_RING_SIZE, nullptr, flags);
+        vertex_ring.persistent_ptr = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, VERTEX_RING_SIZE, flags);
+        vertex_ring.persistent = vertex_ring.persistent_ptr != nullptr;
+        vertex_ring.enabled = vertex_ring.persistent;
+    } else
+#endif
+    {
+        glBufferData(GL_ARRAY_BUFFER, VERTEX_RING_SIZE, nullptr, GL_STREAM_DRAW);
+        vertex_ring.enabled = true;
+    }
+
+    if (!vertex_ring.enabled) {
+        glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
+    }
+}
+
+static void gfx_opengl_init_program_binary_cache(void) {
+#if defined(__SWITCH__)
+    bool has_program_binary = false;
+#else
+    bool has_program_binary = GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary;
+#endif
+    if (CVarGetInteger("gShaderCache", 0) == 0 || !has_program_binary) {
+        return;
+    }
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    if (num_formats == 0) {
+        return;
+    }
+    program_binary_cache.enabled = true;
+
+    string driver = string((const char*)glGetString(GL_VENDOR)) + "\n" + (const char*)glGetString(GL_RENDERER) +
+                    "\n" + (const char*)glGetString(GL_VERSION);
+    string path = Ship::Window::GetPathRelativeToAppDirectory(PROGRAM_BINARY_CACHE_FILE);
+
+    // Reads up to the first entry that is cut short, which is where appending resumes
+    ifstream in(path, ios::binary);
+    char magic[sizeof(PROGRAM_BINARY_CACHE_MAGIC) - 1];
+    uint32_t driver_length;
+    string file_driver;
+    bool valid = in.read(magic, sizeof(magic)).good() &&
+                 memcmp(magic, PROGRAM_BINARY_CACHE_MAGIC, sizeof(magic)) == 0 &&
+                 in.read((char*)&driver_length, sizeof(driver_length)).good() && driver_length == driver.size();
+    if (valid) {
+        file_driver.resize(driver_length);
+        valid = in.read(file_driver.data(), driver_length).good() && file_driver == driver;
+    }
+    uintmax_t valid_size = 0;
+    if (valid) {
+        valid_size = in.tellg();
+        struct ProgramBinaryHeader header;
+        while (in.read((char*)&header, sizeof(header)).good()) {
+            vector<uint8_t> binary(header.length);
+            if (!in.read((char*)binary.data(), header.length).good()) {
+                break;
+            }
+            program_binary_cache.binaries[header.source_hash] = make_pair((GLenum)header.format, std::move(binary));
+            program_binary_cache.stored.insert(header.source_hash);
+            valid_size = in.tellg();
+        }
+    }
+    in.close();
+
+    if (valid) {
+        std::error_code ec;
+        filesystem::resize_file(path, valid_size, ec);
+        program_binary_cache.file.open(path, ios::binary | ios::app);
+    } else {
+        program_binary_cache.file.open(path, ios::binary | ios::trunc);
+        driver_length = driver.size();
+        program_binary_cache.file.write(PROGRAM_BINARY_CACHE_MAGIC, sizeof(magic));
+        program_binary_cache.file.write((const char*)&driver_length, sizeof(driver_length));
+        program_binary_cache.file.write(driver.data(), driver_length);
+        program_binary_cache.file.flush();
+    }
 }
 
 static void gfx_opengl_init(void) {
@@ -782,12 +1148,18 @@ static void gfx_opengl_init(void) {
 
     glGenBuffers(1, &opengl_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
+    gfx_opengl_init_vertex_ring();
+    gfx_opengl_init_program_binary_cache();
 
 #ifdef __APPLE__
     glGenVertexArrays(1, &opengl_vao);
     glBindVertexArray(opengl_vao);
 #endif
 
+    // Bound after the vertex array, which keeps the element buffer binding
+    glGenBuffers(1, &opengl_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, opengl_ibo);
+
     glEnable(GL_DEPTH_CLAMP);
     glDepthFunc(GL_LEQUAL);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -1032,6 +1404,12 @@ struct GfxRenderingAPI gfx_opengl_api = { gfx_opengl_get_name,
                                           gfx_opengl_set_scissor,
                                           gfx_opengl_set_use_alpha,
                                           gfx_opengl_draw_triangles,
+                                          gfx_opengl_map_vertex_buffer,
+                                          gfx_opengl_draw_indexed_triangles,
+                                          gfx_opengl_set_draw_constants,
+                                          gfx_opengl_create_mesh,
+                                          gfx_opengl_draw_mesh,
+                                          gfx_opengl_delete_mesh,
                                           gfx_opengl_init,
                                           gfx_opengl_on_resize,
                                           gfx_opengl_start_frame,
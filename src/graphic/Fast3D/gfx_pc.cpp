@@ -8,7 +8,13 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
 #include <set>
 #include <unordered_map>
 #include <vector>
@@ -27,6 +33,11 @@
 
 #include "gfx_pc.h"
 #include "gfx_cc.h"
+#include "gfx_command_buffer.h"
+#include "gfx_frame_capture.h"
+#include "gfx_hash_pool.h"
+#include "gfx_texture_decode.h"
+#include "gfx_vertex_transform.h"
 #include "gfx_window_manager_api.h"
 #include "gfx_rendering_api.h"
 #include "gfx_screen_config.h"
@@ -36,7 +47,10 @@
 #include "menu/ImGuiImpl.h"
 #include "resource/GameVersions.h"
 #include "resource/ResourceMgr.h"
+#include "resource/type/DisplayList.h"
+#include "resource/type/Texture.h"
 #include "misc/Utils.h"
+#include "thread-pool/BS_thread_pool.hpp"
 #include "libultraship/libultraship.h"
 
 uintptr_t gfxFramebuffer;
@@ -68,24 +82,48 @@ using namespace std;
 #define MAX_VERTICES 64
 
 #define TEXTURE_CACHE_MAX_SIZE 500
-
-struct RGBA {
-    uint8_t r, g, b, a;
-};
-
-struct LoadedVertex {
-    float x, y, z, w;
-    float u, v;
-    struct RGBA color;
-    uint8_t clip_rej;
+// With the content cache, entries of the address cache are cheap, so they are only limited to bound the map's size
+#define TEXTURE_CACHE_MAX_ALIASES 8192
+
+// A span of memory a cached texture was read from, indexed by its start so that writes to that memory can find the
+// textures to drop without scanning the cache. An entry has one span for its texels and one per palette.
+struct TextureCacheRange {
+    const uint8_t* end;
+    TextureCacheNode* node;
 };
 
 static struct {
     TextureCacheMap map;
     list<TextureCacheMapIter> lru;
     vector<uint32_t> free_texture_ids;
+    multimap<const uint8_t*, TextureCacheRange> ranges;
+    size_t max_range_size; // no span is longer, which bounds how far before an address ranges may start to cover it
 } gfx_texture_cache;
 
+// With gTextureContentCache set, a miss in the address keyed cache above hashes the texels (and palette) it would
+// decode and looks them up here, so the same image loaded from several addresses is uploaded once and shared. The GPU
+// memory of these textures is limited by a byte budget rather than an entry count. A texture stays resident while no
+// address uses it, so reloaded resources find it again, until the budget needs the space.
+struct TextureContentEntry {
+    uint32_t texture_id;
+    uint64_t hash;
+    uint32_t users;    // entries of the address cache sharing the texture
+    size_t size_bytes; // RGBA32 size, counted against the budget
+    struct TextureSamplerState sampler;
+    list<uint64_t>::iterator idle_location; // position in idle while users is 0
+};
+
+static struct {
+    unordered_map<uint64_t, TextureContentEntry> map;
+    list<uint64_t> idle; // textures no address uses, least recently released first
+    size_t resident_bytes;
+    size_t budget_bytes;
+    bool enabled;
+} gfx_texture_content_cache;
+
+static struct GfxTextureCacheStats texture_cache_stats, texture_cache_stats_last_frame;
+static struct GfxRenderStateStats render_state_stats, render_state_stats_last_frame;
+
 struct ColorCombiner {
     uint64_t shader_id0;
     uint32_t shader_id1;
@@ -94,8 +132,16 @@ struct ColorCombiner {
     uint8_t shader_input_mapping[2][7];
 };
 
-static map<uint64_t, struct ColorCombiner> color_combiner_pool;
-static map<uint64_t, struct ColorCombiner>::iterator prev_combiner = color_combiner_pool.end();
+static GfxHashPool<uint64_t, struct ColorCombiner, GfxCombinerIdHash> color_combiner_pool;
+
+// Combiners recently looked up, by cc_id. Draws often alternate between a few combiners, which are then found here
+// without probing the pool.
+#define COMBINER_CACHE_SIZE 16
+
+static struct CombinerCacheEntry {
+    uint64_t cc_id;
+    struct ColorCombiner* comb;
+} combiner_cache[COMBINER_CACHE_SIZE];
 
 static struct RSP {
     float modelview_matrix_stack[11][4][4];
@@ -124,11 +170,13 @@ static struct RSP {
 
 static struct RDP {
     const uint8_t* palettes[2];
+    uint16_t palette_entries[2]; // TLUT entries loaded into each half of palettes
     struct {
         const uint8_t* addr;
         uint8_t siz;
         uint32_t width;
         const char* otr_path;
+        uint64_t otr_hash;
     } texture_to_load;
     struct {
         const uint8_t* addr;
@@ -136,6 +184,7 @@ static struct RDP {
         uint32_t full_image_line_size_bytes;
         uint32_t line_size_bytes;
         const char* otr_path;
+        uint64_t otr_hash;
     } loaded_texture[2];
     struct {
         uint8_t fmt;
@@ -171,6 +220,7 @@ static struct RenderingState {
     struct XYWidthHeight viewport, scissor;
     struct ShaderProgram* shader_program;
     TextureCacheNode* textures[2];
+    struct GfxDrawConstants draw_constants;
 } rendering_state;
 
 struct GfxDimensions gfx_current_window_dimensions;
@@ -190,12 +240,199 @@ static bool dropped_frame;
 
 static const std::unordered_map<Mtx*, MtxF>* current_mtx_replacements;
 
-static float buf_vbo[MAX_BUFFERED * (32 * 3)]; // 3 vertices in a triangle and 32 floats per vtx
+static float buf_vbo_storage[MAX_BUFFERED * (32 * 3)]; // 3 vertices in a triangle and 32 floats per vtx
+static float* buf_vbo = buf_vbo_storage;               // buf_vbo_storage, or backend memory from map_vertex_buffer
 static size_t buf_vbo_len;
 static size_t buf_vbo_num_tris;
 
+// Used when the backend has draw_indexed_triangles. Each loaded vertex slot remembers the floats it was last written
+// as in the current batch, so later triangles that produce the same floats for it refer to that vertex again.
+struct BufVboSlot {
+    uint32_t batch; // buf_vbo_batch when index and data were written
+    uint16_t index;
+    float data[32];
+};
+static uint16_t buf_ibo[MAX_BUFFERED * 3];
+static size_t buf_ibo_len;
+static uint16_t buf_vbo_num_verts;
+static uint32_t buf_vbo_batch = 1;
+static struct BufVboSlot buf_vbo_slots[MAX_VERTICES + 4];
+
+// Retained meshes, used when the backend has draw_mesh. A DisplayList resource run from the same state on two frames is
+// recorded the next time it runs: its triangles are drawn as usual, and their vertices are also kept in a mesh on the
+// GPU with the positions left in object space. Later runs only apply the state commands, and each batch of triangles
+// becomes a draw of the matching part of the mesh, transformed by the current matrix on the GPU. Every command and
+// vertex load is compared with the recording as it runs, and the first one that differs ends the replay, so the rest
+// of the display list runs in immediate mode.
+#define RETAINED_MESH_MAX_IDLE_FRAMES 120
+#define RETAINED_MESH_MAX_FAILURES 4
+
+// Part of a mesh with one vertex layout and cull mode. Its indices count from its first vertex.
+struct RetainedMeshSegment {
+    uint32_t vbo_offset; // in floats
+    uint32_t first_index;
+    uint32_t num_indices;
+    uint32_t cull_mode; // G_CULL_BOTH bits of the geometry mode
+};
+
+struct RetainedVertexLoad {
+    const Vtx* vertices;
+    uint8_t count, dest_index;
+    uint64_t hash;
+};
+
+struct RetainedMesh {
+    uint32_t mesh_id; // 0 until recorded
+    uint32_t num_indices;
+    size_t size_bytes;
+    vector<RetainedMeshSegment> segments;
+    vector<Gfx> commands; // every command the recording ran, including the second word of two-word commands
+    vector<RetainedVertexLoad> loads;
+    uint32_t last_frame;
+    uint32_t frames_seen;
+    uint8_t failures;  // replays in a row that did not match the recording
+    bool unretainable; // the display list does something a mesh can not reproduce
+};
+
+// A loaded vertex slot while recording
+struct RetainedVertexSlot {
+    const Vtx* vertex; // null until loaded by the display list being recorded
+    bool fog;          // G_FOG was set when it was loaded
+    uint32_t segment;  // segment id when index and data were written
+    uint32_t index;
+    float data[32];
+};
+
+// A vertex load skipped while replaying, run if the loaded vertices are needed after all
+struct PendingVertexLoad {
+    const Vtx* vertices;
+    uint8_t count, dest_index;
+    uint32_t geometry_mode;
+    uint16_t scaling_s, scaling_t;
+};
+
+enum RetainedMeshMode { RETAINED_NONE, RETAINED_CAPTURE, RETAINED_REPLAY };
+
+static struct {
+    bool enabled;
+    uint32_t frame;
+    unordered_map<uint64_t, RetainedMesh> meshes; // by resource CRC and state
+    uint32_t num_meshes;
+    size_t mesh_bytes;
+
+    enum RetainedMeshMode mode;
+    RetainedMesh* mesh;
+    size_t command_index;
+    size_t load_index;
+
+    // Recording
+    vector<float> vbo;
+    vector<uint32_t> ibo;
+    uint32_t segment_id; // increases with every segment started, so slots never match an earlier one
+    size_t segment_vtx_len;
+    uint32_t segment_num_verts;
+    struct RetainedVertexSlot slots[MAX_VERTICES + 4];
+
+    // Replaying
+    uint32_t cursor; // indices of the triangles run so far
+    uint32_t drawn;  // of those, the indices already drawn
+    size_t segment_index;
+    struct GfxMeshTransform transform;
+    vector<PendingVertexLoad> pending_loads;
+} retained;
+
+static struct GfxRetainedMeshStats retained_mesh_stats, retained_mesh_stats_last_frame;
+
+// Compiled display lists. A DisplayList resource is compiled the first time it runs: its commands are decoded into an
+// array of CompiledCommand with their operands unpacked and the OTR resources they name resolved to pointers. Commands
+// that do nothing here are left out, and so are color and combiner settings overwritten before anything reads them.
+// The result is kept on the resource with the revision of the words it was compiled from, and is compiled again when
+// the words were changed in place or when the resource or one it points into is marked dirty. Display lists that draw
+// rectangles or change framebuffers are not compiled, and always run through gfx_run_dl.
+enum CompiledOp : uint8_t {
+    COMPILED_NOP, // removed once the display list is compiled
+    COMPILED_END,
+    COMPILED_MARKER,
+    COMPILED_LOAD_UCODE,
+    COMPILED_MTX, // ptr is a segmented address
+    COMPILED_MTX_RESOLVED,
+    COMPILED_POPMTX,
+    COMPILED_MOVEMEM,
+    COMPILED_MOVEWORD,
+    COMPILED_TEXTURE,
+    COMPILED_VTX, // ptr is a segmented address
+    COMPILED_VTX_RESOLVED,
+    COMPILED_MODIFYVTX,
+    COMPILED_CALL,          // ptr is a segmented address
+    COMPILED_CALL_RESOLVED, // ptr is a DisplayList resource, w its CRC
+    COMPILED_JUMP,          // ptr is a segmented address
+    COMPILED_BRANCH_Z,      // ptr is a DisplayList resource
+    COMPILED_GEOMETRYMODE,
+    COMPILED_TRI1,
+    COMPILED_TRI2,
+    COMPILED_SETOTHERMODE,
+    COMPILED_RDPSETOTHERMODE,
+    COMPILED_SETTIMG, // ptr is a segmented address or an image name
+    COMPILED_SETTIMG_RESOLVED,
+    COMPILED_LOADBLOCK,
+    COMPILED_LOADTILE,
+    COMPILED_SETTILE,
+    COMPILED_SETTILESIZE,
+    COMPILED_LOADTLUT,
+    COMPILED_SETSCISSOR,
+    // Settings only read when drawing, so one overwritten before a draw or a call is dropped
+    COMPILED_SETGRAYSCALE,
+    COMPILED_SETENVCOLOR,
+    COMPILED_SETPRIMCOLOR,
+    COMPILED_SETFOGCOLOR,
+    COMPILED_SETFILLCOLOR,
+    COMPILED_SETINTENSITY,
+    COMPILED_SETCOMBINE,
+    COMPILED_OP_COUNT
+};
+
+struct CompiledCommand {
+    uint8_t op;
+    uint8_t b[7];  // vertex indices, tiles, formats and color components
+    uint16_t h[4]; // tile coordinates, sizes and combiner settings
+    uint32_t w[2]; // counts, masks and mode words
+    uintptr_t ptr; // resolved pointer, segmented address or display list
+};
+
+// Name and CRC passed on with a resolved G_SETTIMG_OTR, used by the texture cache
+struct CompiledTextureImage {
+    const char* name;
+    uint64_t hash;
+};
+
+struct GfxCompiledDisplayList {
+    bool compiled; // false when the display list has commands that can not be compiled
+    vector<CompiledCommand> commands;
+    vector<CompiledTextureImage> texture_images;
+    uint32_t revision;                                     // DisplayList::Revision the commands were compiled from
+    vector<std::shared_ptr<Ship::Resource>> dependencies; // resources the commands point into
+};
+
+static bool compiled_display_lists_enabled;
+static struct GfxCompiledDisplayListStats compiled_dl_stats, compiled_dl_stats_last_frame;
+
+// Combiners drawn in earlier sessions, as the shader ids passed to create_and_load_new_shader. With gShaderCache set
+// they are created during gfx_init instead of the first time they are drawn, which stalls that frame.
+#define SHADER_CACHE_FILE "shader_cache.bin"
+#define SHADER_CACHE_MAGIC "LUSSHC01"
+
+struct ShaderCacheEntry {
+    uint64_t shader_id0;
+    uint32_t shader_id1;
+    uint32_t reserved;
+};
+
+static std::ofstream shader_cache_file;
+
 static struct GfxWindowManagerAPI* gfx_wapi;
 static struct GfxRenderingAPI* gfx_rapi;
+static struct GfxRenderingAPI* gfx_backend_rapi; // differs from gfx_rapi when calls go through the command buffer
+static struct GfxSubmissionStats submission_stats_last_frame;
 
 static int markerOn;
 static uintptr_t segmentPointers[16];
@@ -209,6 +446,19 @@ static bool fbActive = 0;
 static map<int, FBInfo>::iterator active_fb;
 static map<int, FBInfo> framebuffers;
 
+// Set while the frame being run is captured. frame_capture_pointer is the data the command being executed resolved its
+// address to, which the capture stores in place of the original address.
+static std::string frame_capture_path;
+static std::unique_ptr<struct GfxFrameCapture> frame_capture;
+static const void* frame_capture_pointer;
+
+static inline void gfx_capture_data(const void* addr, size_t size) {
+    if (frame_capture != nullptr) {
+        gfx_frame_capture_read(frame_capture.get(), addr, size);
+        frame_capture_pointer = addr;
+    }
+}
+
 static set<pair<float, float>> get_pixel_depth_pending;
 static unordered_map<pair<float, float>, uint16_t, hash_pair_ff> get_pixel_depth_cached;
 
@@ -227,8 +477,144 @@ static unsigned long get_time(void) {
 }
 #endif
 
+// Scratch space the import_texture_* functions convert into. It grows to fit the largest texture seen so far.
+static vector<uint8_t> texture_scratch;
+
+static uint8_t* gfx_texture_scratch(size_t size) {
+    if (texture_scratch.size() < size) {
+        texture_scratch.resize(size);
+    }
+    return texture_scratch.data();
+}
+
+// With gAsyncTextureDecode set, a texture cache miss only queues the conversion to RGBA32 on a decode worker and the
+// render thread moves on. The upload happens in the next gfx_flush that draws, right before the draw, waiting for the
+// worker there if it is not done yet. Draws therefore keep their order and never sample a texture that was not
+// uploaded, and misses on both texture units are converted in parallel. Whatever is still queued when gfx_run ends is
+// uploaded then, since the game may change the source memory afterwards.
+struct TextureDecodeJob {
+    int i;
+    uint32_t texture_id;
+    uint32_t width, height;
+    std::vector<uint8_t> rgba32;
+    std::future<double> done; // how many milliseconds the conversion took
+};
+
+static std::unique_ptr<BS::thread_pool> texture_decode_pool;
+static std::vector<TextureDecodeJob> texture_decode_jobs;
+static std::vector<std::vector<uint8_t>> texture_decode_buffers;
+static bool texture_decode_async;
+static struct GfxTextureDecodeStats texture_decode_stats, texture_decode_stats_last_frame;
+
+static double gfx_elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void gfx_import_decoded_texture(int i, size_t decoded_size, uint32_t width, uint32_t height,
+                                       std::function<void(uint8_t*)> decode) {
+    texture_decode_stats.decodes++;
+
+    if (!texture_decode_async) {
+        auto start = std::chrono::steady_clock::now();
+        uint8_t* rgba32_buf = gfx_texture_scratch(decoded_size);
+        decode(rgba32_buf);
+        texture_decode_stats.decode_ms += gfx_elapsed_ms(start);
+        gfx_rapi->upload_texture(rgba32_buf, width, height);
+        return;
+    }
+
+    if (texture_decode_pool == nullptr) {
+        unsigned int threads = std::thread::hardware_concurrency();
+        texture_decode_pool = std::make_unique<BS::thread_pool>(std::clamp(threads > 1 ? threads - 1 : 1, 1U, 4U));
+    }
+
+    TextureDecodeJob job;
+    job.i = i;
+    job.texture_id = rendering_state.textures[i]->second.texture_id;
+    job.width = width;
+    job.height = height;
+    if (!texture_decode_buffers.empty()) {
+        job.rgba32 = std::move(texture_decode_buffers.back());
+        texture_decode_buffers.pop_back();
+    }
+    job.rgba32.resize(decoded_size);
+
+    uint8_t* rgba32_buf = job.rgba32.data();
+    job.done = texture_decode_pool->submit([decode = std::move(decode), rgba32_buf]() {
+        auto start = std::chrono::steady_clock::now();
+        decode(rgba32_buf);
+        return gfx_elapsed_ms(start);
+    });
+    texture_decode_jobs.push_back(std::move(job));
+    texture_decode_stats.async_decodes++;
+}
+
+// Uploads every queued texture. Each job selects its texture on the unit it was looked up for, which leaves the units
+// bound as the draws following the misses expect, since a unit's texture only changes after a flush.
+static void gfx_finish_texture_decodes(void) {
+    for (TextureDecodeJob& job : texture_decode_jobs) {
+        auto start = std::chrono::steady_clock::now();
+        texture_decode_stats.decode_ms += job.done.get();
+        texture_decode_stats.wait_ms += gfx_elapsed_ms(start);
+
+        gfx_rapi->select_texture(job.i, job.texture_id);
+        gfx_rapi->upload_texture(job.rgba32.data(), job.width, job.height);
+        texture_decode_buffers.push_back(std::move(job.rgba32));
+    }
+    texture_decode_jobs.clear();
+}
+
+static enum GfxCullMode gfx_cull_mode(uint32_t cull_mode, bool invert_y) {
+    // Front faces are clockwise on screen, counterclockwise in clip space unless invert_y flips it
+    switch (cull_mode) {
+        case G_CULL_FRONT:
+            return invert_y ? GFX_CULL_CW : GFX_CULL_CCW;
+        case G_CULL_BACK:
+            return invert_y ? GFX_CULL_CCW : GFX_CULL_CW;
+        case G_CULL_BOTH:
+            return GFX_CULL_ALL;
+        default:
+            return GFX_CULL_NONE;
+    }
+}
+
+// Draws the replayed triangles not drawn yet, one draw per segment they span
+static void gfx_retained_flush(void) {
+    if (retained.drawn == retained.cursor) {
+        return;
+    }
+    if (!texture_decode_jobs.empty()) {
+        gfx_finish_texture_decodes();
+    }
+
+    bool invert_y = gfx_rapi->get_clip_parameters().invert_y;
+    while (retained.drawn < retained.cursor) {
+        const struct RetainedMeshSegment* segment = &retained.mesh->segments[retained.segment_index];
+        uint32_t segment_end = segment->first_index + segment->num_indices;
+        uint32_t end = std::min(retained.cursor, segment_end);
+        retained.transform.cull = gfx_cull_mode(segment->cull_mode, invert_y);
+        gfx_rapi->draw_mesh(retained.mesh->mesh_id, segment->vbo_offset, retained.drawn, end - retained.drawn,
+                            &retained.transform);
+        retained.drawn = end;
+        if (end == segment_end) {
+            retained.segment_index++;
+        }
+    }
+}
+
 static void gfx_flush(void) {
+    if (retained.mode == RETAINED_REPLAY) {
+        gfx_retained_flush();
+    }
     if (buf_vbo_len > 0) {
+        if (!texture_decode_jobs.empty()) {
+            gfx_finish_texture_decodes();
+        }
+        render_state_stats.flushes++;
+        if (buf_vbo_num_tris < 4) {
+            render_state_stats.small_flushes++;
+        }
+
         int num = buf_vbo_num_tris;
         unsigned long t0 = get_time();
 
@@ -236,9 +622,16 @@ static void gfx_flush(void) {
             int bp = 0;
         }
 
-        gfx_rapi->draw_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_tris);
+        if (buf_ibo_len > 0) {
+            gfx_rapi->draw_indexed_triangles(buf_vbo, buf_vbo_len, buf_ibo, buf_ibo_len);
+        } else {
+            gfx_rapi->draw_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_tris);
+        }
         buf_vbo_len = 0;
         buf_vbo_num_tris = 0;
+        buf_ibo_len = 0;
+        buf_vbo_num_verts = 0;
+        buf_vbo_batch++;
         unsigned long t1 = get_time();
         /*if (t1 - t0 > 1000) {
             printf("f: %d %d\n", num, (int)(t1 - t0));
@@ -252,10 +645,42 @@ static struct ShaderProgram* gfx_lookup_or_create_shader_program(uint64_t shader
         gfx_rapi->unload_shader(rendering_state.shader_program);
         prg = gfx_rapi->create_and_load_new_shader(shader_id0, shader_id1);
         rendering_state.shader_program = prg;
+        if (shader_cache_file.is_open()) {
+            struct ShaderCacheEntry entry = { shader_id0, shader_id1, 0 };
+            shader_cache_file.write((const char*)&entry, sizeof(entry));
+            shader_cache_file.flush();
+        }
     }
     return prg;
 }
 
+// Creates the shaders listed in the shader cache, then opens it to append the combiners first drawn this session.
+static void gfx_shader_cache_prewarm(void) {
+    std::string path = Ship::Window::GetPathRelativeToAppDirectory(SHADER_CACHE_FILE);
+    std::vector<ShaderCacheEntry> entries;
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(SHADER_CACHE_MAGIC) - 1];
+    bool valid = in.read(magic, sizeof(magic)).good() && memcmp(magic, SHADER_CACHE_MAGIC, sizeof(magic)) == 0;
+    struct ShaderCacheEntry entry;
+    while (valid && in.read((char*)&entry, sizeof(entry)).good()) {
+        entries.push_back(entry);
+    }
+    in.close();
+
+    for (const ShaderCacheEntry& e : entries) {
+        gfx_lookup_or_create_shader_program(e.shader_id0, e.shader_id1);
+    }
+    if (!entries.empty()) {
+        SPDLOG_INFO("Created {} shaders from {}", entries.size(), path);
+    }
+
+    // A partly written last entry is dropped along with anything unreadable by rewriting the entries that were read
+    shader_cache_file.open(path, std::ios::binary | std::ios::trunc);
+    shader_cache_file.write(SHADER_CACHE_MAGIC, sizeof(magic));
+    shader_cache_file.write((const char*)entries.data(), entries.size() * sizeof(ShaderCacheEntry));
+    shader_cache_file.flush();
+}
+
 static const char* ccmux_to_string(uint32_t ccmux) {
     static const char* const tbl[] = {
         "G_CCMUX_COMBINED",
@@ -485,43 +910,249 @@ static void gfx_generate_cc(struct ColorCombiner* comb, uint64_t cc_id) {
 }
 
 static struct ColorCombiner* gfx_lookup_or_create_color_combiner(uint64_t cc_id) {
-    if (prev_combiner != color_combiner_pool.end() && prev_combiner->first == cc_id) {
-        return &prev_combiner->second;
+    struct CombinerCacheEntry* cached = &combiner_cache[gfx_hash_mix(cc_id) % COMBINER_CACHE_SIZE];
+    if (cached->comb != nullptr && cached->cc_id == cc_id) {
+        return cached->comb;
     }
 
-    prev_combiner = color_combiner_pool.find(cc_id);
-    if (prev_combiner != color_combiner_pool.end()) {
-        return &prev_combiner->second;
+    struct ColorCombiner* comb = color_combiner_pool.find(cc_id);
+    if (comb == nullptr) {
+        gfx_flush();
+        comb = color_combiner_pool.insert(cc_id);
+        gfx_generate_cc(comb, cc_id);
     }
-    gfx_flush();
-    prev_combiner = color_combiner_pool.insert(make_pair(cc_id, ColorCombiner())).first;
-    gfx_generate_cc(&prev_combiner->second, cc_id);
-    return &prev_combiner->second;
+    cached->cc_id = cc_id;
+    cached->comb = comb;
+    return comb;
 }
 
 void gfx_texture_cache_clear() {
+    gfx_finish_texture_decodes();
     for (const auto& entry : gfx_texture_cache.map) {
+        if (entry.second.content == nullptr) {
+            gfx_texture_cache.free_texture_ids.push_back(entry.second.texture_id);
+        }
+    }
+    for (const auto& entry : gfx_texture_content_cache.map) {
         gfx_texture_cache.free_texture_ids.push_back(entry.second.texture_id);
     }
     gfx_texture_cache.map.clear();
     gfx_texture_cache.lru.clear();
+    gfx_texture_cache.ranges.clear();
+    gfx_texture_cache.max_range_size = 0;
+    gfx_texture_content_cache.map.clear();
+    gfx_texture_content_cache.idle.clear();
+    gfx_texture_content_cache.resident_bytes = 0;
+    rendering_state.textures[0] = nullptr;
+    rendering_state.textures[1] = nullptr;
+    rdp.textures_changed[0] = true;
+    rdp.textures_changed[1] = true;
 }
 
-static bool gfx_texture_cache_lookup(int i, int tile) {
+// The sampler parameters texture_id currently has. A shared texture has one set for every address using it.
+static struct TextureSamplerState* gfx_texture_sampler(TextureCacheNode* node) {
+    return node->second.content != nullptr ? &node->second.content->sampler : &node->second.own_sampler;
+}
+
+// How many bytes from the loaded texture's address the import of the tile reads. CI8 lines are read
+// full_image_line_size_bytes apart, the other formats are read as one run of size_bytes.
+static size_t gfx_texture_source_span(int tile) {
+    const auto& loaded = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index];
+    if (rdp.texture_tile[tile].fmt == G_IM_FMT_CI && rdp.texture_tile[tile].siz == G_IM_SIZ_8b &&
+        loaded.line_size_bytes != 0 && loaded.full_image_line_size_bytes > loaded.line_size_bytes) {
+        size_t lines = (loaded.size_bytes + loaded.line_size_bytes - 1) / loaded.line_size_bytes;
+        return (lines - 1) * loaded.full_image_line_size_bytes + loaded.line_size_bytes;
+    }
+    return loaded.size_bytes;
+}
+
+static void gfx_texture_cache_add_range(TextureCacheNode* node, const uint8_t* start, size_t size) {
+    gfx_texture_cache.ranges.insert(make_pair(start, TextureCacheRange{ start + size, node }));
+    gfx_texture_cache.max_range_size = std::max(gfx_texture_cache.max_range_size, size);
+}
+
+static void gfx_texture_cache_remove_range(TextureCacheNode* node, const uint8_t* start) {
+    auto range = gfx_texture_cache.ranges.equal_range(start);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.node == node) {
+            gfx_texture_cache.ranges.erase(it);
+            return;
+        }
+    }
+}
+
+// Callers must have finished the queued decodes, as the texture id may be handed to another texture right away.
+static void gfx_texture_cache_erase(TextureCacheMap::iterator it) {
+    // Make the next draw look its texture up again rather than use the erased entry
+    for (int i = 0; i < 2; i++) {
+        if (rendering_state.textures[i] == &*it) {
+            rendering_state.textures[i] = nullptr;
+            rdp.textures_changed[i] = true;
+        }
+    }
+
+    const TextureCacheKey& key = it->first;
+    gfx_texture_cache_remove_range(&*it, key.texture_addr);
+    for (int i = 0; i < 2; i++) {
+        if (key.palette_addrs[i] != nullptr) {
+            gfx_texture_cache_remove_range(&*it, key.palette_addrs[i]);
+        }
+    }
+
+    TextureContentEntry* content = it->second.content;
+    if (content == nullptr) {
+        gfx_texture_cache.free_texture_ids.push_back(it->second.texture_id);
+    } else if (--content->users == 0) {
+        content->idle_location = gfx_texture_content_cache.idle.insert(gfx_texture_content_cache.idle.end(),
+                                                                       content->hash);
+    }
+    gfx_texture_cache.lru.erase(it->second.lru_location);
+    gfx_texture_cache.map.erase(it);
+}
+
+// Frees textures until size_bytes more fit in the budget: first the ones no address uses, then those of the least
+// recently used addresses. It gives up once nothing is left, so a texture larger than the whole budget still loads.
+static void gfx_texture_content_cache_reserve(size_t size_bytes) {
+    while (gfx_texture_content_cache.resident_bytes + size_bytes > gfx_texture_content_cache.budget_bytes) {
+        gfx_finish_texture_decodes();
+        if (!gfx_texture_content_cache.idle.empty()) {
+            auto it = gfx_texture_content_cache.map.find(gfx_texture_content_cache.idle.front());
+            gfx_texture_content_cache.idle.pop_front();
+            gfx_texture_cache.free_texture_ids.push_back(it->second.texture_id);
+            gfx_texture_content_cache.resident_bytes -= it->second.size_bytes;
+            gfx_texture_content_cache.map.erase(it);
+            texture_cache_stats.evictions++;
+        } else if (!gfx_texture_cache.lru.empty()) {
+            gfx_texture_cache_erase(gfx_texture_cache.lru.front().it);
+        } else {
+            break;
+        }
+    }
+}
+
+// XXH64 of size bytes at data.
+static uint64_t gfx_hash_bytes(const uint8_t* data, size_t size, uint64_t seed) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL, prime3 = 0x165667B19E3779F9ULL,
+                   prime4 = 0x85EBCA77C2B2AE63ULL, prime5 = 0x27D4EB2F165667C5ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * prime2, 31) * prime1; };
+    auto read64 = [](const uint8_t* p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    };
+
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+        for (; p + 32 <= end; p += 32) {
+            for (int i = 0; i < 4; i++) {
+                v[i] = round(v[i], read64(p + i * 8));
+            }
+        }
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = (h ^ round(0, v[i])) * prime1 + prime4;
+        }
+    } else {
+        h = seed + prime5;
+    }
+    h += size;
+
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h = rotl(h ^ (v * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = rotl(h ^ (*p * prime5), 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Finds the palette memory the import of the tile's texture reads, as up to two spans, and returns how many there are.
+// CI4 tiles read the 16 entries of their palette. CI8 tiles read the loaded entries of the lower half of the TLUT, and
+// those of the upper half only when a texel indexes it, since it may be left over from an earlier TLUT.
+static int gfx_texture_palette_spans(int tile, const uint8_t* spans[2], size_t sizes[2]) {
+    const auto& loaded = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index];
+    int count = 0;
+
+    if (rdp.texture_tile[tile].fmt != G_IM_FMT_CI) {
+        return 0;
+    }
+    if (rdp.texture_tile[tile].siz == G_IM_SIZ_4b) {
+        uint32_t pal_idx = rdp.texture_tile[tile].palette;
+        if (rdp.palettes[pal_idx / 8] != nullptr) {
+            spans[count] = rdp.palettes[pal_idx / 8] + (pal_idx % 8) * 16 * 2;
+            sizes[count++] = 16 * 2;
+        }
+        return count;
+    }
+    if (rdp.palettes[0] != nullptr && rdp.palette_entries[0] != 0) {
+        spans[count] = rdp.palettes[0];
+        sizes[count++] = rdp.palette_entries[0] * 2;
+    }
+    if (rdp.palettes[1] != nullptr && rdp.palette_entries[1] != 0 &&
+        gfx_texture_ci8_uses_upper_half(loaded.addr, loaded.size_bytes, loaded.line_size_bytes,
+                                        loaded.full_image_line_size_bytes)) {
+        spans[count] = rdp.palettes[1];
+        sizes[count++] = rdp.palette_entries[1] * 2;
+    }
+    return count;
+}
+
+// Hashes everything the import of the tile's texture reads: the texels, the palette and the geometry.
+static uint64_t gfx_texture_content_hash(int tile) {
+    const auto& loaded = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index];
     uint8_t fmt = rdp.texture_tile[tile].fmt;
     uint8_t siz = rdp.texture_tile[tile].siz;
-    uint32_t tmem_index = rdp.texture_tile[tile].tmem_index;
+    uint32_t line_size_bytes = rdp.texture_tile[tile].line_size_bytes;
+    size_t span = gfx_texture_source_span(tile);
+
+    uint64_t seed = ((uint64_t)fmt << 56) ^ ((uint64_t)siz << 48) ^ ((uint64_t)line_size_bytes << 24) ^
+                    ((uint64_t)loaded.line_size_bytes << 40) ^ loaded.size_bytes;
+    uint64_t hash = gfx_hash_bytes(loaded.addr, span, seed);
+
+    const uint8_t* palette_spans[2];
+    size_t palette_sizes[2];
+    int palette_count = gfx_texture_palette_spans(tile, palette_spans, palette_sizes);
+    for (int i = 0; i < palette_count; i++) {
+        hash = gfx_hash_bytes(palette_spans[i], palette_sizes[i], hash ^ palette_sizes[i]);
+    }
+    return hash;
+}
 
-    TextureCacheNode** n = &rendering_state.textures[i];
-    const uint8_t* orig_addr = rdp.loaded_texture[tmem_index].addr;
+static TextureCacheKey gfx_texture_cache_key(int tile) {
+    uint8_t fmt = rdp.texture_tile[tile].fmt;
+    uint8_t siz = rdp.texture_tile[tile].siz;
+    const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint8_t palette_index = rdp.texture_tile[tile].palette;
 
-    TextureCacheKey key;
     if (fmt == G_IM_FMT_CI) {
-        key = { orig_addr, { rdp.palettes[0], rdp.palettes[1] }, fmt, siz, palette_index };
-    } else {
-        key = { orig_addr, {}, fmt, siz, palette_index };
+        return { addr, { rdp.palettes[0], rdp.palettes[1] }, fmt, siz, palette_index };
     }
+    return { addr, {}, fmt, siz, palette_index };
+}
+
+static bool gfx_texture_cache_lookup(int i, int tile) {
+    uint8_t siz = rdp.texture_tile[tile].siz;
+    uint32_t tmem_index = rdp.texture_tile[tile].tmem_index;
+
+    TextureCacheNode** n = &rendering_state.textures[i];
+    const uint8_t* orig_addr = rdp.loaded_texture[tmem_index].addr;
+    TextureCacheKey key = gfx_texture_cache_key(tile);
 
     TextureCacheMap::iterator it = gfx_texture_cache.map.find(key);
 
@@ -530,19 +1161,46 @@ static bool gfx_texture_cache_lookup(int i, int tile) {
         *n = &*it;
         gfx_texture_cache.lru.splice(gfx_texture_cache.lru.end(), gfx_texture_cache.lru,
                                      it->second.lru_location); // move to back
+        texture_cache_stats.hits++;
         return true;
     }
 
-    if (gfx_texture_cache.map.size() >= TEXTURE_CACHE_MAX_SIZE) {
+    bool use_content_cache = gfx_texture_content_cache.enabled;
+    if (gfx_texture_cache.map.size() >= (use_content_cache ? TEXTURE_CACHE_MAX_ALIASES : TEXTURE_CACHE_MAX_SIZE)) {
+        // A queued upload must not land in the texture id once it is handed to another texture
+        gfx_finish_texture_decodes();
+
         // Remove the texture that was least recently used
-        it = gfx_texture_cache.lru.front().it;
-        gfx_texture_cache.free_texture_ids.push_back(it->second.texture_id);
-        gfx_texture_cache.map.erase(it);
-        gfx_texture_cache.lru.pop_front();
+        gfx_texture_cache_erase(gfx_texture_cache.lru.front().it);
+        texture_cache_stats.evictions++;
+    }
+
+    TextureContentEntry* content = nullptr;
+    bool shared = false;
+    if (use_content_cache) {
+        uint64_t hash = gfx_texture_content_hash(tile);
+        auto content_it = gfx_texture_content_cache.map.find(hash);
+        if (content_it != gfx_texture_content_cache.map.end()) {
+            content = &content_it->second;
+            if (content->users++ == 0) {
+                gfx_texture_content_cache.idle.erase(content->idle_location);
+            }
+            shared = true;
+        } else {
+            size_t size_bytes = gfx_decoded_texture_size(siz, rdp.loaded_texture[tmem_index].size_bytes);
+            gfx_texture_content_cache_reserve(size_bytes);
+            content = &gfx_texture_content_cache.map[hash];
+            content->hash = hash;
+            content->users = 1;
+            content->size_bytes = size_bytes;
+            gfx_texture_content_cache.resident_bytes += size_bytes;
+        }
     }
 
     uint32_t texture_id;
-    if (!gfx_texture_cache.free_texture_ids.empty()) {
+    if (shared) {
+        texture_id = content->texture_id;
+    } else if (!gfx_texture_cache.free_texture_ids.empty()) {
         texture_id = gfx_texture_cache.free_texture_ids.back();
         gfx_texture_cache.free_texture_ids.pop_back();
     } else {
@@ -552,36 +1210,70 @@ static bool gfx_texture_cache_lookup(int i, int tile) {
     it = gfx_texture_cache.map.insert(make_pair(key, TextureCacheValue())).first;
     TextureCacheNode* node = &*it;
     node->second.texture_id = texture_id;
+    node->second.content = content;
     node->second.lru_location = gfx_texture_cache.lru.insert(gfx_texture_cache.lru.end(), { it });
+    *n = node;
+
+    gfx_texture_cache_add_range(node, orig_addr, gfx_texture_source_span(tile));
+    const uint8_t* palette_spans[2];
+    size_t palette_sizes[2];
+    int palette_count = gfx_texture_palette_spans(tile, palette_spans, palette_sizes);
+    for (int j = 0; j < palette_count; j++) {
+        gfx_texture_cache_add_range(node, palette_spans[j], palette_sizes[j]);
+    }
 
     gfx_rapi->select_texture(i, texture_id);
+    if (shared) {
+        texture_cache_stats.content_hits++;
+        return true;
+    }
+    if (content != nullptr) {
+        content->texture_id = texture_id;
+    }
     gfx_rapi->set_sampler_parameters(i, false, 0, 0);
-    *n = node;
+    texture_cache_stats.misses++;
     return false;
 }
 
+// Erases the entries of the nodes, each listed once.
+static void gfx_texture_cache_erase_nodes(const vector<TextureCacheNode*>& nodes) {
+    if (nodes.empty()) {
+        return;
+    }
+    gfx_finish_texture_decodes();
+    for (TextureCacheNode* node : nodes) {
+        gfx_texture_cache_erase(gfx_texture_cache.map.find(node->first));
+    }
+}
+
+// Drops the textures loaded from orig_addr, as G_INVALTEXCACHE asks.
 static void gfx_texture_cache_delete(const uint8_t* orig_addr) {
-    while (gfx_texture_cache.map.bucket_count() > 0) {
-        TextureCacheKey key = { orig_addr, { 0 }, 0, 0 }; // bucket index only depends on the address
-        size_t bucket = gfx_texture_cache.map.bucket(key);
-        bool again = false;
-        for (auto it = gfx_texture_cache.map.begin(bucket); it != gfx_texture_cache.map.end(bucket); ++it) {
-            if (it->first.texture_addr == orig_addr) {
-                gfx_texture_cache.lru.erase(it->second.lru_location);
-                gfx_texture_cache.free_texture_ids.push_back(it->second.texture_id);
-                gfx_texture_cache.map.erase(it->first);
-                again = true;
-                break;
-            }
+    vector<TextureCacheNode*> nodes;
+    auto range = gfx_texture_cache.ranges.equal_range(orig_addr);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.node->first.texture_addr == orig_addr) {
+            nodes.push_back(it->second.node);
         }
-        if (!again) {
-            break;
+    }
+    gfx_texture_cache_erase_nodes(nodes);
+}
+
+void gfx_texture_cache_invalidate(const void* addr, size_t size) {
+    const uint8_t* start = (const uint8_t*)addr;
+    const uint8_t* end = start + size;
+    const uint8_t* first = start - std::min(gfx_texture_cache.max_range_size, (size_t)(uintptr_t)start);
+
+    vector<TextureCacheNode*> nodes;
+    for (auto it = gfx_texture_cache.ranges.lower_bound(first); it != gfx_texture_cache.ranges.end() && it->first < end;
+         ++it) {
+        if (it->second.end > start && std::find(nodes.begin(), nodes.end(), it->second.node) == nodes.end()) {
+            nodes.push_back(it->second.node);
         }
     }
+    gfx_texture_cache_erase_nodes(nodes);
 }
 
-static void import_texture_rgba16(int tile) {
-    uint8_t rgba32_buf[480 * 240 * 4];
+static void import_texture_rgba16(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -589,26 +1281,15 @@ static void import_texture_rgba16(int tile) {
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     // SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
-    for (uint32_t i = 0; i < size_bytes / 2; i++) {
-        uint16_t col16 = (addr[2 * i] << 8) | addr[2 * i + 1];
-        uint8_t a = col16 & 1;
-        uint8_t r = col16 >> 11;
-        uint8_t g = (col16 >> 6) & 0x1f;
-        uint8_t b = (col16 >> 1) & 0x1f;
-        rgba32_buf[4 * i + 0] = SCALE_5_8(r);
-        rgba32_buf[4 * i + 1] = SCALE_5_8(g);
-        rgba32_buf[4 * i + 2] = SCALE_5_8(b);
-        rgba32_buf[4 * i + 3] = a ? 255 : 0;
-    }
-
     uint32_t width = rdp.texture_tile[tile].line_size_bytes / 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_16b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) { gfx_decode_texture_rgba16(rgba32_buf, addr, size_bytes); });
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
-static void import_texture_rgba32(int tile) {
+static void import_texture_rgba32(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -622,8 +1303,7 @@ static void import_texture_rgba32(int tile) {
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, addr, width, height);
 }
 
-static void import_texture_ia4(int tile) {
-    uint8_t rgba32_buf[32768];
+static void import_texture_ia4(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -631,29 +1311,15 @@ static void import_texture_ia4(int tile) {
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
-    for (uint32_t i = 0; i < size_bytes * 2; i++) {
-        uint8_t byte = addr[i / 2];
-        uint8_t part = (byte >> (4 - (i % 2) * 4)) & 0xf;
-        uint8_t intensity = part >> 1;
-        uint8_t alpha = part & 1;
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4 * i + 0] = SCALE_3_8(r);
-        rgba32_buf[4 * i + 1] = SCALE_3_8(g);
-        rgba32_buf[4 * i + 2] = SCALE_3_8(b);
-        rgba32_buf[4 * i + 3] = alpha ? 255 : 0;
-    }
-
     uint32_t width = rdp.texture_tile[tile].line_size_bytes * 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_4b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) { gfx_decode_texture_ia4(rgba32_buf, addr, size_bytes); });
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
-static void import_texture_ia8(int tile) {
-    uint8_t rgba32_buf[16384];
+static void import_texture_ia8(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -661,27 +1327,15 @@ static void import_texture_ia8(int tile) {
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
-    for (uint32_t i = 0; i < size_bytes; i++) {
-        uint8_t intensity = addr[i] >> 4;
-        uint8_t alpha = addr[i] & 0xf;
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4 * i + 0] = SCALE_4_8(r);
-        rgba32_buf[4 * i + 1] = SCALE_4_8(g);
-        rgba32_buf[4 * i + 2] = SCALE_4_8(b);
-        rgba32_buf[4 * i + 3] = SCALE_4_8(alpha);
-    }
-
     uint32_t width = rdp.texture_tile[tile].line_size_bytes;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_8b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) { gfx_decode_texture_ia8(rgba32_buf, addr, size_bytes); });
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
-static void import_texture_ia16(int tile) {
-    uint8_t rgba32_buf[8192];
+static void import_texture_ia16(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -689,27 +1343,15 @@ static void import_texture_ia16(int tile) {
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
-    for (uint32_t i = 0; i < size_bytes / 2; i++) {
-        uint8_t intensity = addr[2 * i];
-        uint8_t alpha = addr[2 * i + 1];
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4 * i + 0] = r;
-        rgba32_buf[4 * i + 1] = g;
-        rgba32_buf[4 * i + 2] = b;
-        rgba32_buf[4 * i + 3] = alpha;
-    }
-
     uint32_t width = rdp.texture_tile[tile].line_size_bytes / 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_16b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) { gfx_decode_texture_ia16(rgba32_buf, addr, size_bytes); });
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
-static void import_texture_i4(int tile) {
-    uint8_t rgba32_buf[32768];
+static void import_texture_i4(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -717,29 +1359,15 @@ static void import_texture_i4(int tile) {
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     // SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
-    for (uint32_t i = 0; i < size_bytes * 2; i++) {
-        uint8_t byte = addr[i / 2];
-        uint8_t part = (byte >> (4 - (i % 2) * 4)) & 0xf;
-        uint8_t intensity = part;
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        uint8_t a = intensity;
-        rgba32_buf[4 * i + 0] = SCALE_4_8(r);
-        rgba32_buf[4 * i + 1] = SCALE_4_8(g);
-        rgba32_buf[4 * i + 2] = SCALE_4_8(b);
-        rgba32_buf[4 * i + 3] = SCALE_4_8(a);
-    }
-
     uint32_t width = rdp.texture_tile[tile].line_size_bytes * 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_4b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) { gfx_decode_texture_i4(rgba32_buf, addr, size_bytes); });
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
-static void import_texture_i8(int tile) {
-    uint8_t rgba32_buf[16384];
+static void import_texture_i8(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -747,27 +1375,15 @@ static void import_texture_i8(int tile) {
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     // SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
-    for (uint32_t i = 0; i < size_bytes; i++) {
-        uint8_t intensity = addr[i];
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        uint8_t a = intensity;
-        rgba32_buf[4 * i + 0] = r;
-        rgba32_buf[4 * i + 1] = g;
-        rgba32_buf[4 * i + 2] = b;
-        rgba32_buf[4 * i + 3] = a;
-    }
-
     uint32_t width = rdp.texture_tile[tile].line_size_bytes;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_8b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) { gfx_decode_texture_i8(rgba32_buf, addr, size_bytes); });
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
-static void import_texture_ci4(int tile) {
-    uint8_t rgba32_buf[32768];
+static void import_texture_ci4(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
@@ -777,60 +1393,65 @@ static void import_texture_ci4(int tile) {
     const uint8_t* palette = rdp.palettes[pal_idx / 8] + (pal_idx % 8) * 16 * 2; // 16 pixel entries, 16 bits each
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
-    for (uint32_t i = 0; i < size_bytes * 2; i++) {
-        uint8_t byte = addr[i / 2];
-        uint8_t idx = (byte >> (4 - (i % 2) * 4)) & 0xf;
-        uint16_t col16 = (palette[idx * 2] << 8) | palette[idx * 2 + 1]; // Big endian load
-        uint8_t a = col16 & 1;
-        uint8_t r = col16 >> 11;
-        uint8_t g = (col16 >> 6) & 0x1f;
-        uint8_t b = (col16 >> 1) & 0x1f;
-        rgba32_buf[4 * i + 0] = SCALE_5_8(r);
-        rgba32_buf[4 * i + 1] = SCALE_5_8(g);
-        rgba32_buf[4 * i + 2] = SCALE_5_8(b);
-        rgba32_buf[4 * i + 3] = a ? 255 : 0;
-    }
-
     uint32_t width = rdp.texture_tile[tile].line_size_bytes * 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_4b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) {
+                                   gfx_decode_texture_ci4(rgba32_buf, addr, size_bytes, palette);
+                               });
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
-static void import_texture_ci8(int tile) {
-    uint8_t rgba32_buf[16384];
+static void import_texture_ci8(int i, int tile) {
     const uint8_t* addr = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
-
-    for (uint32_t i = 0, j = 0; i < size_bytes; j += full_image_line_size_bytes - line_size_bytes) {
-        for (uint32_t k = 0; k < line_size_bytes; i++, k++, j++) {
-            uint8_t idx = addr[j];
-            uint16_t col16 = (rdp.palettes[idx / 128][(idx % 128) * 2] << 8) |
-                             rdp.palettes[idx / 128][(idx % 128) * 2 + 1]; // Big endian load
-            uint8_t a = col16 & 1;
-            uint8_t r = col16 >> 11;
-            uint8_t g = (col16 >> 6) & 0x1f;
-            uint8_t b = (col16 >> 1) & 0x1f;
-            rgba32_buf[4 * i + 0] = SCALE_5_8(r);
-            rgba32_buf[4 * i + 1] = SCALE_5_8(g);
-            rgba32_buf[4 * i + 2] = SCALE_5_8(b);
-            rgba32_buf[4 * i + 3] = a ? 255 : 0;
-        }
-    }
+    const uint8_t* palettes[2] = { rdp.palettes[0], rdp.palettes[1] };
+    uint16_t palette_entries[2] = { rdp.palette_entries[0], rdp.palette_entries[1] };
 
     uint32_t width = rdp.texture_tile[tile].line_size_bytes;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    if (size_bytes > 15000) {
-        int bp = 0;
+    gfx_import_decoded_texture(i, gfx_decoded_texture_size(G_IM_SIZ_8b, size_bytes), width, height,
+                               [=](uint8_t* rgba32_buf) {
+                                   gfx_decode_texture_ci8(rgba32_buf, addr, size_bytes, line_size_bytes,
+                                                          full_image_line_size_bytes, palettes, palette_entries);
+                               });
+    // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
+}
+
+// Uploads the RGBA32 data the resource manager decoded at load time, if the loaded texture is exactly the start of a
+// pre-decoded texture resource in the format the tile reads it as.
+static bool import_texture_predecoded(int tile) {
+    uint8_t fmt = rdp.texture_tile[tile].fmt;
+    uint8_t siz = rdp.texture_tile[tile].siz;
+    const auto& loaded = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index];
+
+    if (loaded.otr_hash == 0 || fmt == G_IM_FMT_CI) {
+        return false;
     }
 
-    gfx_rapi->upload_texture(rgba32_buf, width, height);
-    // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
+    Ship::Resource* res = Ship::Window::GetInstance()->GetResourceManager()->GetResidentResource(loaded.otr_hash);
+    if (res == nullptr || res->Type != Ship::ResourceType::Texture) {
+        return false;
+    }
+
+    Ship::Texture* texture = (Ship::Texture*)res;
+    uint8_t textureFmt, textureSiz;
+    if (texture->DecodedImageData.empty() || texture->ImageData != loaded.addr ||
+        loaded.size_bytes > texture->ImageDataSize || !texture->GetImageFormat(textureFmt, textureSiz) ||
+        textureFmt != fmt || textureSiz != siz) {
+        return false;
+    }
+
+    uint32_t width = gfx_decoded_texture_size(siz, rdp.texture_tile[tile].line_size_bytes) / 4;
+    uint32_t height = loaded.size_bytes / rdp.texture_tile[tile].line_size_bytes;
+
+    gfx_rapi->upload_texture(texture->DecodedImageData.data(), width, height);
+    return true;
 }
 
 static void import_texture(int i, int tile) {
@@ -842,39 +1463,43 @@ static void import_texture(int i, int tile) {
         return;
     }
 
+    if (import_texture_predecoded(tile)) {
+        return;
+    }
+
     int t0 = get_time();
     if (fmt == G_IM_FMT_RGBA) {
         if (siz == G_IM_SIZ_16b) {
-            import_texture_rgba16(tile);
+            import_texture_rgba16(i, tile);
         } else if (siz == G_IM_SIZ_32b) {
-            import_texture_rgba32(tile);
+            import_texture_rgba32(i, tile);
         } else {
             // abort(); // OTRTODO: Sometimes, seemingly randomly, we end up here. Could be a bad dlist, could be
             // something F3D does not have supported. Further investigation is needed.
         }
     } else if (fmt == G_IM_FMT_IA) {
         if (siz == G_IM_SIZ_4b) {
-            import_texture_ia4(tile);
+            import_texture_ia4(i, tile);
         } else if (siz == G_IM_SIZ_8b) {
-            import_texture_ia8(tile);
+            import_texture_ia8(i, tile);
         } else if (siz == G_IM_SIZ_16b) {
-            import_texture_ia16(tile);
+            import_texture_ia16(i, tile);
         } else {
             abort();
         }
     } else if (fmt == G_IM_FMT_CI) {
         if (siz == G_IM_SIZ_4b) {
-            import_texture_ci4(tile);
+            import_texture_ci4(i, tile);
         } else if (siz == G_IM_SIZ_8b) {
-            import_texture_ci8(tile);
+            import_texture_ci8(i, tile);
         } else {
             abort();
         }
     } else if (fmt == G_IM_FMT_I) {
         if (siz == G_IM_SIZ_4b) {
-            import_texture_i4(tile);
+            import_texture_i4(i, tile);
         } else if (siz == G_IM_SIZ_8b) {
-            import_texture_i8(tile);
+            import_texture_i8(i, tile);
         } else {
             abort();
         }
@@ -918,7 +1543,12 @@ static void gfx_matrix_mul(float res[4][4], const float a[4][4], const float b[4
 static void gfx_sp_matrix(uint8_t parameters, const int32_t* addr) {
     float matrix[4][4];
 
+    gfx_capture_data(addr, sizeof(Mtx));
+
     if (auto it = current_mtx_replacements->find((Mtx*)addr); it != current_mtx_replacements->end()) {
+        if (frame_capture != nullptr) {
+            frame_capture->mtx_replacements[(const Mtx*)addr] = it->second;
+        }
         for (int i = 0; i < 4; i++) {
             for (int j = 0; j < 4; j++) {
                 float v = it->second.mf[i][j];
@@ -997,145 +1627,118 @@ static void gfx_adjust_width_height_for_scale(uint32_t& width, uint32_t& height)
     }
 }
 
-static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx* vertices) {
-    for (size_t i = 0; i < n_vertices; i++, dest_index++) {
-        const Vtx_t* v = &vertices[i].v;
-        const Vtx_tn* vn = &vertices[i].n;
-        struct LoadedVertex* d = &rsp.loaded_vertices[dest_index];
-
-        if (v == NULL) {
-            return;
+static void gfx_sp_transform_vertices(size_t n_vertices, size_t dest_index, const Vtx* vertices) {
+    if ((rsp.geometry_mode & G_LIGHTING) && rsp.lights_changed) {
+        for (int i = 0; i < rsp.current_num_lights - 1; i++) {
+            calculate_normal_dir(&rsp.current_lights[i], rsp.current_lights_coeffs[i]);
         }
+        /*static const Light_t lookat_x = {{0, 0, 0}, 0, {0, 0, 0}, 0, {127, 0, 0}, 0};
+        static const Light_t lookat_y = {{0, 0, 0}, 0, {0, 0, 0}, 0, {0, 127, 0}, 0};*/
+        calculate_normal_dir(&rsp.lookat[0], rsp.current_lookat_coeffs[0]);
+        calculate_normal_dir(&rsp.lookat[1], rsp.current_lookat_coeffs[1]);
+        rsp.lights_changed = false;
+    }
 
-        float x = v->ob[0] * rsp.MP_matrix[0][0] + v->ob[1] * rsp.MP_matrix[1][0] + v->ob[2] * rsp.MP_matrix[2][0] +
-                  rsp.MP_matrix[3][0];
-        float y = v->ob[0] * rsp.MP_matrix[0][1] + v->ob[1] * rsp.MP_matrix[1][1] + v->ob[2] * rsp.MP_matrix[2][1] +
-                  rsp.MP_matrix[3][1];
-        float z = v->ob[0] * rsp.MP_matrix[0][2] + v->ob[1] * rsp.MP_matrix[1][2] + v->ob[2] * rsp.MP_matrix[2][2] +
-                  rsp.MP_matrix[3][2];
-        float w = v->ob[0] * rsp.MP_matrix[0][3] + v->ob[1] * rsp.MP_matrix[1][3] + v->ob[2] * rsp.MP_matrix[2][3] +
-                  rsp.MP_matrix[3][3];
+    struct GfxVertexTransformState state;
+    state.mp_matrix = rsp.MP_matrix;
+    state.adjust_x_for_aspect_ratio = !fbActive;
+    state.aspect_ratio = (float)gfx_current_dimensions.width / (float)gfx_current_dimensions.height;
+    state.geometry_mode = rsp.geometry_mode;
+    state.num_lights = rsp.current_num_lights;
+    state.lights = rsp.current_lights;
+    state.lights_coeffs = rsp.current_lights_coeffs;
+    state.lookat_coeffs = rsp.current_lookat_coeffs;
+    state.texture_scaling_s = rsp.texture_scaling_factor.s;
+    state.texture_scaling_t = rsp.texture_scaling_factor.t;
+    state.fog_mul = rsp.fog_mul;
+    state.fog_offset = rsp.fog_offset;
+
+    gfx_transform_vertices(&rsp.loaded_vertices[dest_index], vertices, n_vertices, &state);
+}
 
-        x = gfx_adjust_x_for_aspect_ratio(x);
+// Runs the vertex loads skipped while replaying, for the slots no later load overwrote
+static void gfx_retained_load_pending_vertices(void) {
+    bool loaded[MAX_VERTICES + 4] = {};
+    uint32_t geometry_mode = rsp.geometry_mode;
+    auto texture_scaling_factor = rsp.texture_scaling_factor;
+
+    for (auto load = retained.pending_loads.rbegin(); load != retained.pending_loads.rend(); ++load) {
+        rsp.geometry_mode = load->geometry_mode;
+        rsp.texture_scaling_factor.s = load->scaling_s;
+        rsp.texture_scaling_factor.t = load->scaling_t;
+        for (size_t i = 0; i < load->count; i++) {
+            if (!loaded[load->dest_index + i]) {
+                loaded[load->dest_index + i] = true;
+                gfx_sp_transform_vertices(1, load->dest_index + i, &load->vertices[i]);
+            }
+        }
+    }
+    rsp.geometry_mode = geometry_mode;
+    rsp.texture_scaling_factor = texture_scaling_factor;
+    retained.pending_loads.clear();
+}
 
-        short U = v->tc[0] * rsp.texture_scaling_factor.s >> 16;
-        short V = v->tc[1] * rsp.texture_scaling_factor.t >> 16;
+// Stops recording because the display list does something a mesh can not reproduce, for instance lighting vertices
+static void gfx_retained_cancel_capture(void) {
+    retained.mesh->unretainable = true;
+    retained.mode = RETAINED_NONE;
+    retained_mesh_stats.fallbacks++;
+}
 
-        if (rsp.geometry_mode & G_LIGHTING) {
-            if (rsp.lights_changed) {
-                for (int i = 0; i < rsp.current_num_lights - 1; i++) {
-                    calculate_normal_dir(&rsp.current_lights[i], rsp.current_lights_coeffs[i]);
-                }
-                /*static const Light_t lookat_x = {{0, 0, 0}, 0, {0, 0, 0}, 0, {127, 0, 0}, 0};
-                static const Light_t lookat_y = {{0, 0, 0}, 0, {0, 0, 0}, 0, {0, 127, 0}, 0};*/
-                calculate_normal_dir(&rsp.lookat[0], rsp.current_lookat_coeffs[0]);
-                calculate_normal_dir(&rsp.lookat[1], rsp.current_lookat_coeffs[1]);
-                rsp.lights_changed = false;
-            }
+// Stops replaying when the display list no longer matches the recording. What matched so far is drawn from the mesh,
+// and the mesh is recorded again later unless this keeps happening.
+static void gfx_retained_cancel_replay(void) {
+    RetainedMesh* mesh = retained.mesh;
+    gfx_retained_flush();
+    gfx_retained_load_pending_vertices();
+    retained.mode = RETAINED_NONE;
+    retained_mesh_stats.fallbacks++;
+
+    gfx_rapi->delete_mesh(mesh->mesh_id);
+    retained.mesh_bytes -= mesh->size_bytes;
+    retained.num_meshes--;
+    mesh->mesh_id = 0;
+    mesh->size_bytes = 0;
+    mesh->frames_seen = 0;
+    mesh->unretainable = ++mesh->failures >= RETAINED_MESH_MAX_FAILURES;
+}
 
-            int r = rsp.current_lights[rsp.current_num_lights - 1].col[0];
-            int g = rsp.current_lights[rsp.current_num_lights - 1].col[1];
-            int b = rsp.current_lights[rsp.current_num_lights - 1].col[2];
-
-            for (int i = 0; i < rsp.current_num_lights - 1; i++) {
-                float intensity = 0;
-                intensity += vn->n[0] * rsp.current_lights_coeffs[i][0];
-                intensity += vn->n[1] * rsp.current_lights_coeffs[i][1];
-                intensity += vn->n[2] * rsp.current_lights_coeffs[i][2];
-                intensity /= 127.0f;
-                if (intensity > 0.0f) {
-                    r += intensity * rsp.current_lights[i].col[0];
-                    g += intensity * rsp.current_lights[i].col[1];
-                    b += intensity * rsp.current_lights[i].col[2];
-                }
-            }
+static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx* vertices) {
+    gfx_capture_data(vertices, n_vertices * sizeof(Vtx));
 
-            d->color.r = r > 255 ? 255 : r;
-            d->color.g = g > 255 ? 255 : g;
-            d->color.b = b > 255 ? 255 : b;
-
-            if (rsp.geometry_mode & G_TEXTURE_GEN) {
-                float dotx = 0, doty = 0;
-                dotx += vn->n[0] * rsp.current_lookat_coeffs[0][0];
-                dotx += vn->n[1] * rsp.current_lookat_coeffs[0][1];
-                dotx += vn->n[2] * rsp.current_lookat_coeffs[0][2];
-                doty += vn->n[0] * rsp.current_lookat_coeffs[1][0];
-                doty += vn->n[1] * rsp.current_lookat_coeffs[1][1];
-                doty += vn->n[2] * rsp.current_lookat_coeffs[1][2];
-
-                dotx /= 127.0f;
-                doty /= 127.0f;
-
-                dotx = Ship::Math::clamp(dotx, -1.0f, 1.0f);
-                doty = Ship::Math::clamp(doty, -1.0f, 1.0f);
-
-                if (rsp.geometry_mode & G_TEXTURE_GEN_LINEAR) {
-                    // Not sure exactly what formula we should use to get accurate values
-                    /*dotx = (2.906921f * dotx * dotx + 1.36114f) * dotx;
-                    doty = (2.906921f * doty * doty + 1.36114f) * doty;
-                    dotx = (dotx + 1.0f) / 4.0f;
-                    doty = (doty + 1.0f) / 4.0f;*/
-                    dotx = acosf(-dotx) /* M_PI */ / 4.0f;
-                    doty = acosf(-doty) /* M_PI */ / 4.0f;
-                } else {
-                    dotx = (dotx + 1.0f) / 4.0f;
-                    doty = (doty + 1.0f) / 4.0f;
-                }
+    if (vertices == NULL || n_vertices == 0) {
+        return;
+    }
 
-                U = (int32_t)(dotx * rsp.texture_scaling_factor.s);
-                V = (int32_t)(doty * rsp.texture_scaling_factor.t);
-            }
+    if (retained.mode == RETAINED_CAPTURE) {
+        if (rsp.geometry_mode & G_LIGHTING) {
+            // The colors would depend on the lights and the matrix
+            gfx_retained_cancel_capture();
         } else {
-            d->color.r = v->cn[0];
-            d->color.g = v->cn[1];
-            d->color.b = v->cn[2];
+            uint64_t hash = gfx_hash_bytes((const uint8_t*)vertices, n_vertices * sizeof(Vtx), 0);
+            retained.mesh->loads.push_back({ vertices, (uint8_t)n_vertices, (uint8_t)dest_index, hash });
+            for (size_t i = 0; i < n_vertices; i++) {
+                retained.slots[dest_index + i].vertex = &vertices[i];
+                retained.slots[dest_index + i].fog = (rsp.geometry_mode & G_FOG) != 0;
+            }
         }
-
-        d->u = U;
-        d->v = V;
-
-        // trivial clip rejection
-        d->clip_rej = 0;
-        if (x < -w) {
-            d->clip_rej |= 1; // CLIP_LEFT
-        }
-        if (x > w) {
-            d->clip_rej |= 2; // CLIP_RIGHT
-        }
-        if (y < -w) {
-            d->clip_rej |= 4; // CLIP_BOTTOM
-        }
-        if (y > w) {
-            d->clip_rej |= 8; // CLIP_TOP
-        }
-        // if (z < -w) d->clip_rej |= 16; // CLIP_NEAR
-        if (z > w) {
-            d->clip_rej |= 32; // CLIP_FAR
-        }
-
-        d->x = x;
-        d->y = y;
-        d->z = z;
-        d->w = w;
-
-        if (rsp.geometry_mode & G_FOG) {
-            if (fabsf(w) < 0.001f) {
-                // To avoid division by zero
-                w = 0.001f;
-            }
-
-            float winv = 1.0f / w;
-            if (winv < 0.0f) {
-                winv = std::numeric_limits<int16_t>::max();
-            }
-
-            float fog_z = z * winv * rsp.fog_mul + rsp.fog_offset;
-            fog_z = Ship::Math::clamp(fog_z, 0.0f, 255.0f);
-            d->color.a = fog_z; // Use alpha variable to store fog factor
-        } else {
-            d->color.a = v->cn[3];
+    } else if (retained.mode == RETAINED_REPLAY) {
+        // The vertex data can change without the commands changing, so it is compared too
+        const RetainedVertexLoad* load = retained.load_index < retained.mesh->loads.size()
+                                             ? &retained.mesh->loads[retained.load_index++]
+                                             : nullptr;
+        if (load != nullptr && load->vertices == vertices && load->count == n_vertices &&
+            load->dest_index == dest_index &&
+            load->hash == gfx_hash_bytes((const uint8_t*)vertices, n_vertices * sizeof(Vtx), 0)) {
+            retained.pending_loads.push_back({ vertices, (uint8_t)n_vertices, (uint8_t)dest_index,
+                                               rsp.geometry_mode, rsp.texture_scaling_factor.s,
+                                               rsp.texture_scaling_factor.t });
+            return;
         }
+        gfx_retained_cancel_replay();
     }
+
+    gfx_sp_transform_vertices(n_vertices, dest_index, vertices);
 }
 
 static void gfx_sp_modify_vertex(uint16_t vtx_idx, uint8_t where, uint32_t val) {
@@ -1149,17 +1752,85 @@ static void gfx_sp_modify_vertex(uint16_t vtx_idx, uint8_t where, uint32_t val)
     v->v = t;
 }
 
-static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bool is_rect) {
-    struct LoadedVertex* v1 = &rsp.loaded_vertices[vtx1_idx];
-    struct LoadedVertex* v2 = &rsp.loaded_vertices[vtx2_idx];
-    struct LoadedVertex* v3 = &rsp.loaded_vertices[vtx3_idx];
-    struct LoadedVertex* v_arr[3] = { v1, v2, v3 };
+// Stores a color in the next 32-bit word of a packed vertex
+static inline void gfx_sp_append_rgba8(float* vtx, size_t* vtx_len, struct RGBA color) {
+    memcpy(&vtx[(*vtx_len)++], &color, sizeof(color));
+}
 
-    // if (rand()%2) return;
+// Points buf_vbo at where the next batch is written, at the start of a batch
+static void gfx_sp_map_vertex_buffer(void) {
+    float* mapped = gfx_rapi->map_vertex_buffer != nullptr
+                        ? gfx_rapi->map_vertex_buffer(sizeof(buf_vbo_storage) / sizeof(float))
+                        : nullptr;
+    buf_vbo = mapped != nullptr ? mapped : buf_vbo_storage;
+}
+
+static void gfx_sp_emit_vertex(size_t slot_index, const float* vtx, size_t vtx_len) {
+    if (gfx_rapi->draw_indexed_triangles == nullptr) {
+        memcpy(buf_vbo + buf_vbo_len, vtx, vtx_len * sizeof(float));
+        buf_vbo_len += vtx_len;
+        return;
+    }
+
+    // The floats are compared rather than the state that produced them, since colors, tiles and the vertex itself can
+    // all change in the middle of a batch
+    struct BufVboSlot* slot = &buf_vbo_slots[slot_index];
+    if (slot->batch != buf_vbo_batch || memcmp(slot->data, vtx, vtx_len * sizeof(float)) != 0) {
+        memcpy(buf_vbo + buf_vbo_len, vtx, vtx_len * sizeof(float));
+        buf_vbo_len += vtx_len;
+        memcpy(slot->data, vtx, vtx_len * sizeof(float));
+        slot->batch = buf_vbo_batch;
+        slot->index = buf_vbo_num_verts++;
+    }
+    buf_ibo[buf_ibo_len++] = slot->index;
+}
+
+// Adds a triangle to the mesh being recorded. vtx holds its vertices as written for immediate mode, and their positions
+// are replaced with the object space ones.
+static void gfx_retained_record_triangle(struct LoadedVertex* v_arr[3], float vtx[3][32], size_t vtx_len,
+                                         int fog_index) {
+    RetainedMesh* mesh = retained.mesh;
+    uint32_t cull_mode = rsp.geometry_mode & G_CULL_BOTH;
+    if (mesh->segments.empty() || vtx_len != retained.segment_vtx_len || cull_mode != mesh->segments.back().cull_mode) {
+        mesh->segments.push_back({ (uint32_t)retained.vbo.size(), (uint32_t)retained.ibo.size(), 0, cull_mode });
+        retained.segment_id++;
+        retained.segment_vtx_len = vtx_len;
+        retained.segment_num_verts = 0;
+    }
 
+    for (int i = 0; i < 3; i++) {
+        struct RetainedVertexSlot* slot = &retained.slots[v_arr[i] - rsp.loaded_vertices];
+        if (slot->vertex == nullptr) {
+            // Loaded before the display list started
+            gfx_retained_cancel_capture();
+            return;
+        }
+
+        float* data = vtx[i];
+        data[0] = slot->vertex->v.ob[0];
+        data[1] = slot->vertex->v.ob[1];
+        data[2] = slot->vertex->v.ob[2];
+        data[3] = 1.0f;
+        if (fog_index >= 0 && slot->fog) {
+            ((uint8_t*)&data[fog_index])[1] = 255;
+        }
+
+        if (slot->segment != retained.segment_id || memcmp(slot->data, data, vtx_len * sizeof(float)) != 0) {
+            retained.vbo.insert(retained.vbo.end(), data, data + vtx_len);
+            memcpy(slot->data, data, vtx_len * sizeof(float));
+            slot->segment = retained.segment_id;
+            slot->index = retained.segment_num_verts++;
+        }
+        retained.ibo.push_back(slot->index);
+    }
+    mesh->segments.back().num_indices += 3;
+}
+
+// Whether the triangle is clipped or culled as a whole
+static bool gfx_sp_triangle_rejected(struct LoadedVertex* v1, struct LoadedVertex* v2, struct LoadedVertex* v3) {
     if (v1->clip_rej & v2->clip_rej & v3->clip_rej) {
         // The whole triangle lies outside the visible area
-        return;
+        return true;
     }
 
     if ((rsp.geometry_mode & G_CULL_BOTH) != 0) {
@@ -1178,20 +1849,35 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
         switch (rsp.geometry_mode & G_CULL_BOTH) {
             case G_CULL_FRONT:
                 if (cross <= 0) {
-                    return;
+                    return true;
                 }
                 break;
             case G_CULL_BACK:
                 if (cross >= 0) {
-                    return;
+                    return true;
                 }
                 break;
             case G_CULL_BOTH:
                 // Why is this even an option?
-                return;
+                return true;
         }
     }
+    return false;
+}
 
+// What the triangles drawn next are drawn with, worked out from the RDP state
+struct DrawState {
+    ColorCombiner* comb;
+    uint32_t tm; // texture coordinates clamped in the shader, two bits per texture
+    uint32_t tex_width[2], tex_height[2], tex_width2[2], tex_height2[2];
+    bool use_alpha, use_fog, use_grayscale;
+    bool packed; // whether vertices take the packed layout, with draw constants
+    uint8_t num_inputs;
+    bool used_textures[2];
+};
+
+// Brings the backend in line with the RDP state, flushing the triangles buffered so far if any of it changes
+static void gfx_sp_prepare_draw(struct DrawState* state) {
     bool depth_test = (rsp.geometry_mode & G_ZBUFFER) == G_ZBUFFER;
     bool depth_mask = (rdp.other_mode_l & Z_UPD) == Z_UPD;
     uint8_t depth_test_and_mask = (depth_test ? 1 : 0) | (depth_mask ? 2 : 0);
@@ -1223,25 +1909,25 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
     }
 
     uint64_t cc_id = rdp.combine_mode;
-    bool use_alpha =
+    state->use_alpha =
         (rdp.other_mode_l & (3 << 20)) == (G_BL_CLR_MEM << 20) && (rdp.other_mode_l & (3 << 16)) == (G_BL_1MA << 16);
-    bool use_fog = (rdp.other_mode_l >> 30) == G_BL_CLR_FOG;
+    state->use_fog = (rdp.other_mode_l >> 30) == G_BL_CLR_FOG;
     bool texture_edge = (rdp.other_mode_l & CVG_X_ALPHA) == CVG_X_ALPHA;
     bool use_noise = (rdp.other_mode_l & (3U << G_MDSFT_ALPHACOMPARE)) == G_AC_DITHER;
     bool use_2cyc = (rdp.other_mode_h & (3U << G_MDSFT_CYCLETYPE)) == G_CYC_2CYCLE;
     bool alpha_threshold = (rdp.other_mode_l & (3U << G_MDSFT_ALPHACOMPARE)) == G_AC_THRESHOLD;
     bool invisible =
         (rdp.other_mode_l & (3 << 24)) == (G_BL_0 << 24) && (rdp.other_mode_l & (3 << 20)) == (G_BL_CLR_MEM << 20);
-    bool use_grayscale = rdp.grayscale;
+    state->use_grayscale = rdp.grayscale;
 
     if (texture_edge) {
-        use_alpha = true;
+        state->use_alpha = true;
     }
 
-    if (use_alpha) {
+    if (state->use_alpha) {
         cc_id |= (uint64_t)SHADER_OPT_ALPHA << CC_SHADER_OPT_POS;
     }
-    if (use_fog) {
+    if (state->use_fog) {
         cc_id |= (uint64_t)SHADER_OPT_FOG << CC_SHADER_OPT_POS;
     }
     if (texture_edge) {
@@ -1259,25 +1945,35 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
     if (invisible) {
         cc_id |= (uint64_t)SHADER_OPT_INVISIBLE << CC_SHADER_OPT_POS;
     }
-    if (use_grayscale) {
+    if (state->use_grayscale) {
         cc_id |= (uint64_t)SHADER_OPT_GRAYSCALE << CC_SHADER_OPT_POS;
     }
 
-    if (!use_alpha) {
+    if (!state->use_alpha) {
         cc_id &= ~((0xfff << 16) | ((uint64_t)0xfff << 44));
     }
 
-    ColorCombiner* comb = gfx_lookup_or_create_color_combiner(cc_id);
+    state->comb = gfx_lookup_or_create_color_combiner(cc_id);
 
-    uint32_t tm = 0;
-    uint32_t tex_width[2], tex_height[2], tex_width2[2], tex_height2[2];
+    state->tm = 0;
 
     for (int i = 0; i < 2; i++) {
         uint32_t tile = rdp.first_tile_index + i;
-        if (comb->used_textures[i]) {
+        if (state->comb->used_textures[i]) {
             if (rdp.textures_changed[i]) {
-                gfx_flush();
-                import_texture(i, tile);
+                // Tile and load commands flag the textures whether or not they change what the tile resolves to
+                TextureCacheNode* bound = rendering_state.textures[i];
+                if (bound != nullptr && bound->first == gfx_texture_cache_key(tile)) {
+                    // Selected again without a flush, since ImGui and framebuffer changes bind textures to the units
+                    // without going through gfx_pc
+                    gfx_rapi->select_texture(i, bound->second.texture_id);
+                    gfx_texture_cache.lru.splice(gfx_texture_cache.lru.end(), gfx_texture_cache.lru,
+                                                 bound->second.lru_location);
+                    render_state_stats.avoided_flushes++;
+                } else {
+                    gfx_flush();
+                    import_texture(i, tile);
+                }
                 rdp.textures_changed[i] = false;
             }
 
@@ -1291,7 +1987,7 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
                 line_size = 1;
             }
 
-            tex_height[i] = tex_size_bytes / line_size;
+            state->tex_height[i] = tex_size_bytes / line_size;
             switch (rdp.texture_tile[tile].siz) {
                 case G_IM_SIZ_4b:
                     line_size <<= 1;
@@ -1303,42 +1999,44 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
                     break;
                 case G_IM_SIZ_32b:
                     line_size /= G_IM_SIZ_32b_LINE_BYTES; // this is 2!
-                    tex_height[i] /= 2;
+                    state->tex_height[i] /= 2;
                     break;
             }
-            tex_width[i] = line_size;
+            state->tex_width[i] = line_size;
 
-            tex_width2[i] = (rdp.texture_tile[tile].lrs - rdp.texture_tile[tile].uls + 4) / 4;
-            tex_height2[i] = (rdp.texture_tile[tile].lrt - rdp.texture_tile[tile].ult + 4) / 4;
+            state->tex_width2[i] = (rdp.texture_tile[tile].lrs - rdp.texture_tile[tile].uls + 4) / 4;
+            state->tex_height2[i] = (rdp.texture_tile[tile].lrt - rdp.texture_tile[tile].ult + 4) / 4;
 
-            uint32_t tex_width1 = tex_width[i] << (cms & G_TX_MIRROR);
-            uint32_t tex_height1 = tex_height[i] << (cmt & G_TX_MIRROR);
+            uint32_t tex_width1 = state->tex_width[i] << (cms & G_TX_MIRROR);
+            uint32_t tex_height1 = state->tex_height[i] << (cmt & G_TX_MIRROR);
 
-            if ((cms & G_TX_CLAMP) && ((cms & G_TX_MIRROR) || tex_width1 != tex_width2[i])) {
-                tm |= 1 << 2 * i;
+            if ((cms & G_TX_CLAMP) && ((cms & G_TX_MIRROR) || tex_width1 != state->tex_width2[i])) {
+                state->tm |= 1 << 2 * i;
                 cms &= ~G_TX_CLAMP;
             }
-            if ((cmt & G_TX_CLAMP) && ((cmt & G_TX_MIRROR) || tex_height1 != tex_height2[i])) {
-                tm |= 1 << 2 * i + 1;
+            if ((cmt & G_TX_CLAMP) && ((cmt & G_TX_MIRROR) || tex_height1 != state->tex_height2[i])) {
+                state->tm |= 1 << 2 * i + 1;
                 cmt &= ~G_TX_CLAMP;
             }
 
             bool linear_filter = (rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT;
-            if (linear_filter != rendering_state.textures[i]->second.linear_filter ||
-                cms != rendering_state.textures[i]->second.cms || cmt != rendering_state.textures[i]->second.cmt) {
+            struct TextureSamplerState* sampler =
+                rendering_state.textures[i] != nullptr ? gfx_texture_sampler(rendering_state.textures[i]) : nullptr;
+            if (sampler != nullptr &&
+                (linear_filter != sampler->linear_filter || cms != sampler->cms || cmt != sampler->cmt)) {
                 gfx_flush();
                 gfx_rapi->set_sampler_parameters(i, linear_filter, cms, cmt);
-                rendering_state.textures[i]->second.linear_filter = linear_filter;
-                rendering_state.textures[i]->second.cms = cms;
-                rendering_state.textures[i]->second.cmt = cmt;
+                sampler->linear_filter = linear_filter;
+                sampler->cms = cms;
+                sampler->cmt = cmt;
             }
         }
     }
 
-    struct ShaderProgram* prg = comb->prg[tm];
+    struct ShaderProgram* prg = state->comb->prg[state->tm];
     if (prg == NULL) {
-        comb->prg[tm] = prg =
-            gfx_lookup_or_create_shader_program(comb->shader_id0, comb->shader_id1 | (tm * SHADER_OPT_TEXEL0_CLAMP_S));
+        uint32_t shader_id1 = state->comb->shader_id1 | (state->tm * SHADER_OPT_TEXEL0_CLAMP_S);
+        state->comb->prg[state->tm] = prg = gfx_lookup_or_create_shader_program(state->comb->shader_id0, shader_id1);
     }
     if (prg != rendering_state.shader_program) {
         gfx_flush();
@@ -1346,191 +2044,313 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
         gfx_rapi->load_shader(prg);
         rendering_state.shader_program = prg;
     }
-    if (use_alpha != rendering_state.alpha_blend) {
+    if (state->use_alpha != rendering_state.alpha_blend) {
         gfx_flush();
-        gfx_rapi->set_use_alpha(use_alpha);
-        rendering_state.alpha_blend = use_alpha;
+        gfx_rapi->set_use_alpha(state->use_alpha);
+        rendering_state.alpha_blend = state->use_alpha;
     }
-    uint8_t num_inputs;
-    bool used_textures[2];
-
     if (markerOn) {
         int bp = 0;
     }
 
-    gfx_rapi->shader_get_info(prg, &num_inputs, used_textures);
-
-    struct GfxClipParameters clip_parameters = gfx_rapi->get_clip_parameters();
-
-    for (int i = 0; i < 3; i++) {
-        float z = v_arr[i]->z, w = v_arr[i]->w;
-        if (clip_parameters.z_is_from_0_to_1) {
-            z = (z + w) / 2.0f;
+    gfx_rapi->shader_get_info(prg, &state->num_inputs, state->used_textures);
+
+    state->packed = gfx_rapi->set_draw_constants != nullptr;
+    if (state->packed) {
+        // Only the constants this draw uses are updated, so switching to a shader without fog, for instance, does not
+        // force a flush
+        struct GfxDrawConstants constants = rendering_state.draw_constants;
+        if (state->use_fog) {
+            constants.fog_color[0] = rdp.fog_color.r / 255.0f;
+            constants.fog_color[1] = rdp.fog_color.g / 255.0f;
+            constants.fog_color[2] = rdp.fog_color.b / 255.0f;
         }
-
-        if (markerOn) {
-            // z = 10;
+        if (state->use_grayscale) {
+            constants.grayscale_color[0] = rdp.grayscale_color.r / 255.0f;
+            constants.grayscale_color[1] = rdp.grayscale_color.g / 255.0f;
+            constants.grayscale_color[2] = rdp.grayscale_color.b / 255.0f;
+            constants.grayscale_color[3] = rdp.grayscale_color.a / 255.0f;
         }
-
-        buf_vbo[buf_vbo_len++] = v_arr[i]->x;
-        buf_vbo[buf_vbo_len++] = clip_parameters.invert_y ? -v_arr[i]->y : v_arr[i]->y;
-        buf_vbo[buf_vbo_len++] = z;
-        buf_vbo[buf_vbo_len++] = w;
-
         for (int t = 0; t < 2; t++) {
-            if (!used_textures[t]) {
+            if (!state->used_textures[t]) {
                 continue;
             }
-            float u = v_arr[i]->u / 32.0f;
-            float v = v_arr[i]->v / 32.0f;
-            int shifts = rdp.texture_tile[rdp.first_tile_index + t].shifts;
-            int shiftt = rdp.texture_tile[rdp.first_tile_index + t].shiftt;
-            if (shifts != 0) {
-                if (shifts <= 10) {
-                    u /= 1 << shifts;
-                } else {
-                    u *= 1 << (16 - shifts);
-                }
+            if (state->tm & (1 << 2 * t)) {
+                constants.tex_clamp[t][0] = (state->tex_width2[t] - 0.5f) / state->tex_width[t];
             }
-            if (shiftt != 0) {
-                if (shiftt <= 10) {
-                    v /= 1 << shiftt;
-                } else {
-                    v *= 1 << (16 - shiftt);
-                }
+            if (state->tm & (1 << 2 * t + 1)) {
+                constants.tex_clamp[t][1] = (state->tex_height2[t] - 0.5f) / state->tex_height[t];
             }
+        }
+        if (memcmp(&constants, &rendering_state.draw_constants, sizeof(constants)) != 0) {
+            gfx_flush();
+            gfx_rapi->set_draw_constants(&constants);
+            rendering_state.draw_constants = constants;
+        }
+    }
+}
 
-            u -= rdp.texture_tile[rdp.first_tile_index + t].uls / 4.0f;
-            v -= rdp.texture_tile[rdp.first_tile_index + t].ult / 4.0f;
+// Writes vert to vtx the way the shader of state reads it, and returns the number of floats written. v1 is the first
+// vertex of the triangle, which the level of detail hack reads.
+static size_t gfx_sp_write_vertex(const struct DrawState* state, const struct GfxClipParameters& clip_parameters,
+                                  struct LoadedVertex* vert, const struct LoadedVertex* v1, bool is_rect, float* vtx) {
+    size_t vtx_len = 0;
 
-            if ((rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT) {
-                // Linear filter adds 0.5f to the coordinates
-                if (!is_rect) {
-                    u += 0.5f;
-                    v += 0.5f;
-                }
-            }
+    float z = vert->z, w = vert->w;
+    if (clip_parameters.z_is_from_0_to_1) {
+        z = (z + w) / 2.0f;
+    }
 
-            buf_vbo[buf_vbo_len++] = u / tex_width[t];
-            buf_vbo[buf_vbo_len++] = v / tex_height[t];
+    if (markerOn) {
+        // z = 10;
+    }
 
-            bool clampS = tm & (1 << 2 * t);
-            bool clampT = tm & (1 << 2 * t + 1);
+    vtx[vtx_len++] = vert->x;
+    vtx[vtx_len++] = clip_parameters.invert_y ? -vert->y : vert->y;
+    vtx[vtx_len++] = z;
+    vtx[vtx_len++] = w;
 
-            if (clampS) {
-                buf_vbo[buf_vbo_len++] = (tex_width2[t] - 0.5f) / tex_width[t];
-            }
-#ifdef __WIIU__
-            else {
-                buf_vbo[buf_vbo_len++] = 0.0f;
+    for (int t = 0; t < 2; t++) {
+        if (!state->used_textures[t]) {
+            continue;
+        }
+        float u = vert->u / 32.0f;
+        float v = vert->v / 32.0f;
+        int shifts = rdp.texture_tile[rdp.first_tile_index + t].shifts;
+        int shiftt = rdp.texture_tile[rdp.first_tile_index + t].shiftt;
+        if (shifts != 0) {
+            if (shifts <= 10) {
+                u /= 1 << shifts;
+            } else {
+                u *= 1 << (16 - shifts);
             }
-#endif
-            if (clampT) {
-                buf_vbo[buf_vbo_len++] = (tex_height2[t] - 0.5f) / tex_height[t];
+        }
+        if (shiftt != 0) {
+            if (shiftt <= 10) {
+                v /= 1 << shiftt;
+            } else {
+                v *= 1 << (16 - shiftt);
             }
-#ifdef __WIIU__
-            else {
-                buf_vbo[buf_vbo_len++] = 0.0f;
+        }
+
+        u -= rdp.texture_tile[rdp.first_tile_index + t].uls / 4.0f;
+        v -= rdp.texture_tile[rdp.first_tile_index + t].ult / 4.0f;
+
+        if ((rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT) {
+            // Linear filter adds 0.5f to the coordinates
+            if (!is_rect) {
+                u += 0.5f;
+                v += 0.5f;
             }
-#endif
         }
 
-        if (use_fog) {
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.r / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.g / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.b / 255.0f;
-            buf_vbo[buf_vbo_len++] = v_arr[i]->color.a / 255.0f; // fog factor (not alpha)
+        vtx[vtx_len++] = u / state->tex_width[t];
+        vtx[vtx_len++] = v / state->tex_height[t];
+
+        if (state->packed) {
+            // The clamp bounds are draw constants
+            continue;
         }
 
-        if (use_grayscale) {
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.r / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.g / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.b / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.a / 255.0f; // lerp interpolation factor (not alpha)
+        bool clampS = state->tm & (1 << 2 * t);
+        bool clampT = state->tm & (1 << 2 * t + 1);
+
+        if (clampS) {
+            vtx[vtx_len++] = (state->tex_width2[t] - 0.5f) / state->tex_width[t];
         }
+#ifdef __WIIU__
+        else {
+            vtx[vtx_len++] = 0.0f;
+        }
+#endif
+        if (clampT) {
+            vtx[vtx_len++] = (state->tex_height2[t] - 0.5f) / state->tex_height[t];
+        }
+#ifdef __WIIU__
+        else {
+            vtx[vtx_len++] = 0.0f;
+        }
+#endif
+    }
 
-        for (int j = 0; j < num_inputs; j++) {
-            struct RGBA* color = 0;
-            struct RGBA tmp;
-            for (int k = 0; k < 1 + (use_alpha ? 1 : 0); k++) {
-                switch (comb->shader_input_mapping[k][j]) {
-                        // Note: CCMUX constants and ACMUX constants used here have same value, which is why this works
-                        // (except LOD fraction).
-                    case G_CCMUX_PRIMITIVE:
-                        color = &rdp.prim_color;
-                        break;
-                    case G_CCMUX_SHADE:
-                        color = &v_arr[i]->color;
-                        break;
-                    case G_CCMUX_ENVIRONMENT:
-                        color = &rdp.env_color;
-                        break;
-                    case G_CCMUX_PRIMITIVE_ALPHA: {
-                        tmp.r = tmp.g = tmp.b = rdp.prim_color.a;
-                        color = &tmp;
-                        break;
-                    }
-                    case G_CCMUX_ENV_ALPHA: {
-                        tmp.r = tmp.g = tmp.b = rdp.env_color.a;
-                        color = &tmp;
-                        break;
-                    }
-                    case G_CCMUX_PRIM_LOD_FRAC: {
-                        tmp.r = tmp.g = tmp.b = rdp.prim_lod_fraction;
-                        color = &tmp;
-                        break;
-                    }
-                    case G_CCMUX_LOD_FRACTION: {
-                        if (rdp.other_mode_l & G_TL_LOD) {
-                            // "Hack" that works for Bowser - Peach painting
-                            float distance_frac = (v1->w - 3000.0f) / 3000.0f;
-                            if (distance_frac < 0.0f) {
-                                distance_frac = 0.0f;
-                            }
-                            if (distance_frac > 1.0f) {
-                                distance_frac = 1.0f;
-                            }
-                            tmp.r = tmp.g = tmp.b = tmp.a = distance_frac * 255.0f;
-                        } else {
-                            tmp.r = tmp.g = tmp.b = tmp.a = 255.0f;
+    if (state->use_fog && state->packed) {
+        gfx_sp_append_rgba8(vtx, &vtx_len, { vert->color.a, 0, 0, 0 }); // fog factor (not alpha)
+    } else if (state->use_fog) {
+        vtx[vtx_len++] = rdp.fog_color.r / 255.0f;
+        vtx[vtx_len++] = rdp.fog_color.g / 255.0f;
+        vtx[vtx_len++] = rdp.fog_color.b / 255.0f;
+        vtx[vtx_len++] = vert->color.a / 255.0f; // fog factor (not alpha)
+    }
+
+    if (state->use_grayscale && !state->packed) {
+        vtx[vtx_len++] = rdp.grayscale_color.r / 255.0f;
+        vtx[vtx_len++] = rdp.grayscale_color.g / 255.0f;
+        vtx[vtx_len++] = rdp.grayscale_color.b / 255.0f;
+        vtx[vtx_len++] = rdp.grayscale_color.a / 255.0f; // lerp interpolation factor (not alpha)
+    }
+
+    for (int j = 0; j < state->num_inputs; j++) {
+        struct RGBA* color = 0;
+        struct RGBA tmp;
+        struct RGBA input = { 0, 0, 0, 255 };
+        for (int k = 0; k < 1 + (state->use_alpha ? 1 : 0); k++) {
+            switch (state->comb->shader_input_mapping[k][j]) {
+                    // Note: CCMUX constants and ACMUX constants used here have same value, which is why this works
+                    // (except LOD fraction).
+                case G_CCMUX_PRIMITIVE:
+                    color = &rdp.prim_color;
+                    break;
+                case G_CCMUX_SHADE:
+                    color = &vert->color;
+                    break;
+                case G_CCMUX_ENVIRONMENT:
+                    color = &rdp.env_color;
+                    break;
+                case G_CCMUX_PRIMITIVE_ALPHA: {
+                    tmp.r = tmp.g = tmp.b = rdp.prim_color.a;
+                    color = &tmp;
+                    break;
+                }
+                case G_CCMUX_ENV_ALPHA: {
+                    tmp.r = tmp.g = tmp.b = rdp.env_color.a;
+                    color = &tmp;
+                    break;
+                }
+                case G_CCMUX_PRIM_LOD_FRAC: {
+                    tmp.r = tmp.g = tmp.b = rdp.prim_lod_fraction;
+                    color = &tmp;
+                    break;
+                }
+                case G_CCMUX_LOD_FRACTION: {
+                    if (rdp.other_mode_l & G_TL_LOD) {
+                        if (retained.mode == RETAINED_CAPTURE) {
+                            gfx_retained_cancel_capture();
                         }
-                        color = &tmp;
-                        break;
+                        // "Hack" that works for Bowser - Peach painting
+                        float distance_frac = (v1->w - 3000.0f) / 3000.0f;
+                        if (distance_frac < 0.0f) {
+                            distance_frac = 0.0f;
+                        }
+                        if (distance_frac > 1.0f) {
+                            distance_frac = 1.0f;
+                        }
+                        tmp.r = tmp.g = tmp.b = tmp.a = distance_frac * 255.0f;
+                    } else {
+                        tmp.r = tmp.g = tmp.b = tmp.a = 255.0f;
                     }
-                    case G_ACMUX_PRIM_LOD_FRAC:
-                        tmp.a = rdp.prim_lod_fraction;
-                        color = &tmp;
-                        break;
-                    default:
-                        memset(&tmp, 0, sizeof(tmp));
-                        color = &tmp;
-                        break;
+                    color = &tmp;
+                    break;
                 }
+                case G_ACMUX_PRIM_LOD_FRAC:
+                    tmp.a = rdp.prim_lod_fraction;
+                    color = &tmp;
+                    break;
+                default:
+                    memset(&tmp, 0, sizeof(tmp));
+                    color = &tmp;
+                    break;
+            }
+            if (state->packed) {
                 if (k == 0) {
-                    buf_vbo[buf_vbo_len++] = color->r / 255.0f;
-                    buf_vbo[buf_vbo_len++] = color->g / 255.0f;
-                    buf_vbo[buf_vbo_len++] = color->b / 255.0f;
-#ifdef __WIIU__
-                    // padding
-                    if (!use_alpha) {
-                        buf_vbo[buf_vbo_len++] = 1.0f;
+                    input.r = color->r;
+                    input.g = color->g;
+                    input.b = color->b;
+                } else if (!state->use_fog || color != &vert->color) {
+                    input.a = color->a;
+                    if (color == &vert->color && retained.mode == RETAINED_CAPTURE &&
+                        retained.slots[vert - rsp.loaded_vertices].fog) {
+                        // Shade alpha holds the fog factor, which depends on the matrix
+                        gfx_retained_cancel_capture();
                     }
+                }
+                continue;
+            }
+            if (k == 0) {
+                vtx[vtx_len++] = color->r / 255.0f;
+                vtx[vtx_len++] = color->g / 255.0f;
+                vtx[vtx_len++] = color->b / 255.0f;
+#ifdef __WIIU__
+                // padding
+                if (!state->use_alpha) {
+                    vtx[vtx_len++] = 1.0f;
+                }
 #endif
+            } else {
+                if (state->use_fog && color == &vert->color) {
+                    // Shade alpha is 100% for fog
+                    vtx[vtx_len++] = 1.0f;
                 } else {
-                    if (use_fog && color == &v_arr[i]->color) {
-                        // Shade alpha is 100% for fog
-                        buf_vbo[buf_vbo_len++] = 1.0f;
-                    } else {
-                        buf_vbo[buf_vbo_len++] = color->a / 255.0f;
-                    }
+                    vtx[vtx_len++] = color->a / 255.0f;
                 }
             }
         }
-        // struct RGBA *color = &v_arr[i]->color;
-        // buf_vbo[buf_vbo_len++] = color->r / 255.0f;
-        // buf_vbo[buf_vbo_len++] = color->g / 255.0f;
-        // buf_vbo[buf_vbo_len++] = color->b / 255.0f;
-        // buf_vbo[buf_vbo_len++] = color->a / 255.0f;
+        if (state->packed) {
+            gfx_sp_append_rgba8(vtx, &vtx_len, input);
+        }
+    }
+    // struct RGBA *color = &vert->color;
+    // vtx[vtx_len++] = color->r / 255.0f;
+    // vtx[vtx_len++] = color->g / 255.0f;
+    // vtx[vtx_len++] = color->b / 255.0f;
+    // vtx[vtx_len++] = color->a / 255.0f;
+    return vtx_len;
+}
+
+static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bool is_rect) {
+    struct LoadedVertex* v1 = &rsp.loaded_vertices[vtx1_idx];
+    struct LoadedVertex* v2 = &rsp.loaded_vertices[vtx2_idx];
+    struct LoadedVertex* v3 = &rsp.loaded_vertices[vtx3_idx];
+    struct LoadedVertex* v_arr[3] = { v1, v2, v3 };
+
+    // if (rand()%2) return;
+
+    if (retained.mode == RETAINED_REPLAY && retained.cursor + 3 > retained.mesh->num_indices) {
+        gfx_retained_cancel_replay();
+    }
+
+    // While replaying, the vertices are not transformed and the GPU clips and culls the mesh instead. While recording,
+    // rejected triangles still go in the mesh, since they can be visible from elsewhere.
+    bool rejected = retained.mode != RETAINED_REPLAY && gfx_sp_triangle_rejected(v1, v2, v3);
+    if (rejected && retained.mode != RETAINED_CAPTURE) {
+        return;
+    }
+
+    struct DrawState state;
+    gfx_sp_prepare_draw(&state);
+
+    if (retained.mode == RETAINED_REPLAY) {
+        // The corners are in the mesh, and drawn by the next flush
+        retained.cursor += 3;
+        return;
+    }
+
+    struct GfxClipParameters clip_parameters = gfx_rapi->get_clip_parameters();
+    float mesh_vtx[3][32];
+    size_t mesh_vtx_len = 0;
+    int fog_index = state.use_fog ? 4 + 2 * (state.used_textures[0] + state.used_textures[1]) : -1;
+
+    if (buf_vbo_num_tris == 0 && !rejected) {
+        gfx_sp_map_vertex_buffer();
+    }
+
+    for (int i = 0; i < 3; i++) {
+        float vtx[32];
+        size_t vtx_len = gfx_sp_write_vertex(&state, clip_parameters, v_arr[i], v1, is_rect, vtx);
+
+        if (retained.mode == RETAINED_CAPTURE) {
+            memcpy(mesh_vtx[i], vtx, vtx_len * sizeof(float));
+            mesh_vtx_len = vtx_len;
+        }
+        if (!rejected) {
+            gfx_sp_emit_vertex(v_arr[i] - rsp.loaded_vertices, vtx, vtx_len);
+        }
+    }
+
+    if (retained.mode == RETAINED_CAPTURE) {
+        gfx_retained_record_triangle(v_arr, mesh_vtx, mesh_vtx_len, fog_index);
+    }
+    if (rejected) {
+        return;
     }
 
     if (++buf_vbo_num_tris == MAX_BUFFERED) {
@@ -1589,6 +2409,8 @@ static void gfx_calc_and_set_viewport(const Vp_t* viewport) {
 }
 
 static void gfx_sp_movemem(uint8_t index, uint8_t offset, const void* data) {
+    gfx_capture_data(data, index == G_MV_VIEWPORT ? sizeof(Vp_t) : sizeof(Light_t));
+
     switch (index) {
         case G_MV_VIEWPORT:
             gfx_calc_and_set_viewport((const Vp_t*)data);
@@ -1673,7 +2495,9 @@ static void gfx_dp_set_scissor(uint32_t mode, uint32_t ulx, uint32_t uly, uint32
 }
 
 static void gfx_dp_set_texture_image(uint32_t format, uint32_t size, uint32_t width, const void* addr,
-                                     const char* otr_path) {
+                                     const char* otr_path, uint64_t otr_hash) {
+    gfx_capture_data(addr, 0);
+
     rdp.texture_to_load.addr = (const uint8_t*)addr;
     rdp.texture_to_load.siz = size;
     rdp.texture_to_load.width = width;
@@ -1681,6 +2505,7 @@ static void gfx_dp_set_texture_image(uint32_t format, uint32_t size, uint32_t wi
         otr_path = otr_path + 7;
     }
     rdp.texture_to_load.otr_path = otr_path;
+    rdp.texture_to_load.otr_hash = otr_hash;
 }
 
 static void gfx_dp_set_tile(uint8_t fmt, uint32_t siz, uint32_t line, uint32_t tmem, uint8_t tile, uint32_t palette,
@@ -1735,11 +2560,18 @@ static void gfx_dp_load_tlut(uint8_t tile, uint32_t high_index) {
 
     if (rdp.texture_tile[tile].tmem == 256) {
         rdp.palettes[0] = rdp.texture_to_load.addr;
+        rdp.palette_entries[0] = std::min<uint32_t>(high_index + 1, 128);
         if (high_index == 255) {
             rdp.palettes[1] = rdp.texture_to_load.addr + 2 * 128;
+            rdp.palette_entries[1] = 128;
         }
     } else {
         rdp.palettes[1] = rdp.texture_to_load.addr;
+        rdp.palette_entries[1] = high_index + 1;
+    }
+
+    if (frame_capture != nullptr) {
+        gfx_frame_capture_read(frame_capture.get(), rdp.texture_to_load.addr, (high_index + 1) * 2);
     }
 }
 
@@ -1769,12 +2601,16 @@ static void gfx_dp_load_block(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
             break;
     }
     uint32_t size_bytes = (lrs + 1) << word_size_shift;
+    if (frame_capture != nullptr) {
+        gfx_frame_capture_read(frame_capture.get(), rdp.texture_to_load.addr, size_bytes);
+    }
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes = size_bytes;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes = size_bytes;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes = size_bytes;
     // assert(size_bytes <= 4096 && "bug: too big texture");
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr = rdp.texture_to_load.addr;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path = rdp.texture_to_load.otr_path;
+    rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_hash = rdp.texture_to_load.otr_hash;
     rdp.textures_changed[rdp.texture_tile[tile].tmem_index] = true;
 }
 
@@ -1803,6 +2639,13 @@ static void gfx_dp_load_tile(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
     uint32_t line_size_bytes = (((lrs - uls) >> G_TEXTURE_IMAGE_FRAC) + 1) << word_size_shift;
     uint32_t start_offset =
         full_image_line_size_bytes * (ult >> G_TEXTURE_IMAGE_FRAC) + ((uls >> G_TEXTURE_IMAGE_FRAC) << word_size_shift);
+    if (frame_capture != nullptr) {
+        // CI8 imports read each line at the full image stride rather than size_bytes contiguously
+        uint32_t num_lines = ((lrt - ult) >> G_TEXTURE_IMAGE_FRAC) + 1;
+        gfx_frame_capture_read(frame_capture.get(), rdp.texture_to_load.addr,
+                               start_offset + std::max(size_bytes, (num_lines - 1) * full_image_line_size_bytes +
+                                                                       line_size_bytes));
+    }
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes = size_bytes;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes = full_image_line_size_bytes;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes = line_size_bytes;
@@ -1810,6 +2653,7 @@ static void gfx_dp_load_tile(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
     assert(size_bytes <= 4096 && "bug: too big texture");
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr = rdp.texture_to_load.addr + start_offset;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path = rdp.texture_to_load.otr_path;
+    rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_hash = rdp.texture_to_load.otr_hash;
     rdp.texture_tile[tile].uls = uls;
     rdp.texture_tile[tile].ult = ult;
     rdp.texture_tile[tile].lrs = lrs;
@@ -1961,8 +2805,34 @@ static void gfx_draw_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t lr
     rdp.viewport_or_scissor_changed = true;
     rsp.geometry_mode = 0;
 
-    gfx_sp_tri1(MAX_VERTICES + 0, MAX_VERTICES + 1, MAX_VERTICES + 3, true);
-    gfx_sp_tri1(MAX_VERTICES + 1, MAX_VERTICES + 2, MAX_VERTICES + 3, true);
+    // Both triangles are drawn with the same state, so it is worked out once and each corner is written once, then
+    // the triangles go straight in the batch. Rectangles are never clipped or culled, and are not part of retained
+    // meshes since they end any recording or replay.
+    struct DrawState state;
+    gfx_sp_prepare_draw(&state);
+    if (buf_vbo_num_tris + 2 > MAX_BUFFERED) {
+        gfx_flush();
+    }
+    if (buf_vbo_num_tris == 0) {
+        gfx_sp_map_vertex_buffer();
+    }
+
+    struct GfxClipParameters clip_parameters = gfx_rapi->get_clip_parameters();
+    float corners[4][32];
+    size_t vtx_len = 0;
+    for (int i = 0; i < 4; i++) {
+        vtx_len = gfx_sp_write_vertex(&state, clip_parameters, &rsp.loaded_vertices[MAX_VERTICES + i], ul, true,
+                                      corners[i]);
+    }
+    static const uint8_t corner_order[6] = { 0, 1, 3, 1, 2, 3 };
+    for (uint8_t corner : corner_order) {
+        gfx_sp_emit_vertex(MAX_VERTICES + corner, corners[corner], vtx_len);
+    }
+    render_state_stats.rectangles++;
+    buf_vbo_num_tris += 2;
+    if (buf_vbo_num_tris == MAX_BUFFERED) {
+        gfx_flush();
+    }
 
     rsp.geometry_mode = geometry_mode_saved;
     rdp.viewport = viewport_saved;
@@ -2076,10 +2946,12 @@ static void gfx_dp_fill_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t
 }
 
 static void gfx_dp_set_z_image(void* z_buf_address) {
+    gfx_capture_data(z_buf_address, 0);
     rdp.z_buf_address = z_buf_address;
 }
 
 static void gfx_dp_set_color_image(uint32_t format, uint32_t size, uint32_t width, void* address) {
+    gfx_capture_data(address, 0);
     rdp.color_image_address = address;
 }
 
@@ -2097,6 +2969,11 @@ static void gfx_dp_set_other_mode(uint32_t h, uint32_t l) {
 }
 
 static void gfx_s2dex_bg_copy(const uObjBg* bg) {
+    if (frame_capture != nullptr) {
+        gfx_frame_capture_read(frame_capture.get(), bg, sizeof(uObjBg));
+        gfx_frame_capture_data_pointer(frame_capture.get(), &bg->b.imagePtr, bg->b.imagePtr);
+    }
+
     /*
     bg->b.imageX = 0;
     bg->b.imageW = width * 4;
@@ -2112,7 +2989,7 @@ static void gfx_s2dex_bg_copy(const uObjBg* bg) {
     bg->b.imageFlip = 0;
     */
     SUPPORT_CHECK(bg->b.imageSiz == G_IM_SIZ_16b);
-    gfx_dp_set_texture_image(G_IM_FMT_RGBA, G_IM_SIZ_16b, 0, bg->b.imagePtr, nullptr);
+    gfx_dp_set_texture_image(G_IM_FMT_RGBA, G_IM_SIZ_16b, 0, bg->b.imagePtr, nullptr, 0);
     gfx_dp_set_tile(G_IM_FMT_RGBA, G_IM_SIZ_16b, 0, 0, G_TX_LOADTILE, 0, 0, 0, 0, 0, 0, 0);
     gfx_dp_load_block(G_TX_LOADTILE, 0, 0, (bg->b.imageW * bg->b.imageH >> 4) - 1, 0);
     gfx_dp_set_tile(bg->b.imageFmt, G_IM_SIZ_16b, bg->b.imageW >> 4, 0, G_TX_RENDERTILE, bg->b.imagePal, 0, 0, 0, 0, 0,
@@ -2141,6 +3018,23 @@ static inline void* seg_addr(uintptr_t w1) {
     }
 }
 
+// G_SETTIMG with an address that is either segmented or points at the name of an image resource
+static void gfx_dp_set_texture_image_address(uint32_t format, uint32_t size, uint32_t width, uintptr_t w1) {
+    uintptr_t i = (uintptr_t)seg_addr(w1);
+
+    char* imgData = (char*)i;
+    uint64_t imgHash = 0;
+
+    if ((i & 1) != 1) {
+        if (gfx_check_image_signature(imgData) == 1) {
+            i = (uintptr_t)GetResourceDataByName(imgData, false);
+            imgHash = GetResourceCrcByName(imgData + 7);
+        }
+    }
+
+    gfx_dp_set_texture_image(format, size, width, (void*)i, imgData, imgHash);
+}
+
 #define C0(pos, width) ((cmd->words.w0 >> (pos)) & ((1U << width) - 1))
 #define C1(pos, width) ((cmd->words.w1 >> (pos)) & ((1U << width) - 1))
 
@@ -2148,6 +3042,794 @@ unsigned int dListBP;
 int matrixBP;
 uintptr_t clearMtx;
 
+static void gfx_run_dl(Gfx* cmd);
+static void gfx_run_display_list(Ship::DisplayList* dl);
+
+// Whether a replay can reproduce the command. The others change the matrices or lights, make vertices from something
+// other than a resource, draw rectangles or switch framebuffers.
+static bool gfx_retained_command_supported(const Gfx* cmd) {
+    switch (cmd->words.w0 >> 24) {
+        case G_NOOP:
+        case G_MARKER:
+        case (uint8_t)G_TEXTURE:
+        case G_VTX_OTR:
+        case (uint8_t)G_ENDDL:
+#ifdef F3DEX_GBI_2
+        case G_GEOMETRYMODE:
+        case G_QUAD:
+#else
+        case (uint8_t)G_SETGEOMETRYMODE:
+        case (uint8_t)G_CLEARGEOMETRYMODE:
+#endif
+        case (uint8_t)G_TRI1:
+#if defined(F3DEX_GBI) || defined(F3DLP_GBI)
+        case (uint8_t)G_TRI2:
+#endif
+        case (uint8_t)G_SETOTHERMODE_L:
+        case (uint8_t)G_SETOTHERMODE_H:
+        case G_RDPSETOTHERMODE:
+        case G_SETTIMG:
+        case G_SETTIMG_OTR:
+        case G_SETGRAYSCALE:
+        case G_LOADBLOCK:
+        case G_LOADTILE:
+        case G_SETTILE:
+        case G_SETTILESIZE:
+        case G_LOADTLUT:
+        case G_SETENVCOLOR:
+        case G_SETPRIMCOLOR:
+        case G_SETFOGCOLOR:
+        case G_SETFILLCOLOR:
+        case G_SETINTENSITY:
+        case G_SETCOMBINE:
+        case G_SETSCISSOR:
+        case G_SETPRIMDEPTH:
+        case G_RDPPIPESYNC:
+        case G_RDPTILESYNC:
+        case G_RDPLOADSYNC:
+        case G_RDPFULLSYNC:
+            return true;
+        case G_DL_OTR:
+            return C0(16, 1) == 0;
+        default:
+            return false;
+    }
+}
+
+// Records the command about to run, or compares it with the recording
+static void gfx_retained_command(const Gfx* cmd) {
+    uint32_t opcode = cmd->words.w0 >> 24;
+    size_t len = opcode == G_MARKER || opcode == G_VTX_OTR || opcode == G_SETTIMG_OTR || opcode == G_DL_OTR ? 2 : 1;
+    vector<Gfx>& commands = retained.mesh->commands;
+
+    if (retained.mode == RETAINED_CAPTURE) {
+        if (gfx_retained_command_supported(cmd)) {
+            commands.insert(commands.end(), cmd, cmd + len);
+        } else {
+            gfx_retained_cancel_capture();
+        }
+    } else if (retained.command_index + len <= commands.size() &&
+               memcmp(&commands[retained.command_index], cmd, len * sizeof(Gfx)) == 0) {
+        retained.command_index += len;
+    } else {
+        gfx_retained_cancel_replay();
+    }
+}
+
+// Hashes the state a recording depends on when the display list starts: what the vertices written for its triangles
+// are computed from, apart from the vertices themselves
+static uint64_t gfx_retained_key(uint64_t crc) {
+    uint64_t hash = gfx_hash_bytes((const uint8_t*)rdp.texture_tile, sizeof(rdp.texture_tile), crc);
+    for (int i = 0; i < 2; i++) {
+        hash = gfx_hash_bytes((const uint8_t*)&rdp.loaded_texture[i].size_bytes, sizeof(uint32_t), hash);
+    }
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.first_tile_index, sizeof(rdp.first_tile_index), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.other_mode_l, sizeof(rdp.other_mode_l), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.other_mode_h, sizeof(rdp.other_mode_h), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.combine_mode, sizeof(rdp.combine_mode), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.grayscale, sizeof(rdp.grayscale), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.prim_lod_fraction, sizeof(rdp.prim_lod_fraction), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.env_color, sizeof(rdp.env_color), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rdp.prim_color, sizeof(rdp.prim_color), hash);
+    hash = gfx_hash_bytes((const uint8_t*)&rsp.geometry_mode, sizeof(rsp.geometry_mode), hash);
+    return gfx_hash_bytes((const uint8_t*)&rsp.texture_scaling_factor, sizeof(rsp.texture_scaling_factor), hash);
+}
+
+static void gfx_retained_capture(Gfx* gfx) {
+    RetainedMesh* mesh = retained.mesh;
+    mesh->segments.clear();
+    mesh->commands.clear();
+    mesh->loads.clear();
+    retained.vbo.clear();
+    retained.ibo.clear();
+    for (struct RetainedVertexSlot& slot : retained.slots) {
+        slot.vertex = nullptr;
+    }
+
+    retained.mode = RETAINED_CAPTURE;
+    gfx_run_dl(gfx);
+    if (retained.mode != RETAINED_CAPTURE) {
+        mesh->segments = {};
+        mesh->commands = {};
+        mesh->loads = {};
+        return;
+    }
+    retained.mode = RETAINED_NONE;
+
+    if (retained.ibo.empty()) {
+        // Nothing to draw from a mesh
+        mesh->unretainable = true;
+        return;
+    }
+    mesh->mesh_id =
+        gfx_rapi->create_mesh(retained.vbo.data(), retained.vbo.size(), retained.ibo.data(), retained.ibo.size());
+    mesh->num_indices = retained.ibo.size();
+    mesh->size_bytes = (retained.vbo.size() + retained.ibo.size()) * sizeof(uint32_t);
+    retained.mesh_bytes += mesh->size_bytes;
+    retained.num_meshes++;
+    retained_mesh_stats.captures++;
+}
+
+static void gfx_retained_replay(Gfx* gfx) {
+    RetainedMesh* mesh = retained.mesh;
+    gfx_flush();
+
+    // The transform gfx_sp_vertex applies, as a matrix
+    struct GfxClipParameters clip_parameters = gfx_rapi->get_clip_parameters();
+    for (int i = 0; i < 4; i++) {
+        float(*m)[4] = rsp.MP_matrix;
+        retained.transform.matrix[i][0] = gfx_adjust_x_for_aspect_ratio(m[i][0]);
+        retained.transform.matrix[i][1] = clip_parameters.invert_y ? -m[i][1] : m[i][1];
+        retained.transform.matrix[i][2] = clip_parameters.z_is_from_0_to_1 ? (m[i][2] + m[i][3]) / 2.0f : m[i][2];
+        retained.transform.matrix[i][3] = m[i][3];
+    }
+    retained.transform.fog_mul = rsp.fog_mul;
+    retained.transform.fog_offset = rsp.fog_offset;
+    retained.cursor = 0;
+    retained.drawn = 0;
+    retained.segment_index = 0;
+    retained.pending_loads.clear();
+
+    retained.mode = RETAINED_REPLAY;
+    gfx_run_dl(gfx);
+    if (retained.mode != RETAINED_REPLAY) {
+        return;
+    }
+    gfx_flush();
+    gfx_retained_load_pending_vertices();
+    retained.mode = RETAINED_NONE;
+    mesh->failures = 0;
+    retained_mesh_stats.replays++;
+}
+
+// Runs a DisplayList resource, from its retained mesh if it has one for the current state
+static void gfx_retained_run_dl(Ship::DisplayList* dl, uint64_t crc) {
+    if (!retained.enabled || retained.mode != RETAINED_NONE || frame_capture != nullptr ||
+        gfx_rapi->draw_mesh == nullptr || gfx_rapi->set_draw_constants == nullptr) {
+        gfx_run_display_list(dl);
+        return;
+    }
+
+    RetainedMesh* mesh = &retained.meshes[gfx_retained_key(crc)];
+    if (mesh->last_frame != retained.frame || mesh->frames_seen == 0) {
+        mesh->last_frame = retained.frame;
+        mesh->frames_seen++;
+    }
+    if (mesh->unretainable || (mesh->mesh_id == 0 && mesh->frames_seen < 2)) {
+        gfx_run_display_list(dl);
+        return;
+    }
+
+    retained.mesh = mesh;
+    retained.command_index = 0;
+    retained.load_index = 0;
+    if (mesh->mesh_id == 0) {
+        gfx_retained_capture(dl->Instructions.data());
+    } else {
+        gfx_retained_replay(dl->Instructions.data());
+    }
+}
+
+// Deletes the meshes of display lists that have not run for a while
+static void gfx_retained_end_frame(void) {
+    retained.frame++;
+    if (retained.frame % RETAINED_MESH_MAX_IDLE_FRAMES == 0) {
+        for (auto it = retained.meshes.begin(); it != retained.meshes.end();) {
+            if (retained.frame - it->second.last_frame <= RETAINED_MESH_MAX_IDLE_FRAMES) {
+                ++it;
+                continue;
+            }
+            if (it->second.mesh_id != 0) {
+                gfx_rapi->delete_mesh(it->second.mesh_id);
+                retained.mesh_bytes -= it->second.size_bytes;
+                retained.num_meshes--;
+            }
+            it = retained.meshes.erase(it);
+        }
+    }
+
+    retained_mesh_stats.meshes = retained.num_meshes;
+    retained_mesh_stats.mesh_bytes = retained.mesh_bytes;
+    retained_mesh_stats_last_frame = retained_mesh_stats;
+    retained_mesh_stats = {};
+}
+
+// Loads the resource with the CRC, which the compiled display list then keeps alive
+static Ship::Resource* gfx_compiled_dl_dependency(GfxCompiledDisplayList* compiled, uint64_t crc) {
+    std::shared_ptr<Ship::Resource> res = LoadResource(crc, false);
+    if (res == nullptr || res->GetPointer() == nullptr) {
+        return nullptr;
+    }
+    if (std::find(compiled->dependencies.begin(), compiled->dependencies.end(), res) == compiled->dependencies.end()) {
+        compiled->dependencies.push_back(res);
+    }
+    return res.get();
+}
+
+static Ship::DisplayList* gfx_get_display_list(uint64_t crc) {
+    Ship::Resource* res = Ship::Window::GetInstance()->GetResourceManager()->GetResidentResource(crc);
+    if (res != nullptr && res->Type == Ship::ResourceType::DisplayList &&
+        static_cast<Ship::DisplayList*>(res)->HasDirtyLinks()) {
+        // Points into resources that are about to be reloaded, so it is loaded and linked again too
+        res->IsDirty = true;
+        res = nullptr;
+    }
+    if (res == nullptr) {
+        res = LoadResource(crc, false).get();
+    }
+    if (res == nullptr || res->Type != Ship::ResourceType::DisplayList) {
+        return nullptr;
+    }
+    return static_cast<Ship::DisplayList*>(res);
+}
+
+// Decodes the source words into commands. Fails if the display list has a command only gfx_run_dl can run, or does not
+// end. Display lists it calls are looked up by CRC when called, so they are compiled and reloaded on their own.
+static bool gfx_compile_commands(GfxCompiledDisplayList* compiled, const vector<Gfx>& source) {
+#ifdef F3DEX_GBI_2
+    vector<CompiledCommand>& commands = compiled->commands;
+    // Index of the last setting of each kind that nothing has read yet
+    size_t unread[COMPILED_OP_COUNT];
+    std::fill(std::begin(unread), std::end(unread), SIZE_MAX);
+
+    for (size_t i = 0; i < source.size(); i++) {
+        const Gfx* cmd = &source[i];
+        uint32_t opcode = cmd->words.w0 >> 24;
+        uint64_t hash = 0;
+        if (opcode == G_MARKER || opcode == G_MTX_OTR || opcode == G_VTX_OTR || opcode == G_SETTIMG_OTR ||
+            opcode == G_BRANCH_Z_OTR || (opcode == G_DL_OTR && C0(16, 1) == 0)) {
+            // The second word holds a CRC
+            if (++i == source.size()) {
+                return false;
+            }
+            hash = ((uint64_t)source[i].words.w0 << 32) + source[i].words.w1;
+        }
+
+        CompiledCommand c = {};
+        switch (opcode) {
+            case G_NOOP:
+            case G_SPNOOP:
+            case G_CULLDL:
+            case G_SETPRIMDEPTH:
+            case G_SETBLENDCOLOR:
+            case G_SETCONVERT:
+            case G_SETKEYR:
+            case G_SETKEYGB:
+            case G_RDPPIPESYNC:
+            case G_RDPTILESYNC:
+            case G_RDPLOADSYNC:
+            case G_RDPFULLSYNC:
+                continue;
+            case G_MARKER:
+                c.op = COMPILED_MARKER;
+                break;
+            case G_LOAD_UCODE:
+                c.op = COMPILED_LOAD_UCODE;
+                break;
+            case G_MTX:
+                c.op = COMPILED_MTX;
+                c.b[0] = C0(0, 8) ^ G_MTX_PUSH;
+                c.ptr = cmd->words.w1;
+                break;
+            case G_MTX_OTR: {
+                Ship::Resource* res = gfx_compiled_dl_dependency(compiled, hash);
+                if (res == nullptr) {
+                    continue;
+                }
+                c.op = COMPILED_MTX_RESOLVED;
+                c.b[0] = C0(0, 8) ^ G_MTX_PUSH;
+                c.ptr = (uintptr_t)res->GetPointer();
+                break;
+            }
+            case (uint8_t)G_POPMTX:
+                c.op = COMPILED_POPMTX;
+                c.w[0] = cmd->words.w1 / 64;
+                break;
+            case G_MOVEMEM:
+                c.op = COMPILED_MOVEMEM;
+                c.b[0] = C0(0, 8);
+                c.h[0] = C0(8, 8) * 8;
+                c.ptr = cmd->words.w1;
+                break;
+            case (uint8_t)G_MOVEWORD:
+                c.op = COMPILED_MOVEWORD;
+                c.b[0] = C0(16, 8);
+                c.h[0] = C0(0, 16);
+                c.ptr = cmd->words.w1;
+                break;
+            case (uint8_t)G_TEXTURE:
+                c.op = COMPILED_TEXTURE;
+                c.b[0] = C0(11, 3);
+                c.b[1] = C0(8, 3);
+                c.b[2] = C0(1, 7);
+                c.h[0] = C1(16, 16);
+                c.h[1] = C1(0, 16);
+                break;
+            case G_VTX:
+                c.op = COMPILED_VTX;
+                c.w[0] = C0(12, 8);
+                c.w[1] = C0(1, 7) - C0(12, 8);
+                c.ptr = cmd->words.w1;
+                break;
+            case G_VTX_OTR:
+                c.op = COMPILED_VTX_RESOLVED;
+                c.w[0] = C0(12, 8);
+                c.w[1] = C0(1, 7) - C0(12, 8);
+                // Larger than any offset, so a pointer gfx_run_dl patched in
+                if (cmd->words.w1 > 0xFFFFF) {
+                    c.ptr = cmd->words.w1;
+                } else {
+                    Ship::Resource* res = gfx_compiled_dl_dependency(compiled, hash);
+                    if (res == nullptr) {
+                        continue;
+                    }
+                    c.ptr = (uintptr_t)res->GetPointer() + cmd->words.w1;
+                }
+                break;
+            case G_MODIFYVTX:
+                c.op = COMPILED_MODIFYVTX;
+                c.b[0] = C0(16, 8);
+                c.h[0] = C0(1, 15);
+                c.w[0] = cmd->words.w1;
+                break;
+            case G_DL:
+                c.op = C0(16, 1) == 0 ? COMPILED_CALL : COMPILED_JUMP;
+                c.ptr = cmd->words.w1;
+                break;
+            case G_DL_OTR:
+                if (C0(16, 1) == 0) {
+                    c.op = COMPILED_CALL_RESOLVED;
+                    c.w[0] = hash >> 32;
+                    c.w[1] = (uint32_t)hash;
+                } else {
+                    c.op = COMPILED_JUMP;
+                    c.ptr = cmd->words.w1;
+                }
+                break;
+            case G_BRANCH_Z_OTR:
+                c.op = COMPILED_BRANCH_Z;
+                c.b[0] = cmd->words.w0 & 0x00000FFF;
+                c.w[0] = hash >> 32;
+                c.w[1] = (uint32_t)hash;
+                c.ptr = (uint32_t)cmd->words.w1;
+                break;
+            case (uint8_t)G_ENDDL:
+                c.op = COMPILED_END;
+                break;
+            case G_GEOMETRYMODE:
+                c.op = COMPILED_GEOMETRYMODE;
+                c.w[0] = ~C0(0, 24);
+                c.w[1] = cmd->words.w1;
+                break;
+            case (uint8_t)G_TRI1:
+                c.op = COMPILED_TRI1;
+                c.b[0] = C0(16, 8) / 2;
+                c.b[1] = C0(8, 8) / 2;
+                c.b[2] = C0(0, 8) / 2;
+                break;
+            case G_QUAD:
+            case (uint8_t)G_TRI2:
+                c.op = COMPILED_TRI2;
+                c.b[0] = C0(16, 8) / 2;
+                c.b[1] = C0(8, 8) / 2;
+                c.b[2] = C0(0, 8) / 2;
+                c.b[3] = C1(16, 8) / 2;
+                c.b[4] = C1(8, 8) / 2;
+                c.b[5] = C1(0, 8) / 2;
+                break;
+            case (uint8_t)G_SETOTHERMODE_L:
+                c.op = COMPILED_SETOTHERMODE;
+                c.w[0] = 31 - C0(8, 8) - C0(0, 8);
+                c.w[1] = C0(0, 8) + 1;
+                c.ptr = cmd->words.w1;
+                break;
+            case (uint8_t)G_SETOTHERMODE_H:
+                c.op = COMPILED_SETOTHERMODE;
+                c.b[0] = true; // the word is the high half of the mode
+                c.w[0] = 63 - C0(8, 8) - C0(0, 8);
+                c.w[1] = C0(0, 8) + 1;
+                c.ptr = cmd->words.w1;
+                break;
+            case G_RDPSETOTHERMODE:
+                c.op = COMPILED_RDPSETOTHERMODE;
+                c.w[0] = C0(0, 24);
+                c.w[1] = cmd->words.w1;
+                break;
+            case G_SETTIMG:
+                c.op = COMPILED_SETTIMG;
+                c.b[0] = C0(21, 3);
+                c.b[1] = C0(19, 2);
+                c.h[0] = C0(0, 10);
+                c.ptr = cmd->words.w1;
+                break;
+            case G_SETTIMG_OTR:
+                c.op = COMPILED_SETTIMG_RESOLVED;
+                c.b[0] = C0(21, 3);
+                c.b[1] = C0(19, 2);
+                c.h[0] = C0(0, 10);
+                // Set when gfx_run_dl patched in the texture
+                c.ptr = cmd->words.w1;
+                if (c.ptr == 0) {
+                    Ship::Resource* res = gfx_compiled_dl_dependency(compiled, hash);
+                    if (res == nullptr) {
+                        continue;
+                    }
+                    c.ptr = (uintptr_t)res->GetPointer();
+                }
+                c.w[0] = compiled->texture_images.size();
+                compiled->texture_images.push_back({ GetResourceNameByCrc(hash), hash });
+                break;
+            case G_SETGRAYSCALE:
+                c.op = COMPILED_SETGRAYSCALE;
+                c.b[0] = cmd->words.w1 != 0;
+                break;
+            case G_LOADBLOCK:
+            case G_LOADTILE:
+            case G_SETTILESIZE:
+                c.op = opcode == G_LOADBLOCK  ? COMPILED_LOADBLOCK
+                       : opcode == G_LOADTILE ? COMPILED_LOADTILE
+                                              : COMPILED_SETTILESIZE;
+                c.b[0] = C1(24, 3);
+                c.h[0] = C0(12, 12);
+                c.h[1] = C0(0, 12);
+                c.h[2] = C1(12, 12);
+                c.h[3] = C1(0, 12);
+                break;
+            case G_SETTILE:
+                c.op = COMPILED_SETTILE;
+                c.b[0] = C0(21, 3);
+                c.b[1] = C0(19, 2);
+                c.b[2] = C1(24, 3);
+                c.b[3] = C1(20, 4);
+                c.b[4] = C1(18, 2);
+                c.b[5] = C1(14, 4);
+                c.b[6] = C1(10, 4);
+                c.h[0] = C0(9, 9);
+                c.h[1] = C0(0, 9);
+                c.h[2] = C1(8, 2);
+                c.h[3] = C1(4, 4);
+                c.w[0] = C1(0, 4);
+                break;
+            case G_LOADTLUT:
+                c.op = COMPILED_LOADTLUT;
+                c.b[0] = C1(24, 3);
+                c.h[0] = C1(14, 10);
+                break;
+            case G_SETENVCOLOR:
+            case G_SETFOGCOLOR:
+            case G_SETINTENSITY:
+                c.op = opcode == G_SETENVCOLOR   ? COMPILED_SETENVCOLOR
+                       : opcode == G_SETFOGCOLOR ? COMPILED_SETFOGCOLOR
+                                                 : COMPILED_SETINTENSITY;
+                c.b[0] = C1(24, 8);
+                c.b[1] = C1(16, 8);
+                c.b[2] = C1(8, 8);
+                c.b[3] = C1(0, 8);
+                break;
+            case G_SETPRIMCOLOR:
+                c.op = COMPILED_SETPRIMCOLOR;
+                c.b[0] = C0(8, 8);
+                c.b[1] = C0(0, 8);
+                c.b[2] = C1(24, 8);
+                c.b[3] = C1(16, 8);
+                c.b[4] = C1(8, 8);
+                c.b[5] = C1(0, 8);
+                break;
+            case G_SETFILLCOLOR:
+                c.op = COMPILED_SETFILLCOLOR;
+                c.w[0] = cmd->words.w1;
+                break;
+            case G_SETCOMBINE:
+                c.op = COMPILED_SETCOMBINE;
+                c.h[0] = color_comb(C0(20, 4), C1(28, 4), C0(15, 5), C1(15, 3));
+                c.h[1] = alpha_comb(C0(12, 3), C1(12, 3), C0(9, 3), C1(9, 3));
+                c.h[2] = color_comb(C0(5, 4), C1(24, 4), C0(0, 5), C1(6, 3));
+                c.h[3] = alpha_comb(C1(21, 3), C1(3, 3), C1(18, 3), C1(0, 3));
+                break;
+            case G_SETSCISSOR:
+                c.op = COMPILED_SETSCISSOR;
+                c.b[0] = C1(24, 2);
+                c.h[0] = C0(12, 12);
+                c.h[1] = C0(0, 12);
+                c.h[2] = C1(12, 12);
+                c.h[3] = C1(0, 12);
+                break;
+            default:
+                // Rectangles, framebuffers and anything else gfx_run_dl handles on its own
+                return false;
+        }
+
+        if (c.op >= COMPILED_SETGRAYSCALE) {
+            if (unread[c.op] != SIZE_MAX) {
+                commands[unread[c.op]].op = COMPILED_NOP;
+            }
+            unread[c.op] = commands.size();
+        } else {
+            std::fill(std::begin(unread), std::end(unread), SIZE_MAX);
+        }
+        commands.push_back(c);
+
+        if (c.op == COMPILED_END || c.op == COMPILED_JUMP) {
+            commands.erase(std::remove_if(commands.begin(), commands.end(),
+                                          [](const CompiledCommand& command) { return command.op == COMPILED_NOP; }),
+                           commands.end());
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+static std::shared_ptr<GfxCompiledDisplayList> gfx_compile_display_list(const Ship::DisplayList* dl) {
+    auto compiled = std::make_shared<GfxCompiledDisplayList>();
+    compiled->revision = dl->Revision;
+    compiled->compiled = gfx_compile_commands(compiled.get(), dl->Instructions);
+    if (!compiled->compiled) {
+        compiled->commands = {};
+        compiled->texture_images = {};
+        compiled->dependencies = {};
+    }
+    compiled_dl_stats.compiles++;
+    return compiled;
+}
+
+// Whether the display list was compiled from its current words and resources
+static bool gfx_compiled_dl_current(const GfxCompiledDisplayList* compiled, const Ship::DisplayList* dl) {
+    if (compiled->revision != dl->Revision) {
+        return false;
+    }
+    for (const std::shared_ptr<Ship::Resource>& res : compiled->dependencies) {
+        if (res->IsDirty) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void gfx_run_compiled_dl(const GfxCompiledDisplayList* compiled) {
+    for (const CompiledCommand* c = compiled->commands.data();; c++) {
+        switch (c->op) {
+            case COMPILED_END:
+                markerOn = false;
+                return;
+            case COMPILED_MARKER:
+                markerOn = true;
+                break;
+            case COMPILED_LOAD_UCODE:
+                rsp.fog_mul = 0;
+                rsp.fog_offset = 0;
+                break;
+            case COMPILED_MTX: {
+                uintptr_t mtxAddr = c->ptr;
+                if (mtxAddr == SEG_ADDR(0, 0x12DB20) || mtxAddr == SEG_ADDR(0, 0x12DB40) ||
+                    mtxAddr == SEG_ADDR(0, 0xFBC20)) {
+                    mtxAddr = clearMtx;
+                }
+                gfx_sp_matrix(c->b[0], (const int32_t*)seg_addr(mtxAddr));
+                break;
+            }
+            case COMPILED_MTX_RESOLVED:
+                gfx_sp_matrix(c->b[0], (const int32_t*)c->ptr);
+                break;
+            case COMPILED_POPMTX:
+                gfx_sp_pop_matrix(c->w[0]);
+                break;
+            case COMPILED_MOVEMEM:
+                gfx_sp_movemem(c->b[0], c->h[0], seg_addr(c->ptr));
+                break;
+            case COMPILED_MOVEWORD:
+                gfx_sp_moveword(c->b[0], c->h[0], c->ptr);
+                break;
+            case COMPILED_TEXTURE:
+                gfx_sp_texture(c->h[0], c->h[1], c->b[0], c->b[1], c->b[2]);
+                break;
+            case COMPILED_VTX:
+                gfx_sp_vertex(c->w[0], c->w[1], (const Vtx*)seg_addr(c->ptr));
+                break;
+            case COMPILED_VTX_RESOLVED:
+                gfx_sp_vertex(c->w[0], c->w[1], (const Vtx*)c->ptr);
+                break;
+            case COMPILED_MODIFYVTX:
+                gfx_sp_modify_vertex(c->h[0], c->b[0], c->w[0]);
+                break;
+            case COMPILED_CALL:
+                gfx_run_dl((Gfx*)seg_addr(c->ptr));
+                break;
+            case COMPILED_CALL_RESOLVED: {
+                uint64_t crc = ((uint64_t)c->w[0] << 32) | c->w[1];
+                Ship::DisplayList* dl = gfx_get_display_list(crc);
+                if (dl != nullptr) {
+                    gfx_retained_run_dl(dl, crc);
+                }
+                break;
+            }
+            case COMPILED_JUMP:
+                gfx_run_dl((Gfx*)seg_addr(c->ptr));
+                return;
+            case COMPILED_BRANCH_Z:
+                if (rsp.loaded_vertices[c->b[0]].z <= (uint32_t)c->ptr) {
+                    Ship::DisplayList* dl = gfx_get_display_list(((uint64_t)c->w[0] << 32) | c->w[1]);
+                    if (dl != nullptr) {
+                        gfx_run_display_list(dl);
+                        return;
+                    }
+                }
+                break;
+            case COMPILED_GEOMETRYMODE:
+                gfx_sp_geometry_mode(c->w[0], c->w[1]);
+                break;
+            case COMPILED_TRI1:
+                gfx_sp_tri1(c->b[0], c->b[1], c->b[2], false);
+                break;
+            case COMPILED_TRI2:
+                gfx_sp_tri1(c->b[0], c->b[1], c->b[2], false);
+                gfx_sp_tri1(c->b[3], c->b[4], c->b[5], false);
+                break;
+            case COMPILED_SETOTHERMODE:
+                gfx_sp_set_other_mode(c->w[0], c->w[1], c->b[0] ? (uint64_t)c->ptr << 32 : (uint64_t)c->ptr);
+                break;
+            case COMPILED_RDPSETOTHERMODE:
+                gfx_dp_set_other_mode(c->w[0], c->w[1]);
+                break;
+            case COMPILED_SETTIMG:
+                gfx_dp_set_texture_image_address(c->b[0], c->b[1], c->h[0], c->ptr);
+                break;
+            case COMPILED_SETTIMG_RESOLVED: {
+                const CompiledTextureImage* image = &compiled->texture_images[c->w[0]];
+                gfx_dp_set_texture_image(c->b[0], c->b[1], c->h[0], (const void*)c->ptr, image->name, image->hash);
+                break;
+            }
+            case COMPILED_LOADBLOCK:
+                gfx_dp_load_block(c->b[0], c->h[0], c->h[1], c->h[2], c->h[3]);
+                break;
+            case COMPILED_LOADTILE:
+                gfx_dp_load_tile(c->b[0], c->h[0], c->h[1], c->h[2], c->h[3]);
+                break;
+            case COMPILED_SETTILE:
+                gfx_dp_set_tile(c->b[0], c->b[1], c->h[0], c->h[1], c->b[2], c->b[3], c->b[4], c->b[5], c->b[6],
+                                c->h[2], c->h[3], c->w[0]);
+                break;
+            case COMPILED_SETTILESIZE:
+                gfx_dp_set_tile_size(c->b[0], c->h[0], c->h[1], c->h[2], c->h[3]);
+                break;
+            case COMPILED_LOADTLUT:
+                gfx_dp_load_tlut(c->b[0], c->h[0]);
+                break;
+            case COMPILED_SETSCISSOR:
+                gfx_dp_set_scissor(c->b[0], c->h[0], c->h[1], c->h[2], c->h[3]);
+                break;
+            case COMPILED_SETGRAYSCALE:
+                rdp.grayscale = c->b[0];
+                break;
+            case COMPILED_SETENVCOLOR:
+                gfx_dp_set_env_color(c->b[0], c->b[1], c->b[2], c->b[3]);
+                break;
+            case COMPILED_SETPRIMCOLOR:
+                gfx_dp_set_prim_color(c->b[0], c->b[1], c->b[2], c->b[3], c->b[4], c->b[5]);
+                break;
+            case COMPILED_SETFOGCOLOR:
+                gfx_dp_set_fog_color(c->b[0], c->b[1], c->b[2], c->b[3]);
+                break;
+            case COMPILED_SETFILLCOLOR:
+                gfx_dp_set_fill_color(c->w[0]);
+                break;
+            case COMPILED_SETINTENSITY:
+                gfx_dp_set_grayscale_color(c->b[0], c->b[1], c->b[2], c->b[3]);
+                break;
+            case COMPILED_SETCOMBINE:
+                gfx_dp_set_combine_mode(c->h[0], c->h[1], c->h[2], c->h[3]);
+                break;
+        }
+    }
+}
+
+// Runs a DisplayList resource from its compiled commands, compiling it first if it has changed. Frame and retained mesh
+// recordings follow the source words, so those run through gfx_run_dl.
+static void gfx_run_display_list(Ship::DisplayList* dl) {
+    if (!compiled_display_lists_enabled || frame_capture != nullptr || retained.mode != RETAINED_NONE ||
+        dl->IsDirty) {
+        gfx_run_dl(dl->Instructions.data());
+        return;
+    }
+
+    // Held while running, in case a call compiles this display list again
+    std::shared_ptr<GfxCompiledDisplayList> compiled = dl->Compiled;
+    if (compiled == nullptr || !gfx_compiled_dl_current(compiled.get(), dl)) {
+        compiled = gfx_compile_display_list(dl);
+        dl->Compiled = compiled;
+    }
+
+    if (compiled->compiled) {
+        compiled_dl_stats.runs++;
+        gfx_run_compiled_dl(compiled.get());
+    } else {
+        compiled_dl_stats.interpreted++;
+        gfx_run_dl(dl->Instructions.data());
+    }
+}
+
+// Appends the command gfx_run_dl just executed, the words from start to end, to the frame capture. Calls and branches
+// are followed rather than recorded, and addresses are replaced with the data they resolved to, so the capture is one
+// flat display list that replays without segments or resources.
+static void gfx_capture_command(uint32_t opcode, const Gfx* start, const Gfx* end) {
+    const void* ptr = frame_capture_pointer;
+    frame_capture_pointer = nullptr;
+
+    switch (opcode) {
+        case G_DL:
+        case G_DL_OTR:
+        case G_BRANCH_Z_OTR:
+        case G_MARKER:
+            break;
+        case G_MTX:
+        case G_MOVEMEM:
+        case G_VTX:
+        case G_SETTIMG:
+            gfx_frame_capture_fixup_command(frame_capture.get(), start->words.w0, (uintptr_t)ptr, FIXUP_POINTER);
+            break;
+        case G_MTX_OTR:
+            if (ptr != nullptr) {
+                gfx_frame_capture_fixup_command(frame_capture.get(),
+                                                (start->words.w0 & 0x00FFFFFF) | ((uint32_t)(uint8_t)G_MTX << 24),
+                                                (uintptr_t)ptr, FIXUP_POINTER);
+            }
+            break;
+        case G_SETTIMG_OTR:
+            if (ptr != nullptr) {
+                gfx_frame_capture_fixup_command(frame_capture.get(),
+                                                (start->words.w0 & 0x00FFFFFF) | ((uint32_t)(uint8_t)G_SETTIMG << 24),
+                                                (uintptr_t)ptr, FIXUP_POINTER);
+            }
+            break;
+        case G_VTX_OTR:
+            // Kept as G_VTX_OTR with a resolved pointer, the form the command is patched to after its first run
+            if (ptr != nullptr) {
+                gfx_frame_capture_fixup_command(frame_capture.get(), start->words.w0, (uintptr_t)ptr, FIXUP_POINTER);
+                gfx_frame_capture_command(frame_capture.get(), start + 1, 1);
+            }
+            break;
+        case G_SETZIMG:
+        case G_SETCIMG:
+            gfx_frame_capture_fixup_command(frame_capture.get(), start->words.w0, (uintptr_t)ptr, FIXUP_ADDRESS);
+            break;
+        case G_INVALTEXCACHE:
+            gfx_frame_capture_fixup_command(frame_capture.get(), start->words.w0, start->words.w1, FIXUP_ADDRESS);
+            break;
+        case G_SETFB:
+        case G_SETTIMG_FB:
+            gfx_frame_capture_fixup_command(frame_capture.get(), start->words.w0, start->words.w1, FIXUP_FRAMEBUFFER);
+            break;
+        case G_BG_COPY:
+            if (!markerOn) {
+                gfx_frame_capture_fixup_command(frame_capture.get(), start->words.w0, start->words.w1, FIXUP_POINTER);
+            }
+            break;
+        default:
+            gfx_frame_capture_command(frame_capture.get(), start, end - start + 1);
+            break;
+    }
+}
+
 static void gfx_run_dl(Gfx* cmd) {
     // puts("dl");
     int dummy = 0;
@@ -2160,6 +3842,11 @@ static void gfx_run_dl(Gfx* cmd) {
     for (;;) {
         uint32_t opcode = cmd->words.w0 >> 24;
         // uint32_t opcode = cmd->words.w0 & 0xFF;
+        const Gfx* cmd_start = cmd;
+
+        if (retained.mode != RETAINED_NONE) {
+            gfx_retained_command(cmd);
+        }
 
         // if (markerOn)
         // printf("OP: %02X\n", opcode);
@@ -2337,10 +4024,10 @@ static void gfx_run_dl(Gfx* cmd) {
                     // printf("G_DL_OTR: %s\n", fileName);
 #endif
 
-                    Gfx* gfx = (Gfx*)GetResourceDataByCrc(hash, false);
+                    Ship::DisplayList* dl = gfx_get_display_list(hash);
 
-                    if (gfx != 0) {
-                        gfx_run_dl(gfx);
+                    if (dl != nullptr) {
+                        gfx_retained_run_dl(dl, hash);
                     }
                 } else {
                     cmd = (Gfx*)seg_addr(cmd->words.w1);
@@ -2431,20 +4118,9 @@ static void gfx_run_dl(Gfx* cmd) {
                 break;
 
             // RDP Commands:
-            case G_SETTIMG: {
-                uintptr_t i = (uintptr_t)seg_addr(cmd->words.w1);
-
-                char* imgData = (char*)i;
-
-                if ((i & 1) != 1) {
-                    if (gfx_check_image_signature(imgData) == 1) {
-                        i = (uintptr_t)GetResourceDataByName(imgData, false);
-                    }
-                }
-
-                gfx_dp_set_texture_image(C0(21, 3), C0(19, 2), C0(0, 10), (void*)i, imgData);
+            case G_SETTIMG:
+                gfx_dp_set_texture_image_address(C0(21, 3), C0(19, 2), C0(0, 10), cmd->words.w1);
                 break;
-            }
             case G_SETTIMG_OTR: {
                 uintptr_t addr = cmd->words.w1;
                 cmd++;
@@ -2481,7 +4157,7 @@ static void gfx_run_dl(Gfx* cmd) {
                 uint32_t width = C0(0, 10);
 
                 if (tex != NULL) {
-                    gfx_dp_set_texture_image(fmt, size, width, tex, fileName);
+                    gfx_dp_set_texture_image(fmt, size, width, tex, fileName, hash);
                 }
 
                 cmd++;
@@ -2506,6 +4182,7 @@ static void gfx_run_dl(Gfx* cmd) {
             case G_SETTIMG_FB: {
                 gfx_flush();
                 gfx_rapi->select_texture_fb(cmd->words.w1);
+                rendering_state.textures[0] = nullptr;
                 rdp.textures_changed[0] = false;
                 rdp.textures_changed[1] = false;
 
@@ -2651,10 +4328,38 @@ static void gfx_run_dl(Gfx* cmd) {
 
                 break;
         }
+        if (frame_capture != nullptr) {
+            gfx_capture_command(opcode, cmd_start, cmd);
+        }
         ++cmd;
     }
 }
 
+static bool gfx_capture_frame_command(std::shared_ptr<Ship::Console> console, const std::vector<std::string>& args) {
+    if (args.size() < 2) {
+        return CMD_FAILED;
+    }
+
+    gfx_capture_next_frame(args[1].c_str());
+    console->SendInfoMessage("Capturing the next frame to %s", args[1].c_str());
+    return CMD_SUCCESS;
+}
+
+static void gfx_finish_frame_capture() {
+    Gfx end_dl;
+    end_dl.words.w0 = (uint32_t)(uint8_t)G_ENDDL << 24;
+    end_dl.words.w1 = 0;
+    gfx_frame_capture_command(frame_capture.get(), &end_dl, 1);
+
+    for (const auto& [id, fb] : framebuffers) {
+        frame_capture->framebuffers.push_back({ id, fb.orig_width, fb.orig_height });
+    }
+
+    gfx_frame_capture_write(frame_capture.get(), frame_capture_path.c_str());
+    frame_capture.reset();
+    frame_capture_path.clear();
+}
+
 static void gfx_sp_reset() {
     rsp.modelview_matrix_stack_size = 1;
     rsp.current_num_lights = 2;
@@ -2671,6 +4376,12 @@ void gfx_init(struct GfxWindowManagerAPI* wapi, struct GfxRenderingAPI* rapi, co
     gfx_rapi = rapi;
     gfx_wapi->init(game_name, rapi->get_name(), start_in_fullscreen, width, height);
     gfx_rapi->init();
+    gfx_backend_rapi = rapi;
+    // Read once, since the texture and shader ids handed out by the command buffer only mean something through it
+    if (CVarGetInteger("gThreadedSubmission", 0) != 0 && gfx_command_buffer_supported(rapi)) {
+        gfx_command_buffer_init(rapi);
+        gfx_rapi = &gfx_command_buffer_api;
+    }
     gfx_rapi->update_framebuffer_parameters(0, width, height, 1, false, true, true, true);
 #ifdef __APPLE__
     gfx_current_dimensions.internal_mul = 1;
@@ -2685,25 +4396,25 @@ void gfx_init(struct GfxWindowManagerAPI* wapi, struct GfxRenderingAPI* rapi, co
     game_framebuffer = gfx_rapi->create_framebuffer();
     game_framebuffer_msaa_resolved = gfx_rapi->create_framebuffer();
 
+    SohImGui::GetConsole()->AddCommand(
+        "capture_frame", { gfx_capture_frame_command,
+                           "Writes the commands and data of the next frame to a file, for replaying without the game",
+                           { { "path", Ship::ArgumentType::TEXT } } });
+
     for (int i = 0; i < 16; i++) {
         segmentPointers[i] = 0;
     }
 
-    // Used in the 120 star TAS
-    static uint32_t precomp_shaders[] = { 0x01200200, 0x00000045, 0x00000200, 0x01200a00, 0x00000a00, 0x01a00045,
-                                          0x00000551, 0x01045045, 0x05a00a00, 0x01200045, 0x05045045, 0x01045a00,
-                                          0x01a00a00, 0x0000038d, 0x01081081, 0x0120038d, 0x03200045, 0x03200a00,
-                                          0x01a00a6f, 0x01141045, 0x07a00a00, 0x05200200, 0x03200200, 0x09200200,
-                                          0x0920038d, 0x09200045 };
-    for (size_t i = 0; i < sizeof(precomp_shaders) / sizeof(uint32_t); i++) {
-        // gfx_lookup_or_create_shader_program(precomp_shaders[i]);
-    }
-
     Ship::ExecuteHooks<Ship::GfxInit>();
+
+    // After the hooks, which set the texture filter the shaders are generated for
+    if (CVarGetInteger("gShaderCache", 0) != 0) {
+        gfx_shader_cache_prewarm();
+    }
 }
 
 struct GfxRenderingAPI* gfx_get_current_rendering_api(void) {
-    return gfx_rapi;
+    return gfx_backend_rapi;
 }
 
 void gfx_start_frame(void) {
@@ -2758,6 +4469,11 @@ void gfx_start_frame(void) {
 
 void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacements) {
     gfx_sp_reset();
+    texture_decode_async = CVarGetInteger("gAsyncTextureDecode", 0) != 0;
+    gfx_texture_content_cache.enabled = CVarGetInteger("gTextureContentCache", 0) != 0;
+    gfx_texture_content_cache.budget_bytes = (size_t)std::max(CVarGetInteger("gTextureCacheBudgetMB", 256), 1) << 20;
+    retained.enabled = CVarGetInteger("gRetainedMeshes", 0) != 0;
+    compiled_display_lists_enabled = CVarGetInteger("gCompiledDisplayLists", 0) != 0;
 
     // puts("New frame");
     get_pixel_depth_pending.clear();
@@ -2791,8 +4507,26 @@ void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacemen
     rdp.viewport_or_scissor_changed = true;
     rendering_state.viewport = {};
     rendering_state.scissor = {};
+    if (!frame_capture_path.empty()) {
+        frame_capture = std::make_unique<GfxFrameCapture>();
+    }
     gfx_run_dl(commands);
+    if (frame_capture != nullptr) {
+        gfx_finish_frame_capture();
+    }
     gfx_flush();
+    gfx_finish_texture_decodes();
+    texture_decode_stats_last_frame = texture_decode_stats;
+    texture_decode_stats = {};
+    texture_cache_stats.textures = gfx_texture_content_cache.map.size();
+    texture_cache_stats.resident_bytes = gfx_texture_content_cache.resident_bytes;
+    texture_cache_stats_last_frame = texture_cache_stats;
+    texture_cache_stats = {};
+    gfx_retained_end_frame();
+    compiled_dl_stats_last_frame = compiled_dl_stats;
+    compiled_dl_stats = {};
+    render_state_stats_last_frame = render_state_stats;
+    render_state_stats = {};
     gfxFramebuffer = 0;
     if (game_renders_to_framebuffer) {
         gfx_rapi->start_draw_to_framebuffer(0, 1);
@@ -2812,6 +4546,11 @@ void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacemen
             gfxFramebuffer = (uintptr_t)gfx_rapi->get_framebuffer_texture_id(game_framebuffer);
         }
     }
+    if (gfx_rapi == &gfx_command_buffer_api) {
+        // ImGui draws with the backend's device directly, after the game's draws
+        gfx_command_buffer_sync();
+        submission_stats_last_frame = gfx_command_buffer_take_stats();
+    }
     SohImGui::DrawFramebufferAndGameInput();
     SohImGui::Render();
     double t1 = gfx_wapi->get_time();
@@ -2828,6 +4567,34 @@ void gfx_end_frame(void) {
     }
 }
 
+const struct GfxTextureDecodeStats* gfx_get_texture_decode_stats(void) {
+    return &texture_decode_stats_last_frame;
+}
+
+const struct GfxTextureCacheStats* gfx_get_texture_cache_stats(void) {
+    return &texture_cache_stats_last_frame;
+}
+
+const struct GfxRetainedMeshStats* gfx_get_retained_mesh_stats(void) {
+    return &retained_mesh_stats_last_frame;
+}
+
+const struct GfxCompiledDisplayListStats* gfx_get_compiled_display_list_stats(void) {
+    return &compiled_dl_stats_last_frame;
+}
+
+const struct GfxRenderStateStats* gfx_get_render_state_stats(void) {
+    return &render_state_stats_last_frame;
+}
+
+const struct GfxSubmissionStats* gfx_get_submission_stats(void) {
+    return &submission_stats_last_frame;
+}
+
+void gfx_capture_next_frame(const char* path) {
+    frame_capture_path = path;
+}
+
 void gfx_set_target_fps(int fps) {
     gfx_wapi->set_target_fps(fps);
 }
@@ -19,6 +19,7 @@ extern uintptr_t gfxFramebuffer;
 
 struct GfxRenderingAPI;
 struct GfxWindowManagerAPI;
+struct GfxSubmissionStats;
 
 struct XYWidthHeight {
     int16_t x, y;
@@ -50,14 +51,56 @@ struct TextureCacheKey {
 typedef std::unordered_map<TextureCacheKey, struct TextureCacheValue, TextureCacheKey::Hasher> TextureCacheMap;
 typedef std::pair<const TextureCacheKey, struct TextureCacheValue> TextureCacheNode;
 
-struct TextureCacheValue {
-    uint32_t texture_id;
+struct TextureSamplerState {
     uint8_t cms, cmt;
     bool linear_filter;
+};
+
+struct TextureCacheValue {
+    uint32_t texture_id;
+    struct TextureSamplerState own_sampler;
+    struct TextureContentEntry* content; // entry of the content cache whose texture this shares, if any
 
     std::list<struct TextureCacheMapIter>::iterator lru_location;
 };
 
+struct GfxTextureDecodeStats {
+    uint32_t decodes;       // texture cache misses converted to RGBA32
+    uint32_t async_decodes; // of those, the ones converted on a decode worker
+    double decode_ms;       // time spent converting, summed over all threads
+    double wait_ms;         // time the render thread waited for decode workers
+};
+
+struct GfxTextureCacheStats {
+    uint32_t hits;           // lookups that found the texture loaded from the same address
+    uint32_t content_hits;   // of the other lookups, the ones that found the same texels uploaded from elsewhere
+    uint32_t misses;         // lookups that had to upload the texture
+    uint32_t evictions;      // textures dropped to stay under the entry limit or the byte budget
+    uint32_t textures;       // textures held by the content cache
+    uint64_t resident_bytes; // RGBA32 size of those textures
+};
+
+struct GfxRetainedMeshStats {
+    uint32_t replays;    // display lists drawn from retained meshes
+    uint32_t captures;   // display lists recorded into new retained meshes
+    uint32_t fallbacks;  // recordings or replays given up part way, finishing the display list in immediate mode
+    uint32_t meshes;     // retained meshes on the GPU
+    uint64_t mesh_bytes; // size of their vertices and indices
+};
+
+struct GfxCompiledDisplayListStats {
+    uint32_t runs;        // DisplayList resources run from their compiled commands
+    uint32_t compiles;    // display lists compiled, or compiled again after they changed
+    uint32_t interpreted; // DisplayList resources run command by command because they can not be compiled
+};
+
+struct GfxRenderStateStats {
+    uint32_t flushes;         // batches of triangles drawn
+    uint32_t small_flushes;   // of those, the ones with fewer than 4 triangles
+    uint32_t avoided_flushes; // texture changes flagged by tile commands that left the bound textures as they were
+    uint32_t rectangles;      // texture and fill rectangles added to batches
+};
+
 struct TextureCacheMapIter {
     TextureCacheMap::iterator it;
 };
@@ -78,9 +121,26 @@ struct GfxRenderingAPI* gfx_get_current_rendering_api(void);
 void gfx_start_frame(void);
 void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacements);
 void gfx_end_frame(void);
+// Captures the next frame gfx_run renders to path. See gfx_frame_capture.h.
+void gfx_capture_next_frame(const char* path);
+// Texture decode counts and times of the last frame gfx_run rendered.
+const struct GfxTextureDecodeStats* gfx_get_texture_decode_stats(void);
+// Texture cache counts of the last frame gfx_run rendered.
+const struct GfxTextureCacheStats* gfx_get_texture_cache_stats(void);
+// Retained mesh counts of the last frame gfx_run rendered.
+const struct GfxRetainedMeshStats* gfx_get_retained_mesh_stats(void);
+// Compiled display list counts of the last frame gfx_run rendered.
+const struct GfxCompiledDisplayListStats* gfx_get_compiled_display_list_stats(void);
+// Flush counts of the last frame gfx_run rendered.
+const struct GfxRenderStateStats* gfx_get_render_state_stats(void);
+// Submission thread counts of the last frame gfx_run rendered, when gThreadedSubmission is in use.
+// See gfx_command_buffer.h.
+const struct GfxSubmissionStats* gfx_get_submission_stats(void);
 void gfx_set_target_fps(int);
 void gfx_set_maximum_frame_latency(int latency);
 void gfx_texture_cache_clear();
+// Drops the cached textures whose texels or palettes were read from the size bytes at addr.
+void gfx_texture_cache_invalidate(const void* addr, size_t size);
 extern "C" int gfx_create_framebuffer(uint32_t width, uint32_t height);
 void gfx_get_pixel_depth_prepare(float x, float y);
 uint16_t gfx_get_pixel_depth(float x, float y);
@@ -16,6 +16,24 @@ struct GfxClipParameters {
     bool invert_y;
 };
 
+// Values that are the same for every vertex of a draw. Backends with set_draw_constants take them as shader uniforms
+// instead of reading them from each vertex.
+struct GfxDrawConstants {
+    float fog_color[3];
+    float grayscale_color[4]; // rgb, then how far to lerp towards it
+    float tex_clamp[2][2];    // largest s and t coordinate of each texture whose tile clamps
+};
+
+enum GfxCullMode { GFX_CULL_NONE, GFX_CULL_CW, GFX_CULL_CCW, GFX_CULL_ALL }; // winding culled, in clip space
+
+// How a retained mesh is drawn. The matrix takes object space positions (as row vectors) to clip space, with the
+// aspect ratio, invert_y and z_is_from_0_to_1 adjustments already applied.
+struct GfxMeshTransform {
+    float matrix[4][4];
+    float fog_mul, fog_offset;
+    enum GfxCullMode cull;
+};
+
 enum FilteringMode { FILTER_THREE_POINT, FILTER_LINEAR, FILTER_NONE };
 
 // A hash function used to hash a: pair<float, float>
@@ -47,6 +65,26 @@ struct GfxRenderingAPI {
     void (*set_scissor)(int x, int y, int width, int height);
     void (*set_use_alpha)(bool use_alpha);
     void (*draw_triangles)(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_tris);
+    // Optional. Returns memory for the next batch of up to max_buf_vbo_len floats, which is then passed to
+    // draw_triangles, so vertices are written straight to the GPU. Null means the batch is built in gfx_pc's own array.
+    float* (*map_vertex_buffer)(size_t max_buf_vbo_len);
+    // Optional. Draws buf_ibo_len / 3 triangles whose corners index the vertices in buf_vbo. When set, gfx_pc writes
+    // each vertex once per batch instead of once per triangle corner, and calls this instead of draw_triangles.
+    void (*draw_indexed_triangles)(float buf_vbo[], size_t buf_vbo_len, const uint16_t buf_ibo[], size_t buf_ibo_len);
+    // Optional. When set, gfx_pc writes the packed vertex layout: the position and texture coordinates as floats, then
+    // one 32-bit word each for the fog factor (in the first byte) and for every input color (RGBA8). Fog color,
+    // grayscale color and texture clamp bounds are left out of the vertices and passed here before the draws using them.
+    void (*set_draw_constants)(const struct GfxDrawConstants* constants);
+    // Optional, together with draw_mesh and delete_mesh, and only used along with set_draw_constants. Keeps vertices of
+    // the packed layout and indices into them on the GPU, and returns an id for them. The positions are in object space
+    // with w = 1. A nonzero second byte of the fog word asks for the fog factor to be computed from the transformed z
+    // and w instead, like the RSP does when G_FOG is set.
+    uint32_t (*create_mesh)(const float buf_vbo[], size_t buf_vbo_len, const uint32_t buf_ibo[], size_t buf_ibo_len);
+    // Draws ibo_len / 3 triangles of a mesh with the current shader and state. The indices start at ibo_offset and
+    // refer to vertices starting vbo_offset floats into the mesh.
+    void (*draw_mesh)(uint32_t mesh_id, size_t vbo_offset, size_t ibo_offset, size_t ibo_len,
+                      const struct GfxMeshTransform* transform);
+    void (*delete_mesh)(uint32_t mesh_id);
     void (*init)(void);
     void (*on_resize)(void);
     void (*start_frame)(void);
@@ -0,0 +1,341 @@
+#include "gfx_texture_decode.h"
+
+#include <string.h>
+#include <algorithm>
+#include <array>
+
+#include "libultraship/libultra/gbi.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_DECODE_SSE2
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TEXTURE_DECODE_AVX2
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define TEXTURE_DECODE_NEON
+#endif
+
+// SCALE_M_N: upscale M-bit integer to 8-bit
+#define SCALE_5_8(VAL_) (((VAL_)*0xFF) / 0x1F)
+#define SCALE_4_8(VAL_) ((VAL_)*0x11)
+#define SCALE_3_8(VAL_) ((VAL_)*0x24)
+
+// The vector paths compute SCALE_5_8 as (v * 1053) >> 7, which gives the same result for every 5-bit input.
+#define SCALE_5_8_MUL 1053
+#define SCALE_5_8_SHIFT 7
+
+static constexpr std::array<uint8_t, 32> scale_5_8_lut = [] {
+    std::array<uint8_t, 32> lut{};
+    for (int i = 0; i < 32; i++) {
+        lut[i] = SCALE_5_8(i);
+    }
+    return lut;
+}();
+
+// RGBA32 texel for every IA4 nibble.
+static constexpr std::array<std::array<uint8_t, 4>, 16> ia4_lut = [] {
+    std::array<std::array<uint8_t, 4>, 16> lut{};
+    for (int i = 0; i < 16; i++) {
+        uint8_t intensity = SCALE_3_8(i >> 1);
+        lut[i] = { intensity, intensity, intensity, (uint8_t)((i & 1) ? 255 : 0) };
+    }
+    return lut;
+}();
+
+static inline void decode_rgba16_texel(uint8_t* dst, uint16_t col16) {
+    dst[0] = scale_5_8_lut[col16 >> 11];
+    dst[1] = scale_5_8_lut[(col16 >> 6) & 0x1f];
+    dst[2] = scale_5_8_lut[(col16 >> 1) & 0x1f];
+    dst[3] = (col16 & 1) ? 255 : 0;
+}
+
+static inline void write_gray_texel(uint8_t* dst, uint8_t intensity, uint8_t alpha) {
+    dst[0] = intensity;
+    dst[1] = intensity;
+    dst[2] = intensity;
+    dst[3] = alpha;
+}
+
+// Expands a big endian RGBA16 palette into RGBA32 texels so palette textures only need one lookup per texel.
+static void expand_palette(uint8_t (*dst)[4], const uint8_t* palette, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        decode_rgba16_texel(dst[i], (palette[i * 2] << 8) | palette[i * 2 + 1]);
+    }
+}
+
+size_t gfx_decoded_texture_size(uint8_t siz, uint32_t size_bytes) {
+    switch (siz) {
+        case G_IM_SIZ_4b:
+            return (size_t)size_bytes * 8;
+        case G_IM_SIZ_8b:
+            return (size_t)size_bytes * 4;
+        case G_IM_SIZ_16b:
+            return (size_t)size_bytes * 2;
+        default:
+            return size_bytes;
+    }
+}
+
+#if defined(TEXTURE_DECODE_SSE2)
+// Stores 16 intensity bytes as 16 texels with the intensity in every channel.
+static inline void store_gray16_sse2(uint8_t* dst, __m128i intensity) {
+    __m128i lo = _mm_unpacklo_epi8(intensity, intensity);
+    __m128i hi = _mm_unpackhi_epi8(intensity, intensity);
+    _mm_storeu_si128((__m128i*)(dst + 0), _mm_unpacklo_epi16(lo, lo));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(lo, lo));
+    _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(hi, hi));
+    _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(hi, hi));
+}
+
+// Stores 16 intensity/alpha byte pairs as 16 texels.
+static inline void store_gray_alpha16_sse2(uint8_t* dst, __m128i intensity, __m128i alpha) {
+    __m128i ii_lo = _mm_unpacklo_epi8(intensity, intensity);
+    __m128i ii_hi = _mm_unpackhi_epi8(intensity, intensity);
+    __m128i ia_lo = _mm_unpacklo_epi8(intensity, alpha);
+    __m128i ia_hi = _mm_unpackhi_epi8(intensity, alpha);
+    _mm_storeu_si128((__m128i*)(dst + 0), _mm_unpacklo_epi16(ii_lo, ia_lo));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(ii_lo, ia_lo));
+    _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(ii_hi, ia_hi));
+    _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(ii_hi, ia_hi));
+}
+
+// Splits 16 bytes into their high and low nibbles, each scaled to 8 bits.
+static inline void split_nibbles_sse2(__m128i v, __m128i* high, __m128i* low) {
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i h = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+    __m128i l = _mm_and_si128(v, nibble);
+    *high = _mm_or_si128(_mm_slli_epi16(h, 4), h);
+    *low = _mm_or_si128(_mm_slli_epi16(l, 4), l);
+}
+#elif defined(TEXTURE_DECODE_NEON)
+static inline void split_nibbles_neon(uint8x16_t v, uint8x16_t* high, uint8x16_t* low) {
+    const uint8x16_t scale = vdupq_n_u8(0x11);
+    *high = vmulq_u8(vshrq_n_u8(v, 4), scale);
+    *low = vmulq_u8(vandq_u8(v, vdupq_n_u8(0x0f)), scale);
+}
+#endif
+
+void gfx_decode_texture_rgba16(uint8_t* dst, const uint8_t* src, uint32_t size_bytes) {
+    uint32_t count = size_bytes / 2;
+    uint32_t i = 0;
+
+#if defined(TEXTURE_DECODE_SSE2)
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mul5 = _mm_set1_epi16(SCALE_5_8_MUL);
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+
+        __m128i r = _mm_srli_epi16(x, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(x, 6), mask5);
+        __m128i b = _mm_and_si128(_mm_srli_epi16(x, 1), mask5);
+        r = _mm_srli_epi16(_mm_mullo_epi16(r, mul5), SCALE_5_8_SHIFT);
+        g = _mm_srli_epi16(_mm_mullo_epi16(g, mul5), SCALE_5_8_SHIFT);
+        b = _mm_srli_epi16(_mm_mullo_epi16(b, mul5), SCALE_5_8_SHIFT);
+        __m128i a = _mm_slli_epi16(_mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(x, _mm_set1_epi16(1))), 8);
+
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, a);
+        _mm_storeu_si128((__m128i*)(dst + 4 * i), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dst + 4 * i + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+#elif defined(TEXTURE_DECODE_NEON)
+    const uint8x16x2_t lut = { { vld1q_u8(&scale_5_8_lut[0]), vld1q_u8(&scale_5_8_lut[16]) } };
+    const uint16x8_t mask5 = vdupq_n_u16(0x1f);
+    for (; i + 16 <= count; i += 16) {
+        uint16x8_t x0 = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src + 2 * i)));
+        uint16x8_t x1 = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src + 2 * i + 16)));
+
+        uint8x16x4_t out;
+        out.val[0] = vqtbl2q_u8(lut, vcombine_u8(vmovn_u16(vshrq_n_u16(x0, 11)), vmovn_u16(vshrq_n_u16(x1, 11))));
+        out.val[1] = vqtbl2q_u8(lut, vcombine_u8(vmovn_u16(vandq_u16(vshrq_n_u16(x0, 6), mask5)),
+                                                 vmovn_u16(vandq_u16(vshrq_n_u16(x1, 6), mask5))));
+        out.val[2] = vqtbl2q_u8(lut, vcombine_u8(vmovn_u16(vandq_u16(vshrq_n_u16(x0, 1), mask5)),
+                                                 vmovn_u16(vandq_u16(vshrq_n_u16(x1, 1), mask5))));
+        out.val[3] = vtstq_u8(vcombine_u8(vmovn_u16(x0), vmovn_u16(x1)), vdupq_n_u8(1));
+        vst4q_u8(dst + 4 * i, out);
+    }
+#endif
+
+    for (; i < count; i++) {
+        decode_rgba16_texel(&dst[4 * i], (src[2 * i] << 8) | src[2 * i + 1]);
+    }
+}
+
+void gfx_decode_texture_ia4(uint8_t* dst, const uint8_t* src, uint32_t size_bytes) {
+    for (uint32_t i = 0; i < size_bytes; i++) {
+        memcpy(&dst[8 * i], ia4_lut[src[i] >> 4].data(), 4);
+        memcpy(&dst[8 * i + 4], ia4_lut[src[i] & 0xf].data(), 4);
+    }
+}
+
+void gfx_decode_texture_ia8(uint8_t* dst, const uint8_t* src, uint32_t size_bytes) {
+    uint32_t i = 0;
+
+#if defined(TEXTURE_DECODE_SSE2)
+    for (; i + 16 <= size_bytes; i += 16) {
+        __m128i intensity, alpha;
+        split_nibbles_sse2(_mm_loadu_si128((const __m128i*)(src + i)), &intensity, &alpha);
+        store_gray_alpha16_sse2(dst + 4 * i, intensity, alpha);
+    }
+#elif defined(TEXTURE_DECODE_NEON)
+    for (; i + 16 <= size_bytes; i += 16) {
+        uint8x16x4_t out;
+        split_nibbles_neon(vld1q_u8(src + i), &out.val[0], &out.val[3]);
+        out.val[1] = out.val[0];
+        out.val[2] = out.val[0];
+        vst4q_u8(dst + 4 * i, out);
+    }
+#endif
+
+    for (; i < size_bytes; i++) {
+        write_gray_texel(&dst[4 * i], SCALE_4_8(src[i] >> 4), SCALE_4_8(src[i] & 0xf));
+    }
+}
+
+void gfx_decode_texture_ia16(uint8_t* dst, const uint8_t* src, uint32_t size_bytes) {
+    uint32_t count = size_bytes / 2;
+    uint32_t i = 0;
+
+#if defined(TEXTURE_DECODE_SSE2)
+    for (; i + 8 <= count; i += 8) {
+        // Each 16-bit lane holds intensity in the low byte and alpha in the high byte.
+        __m128i ia = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+        __m128i intensity = _mm_and_si128(ia, _mm_set1_epi16(0xff));
+        __m128i ii = _mm_or_si128(intensity, _mm_slli_epi16(intensity, 8));
+        _mm_storeu_si128((__m128i*)(dst + 4 * i), _mm_unpacklo_epi16(ii, ia));
+        _mm_storeu_si128((__m128i*)(dst + 4 * i + 16), _mm_unpackhi_epi16(ii, ia));
+    }
+#elif defined(TEXTURE_DECODE_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t ia = vld2q_u8(src + 2 * i);
+        uint8x16x4_t out = { { ia.val[0], ia.val[0], ia.val[0], ia.val[1] } };
+        vst4q_u8(dst + 4 * i, out);
+    }
+#endif
+
+    for (; i < count; i++) {
+        write_gray_texel(&dst[4 * i], src[2 * i], src[2 * i + 1]);
+    }
+}
+
+void gfx_decode_texture_i4(uint8_t* dst, const uint8_t* src, uint32_t size_bytes) {
+    uint32_t i = 0;
+
+#if defined(TEXTURE_DECODE_SSE2)
+    for (; i + 16 <= size_bytes; i += 16) {
+        __m128i high, low;
+        split_nibbles_sse2(_mm_loadu_si128((const __m128i*)(src + i)), &high, &low);
+        store_gray16_sse2(dst + 8 * i, _mm_unpacklo_epi8(high, low));
+        store_gray16_sse2(dst + 8 * i + 64, _mm_unpackhi_epi8(high, low));
+    }
+#elif defined(TEXTURE_DECODE_NEON)
+    for (; i + 16 <= size_bytes; i += 16) {
+        uint8x16_t high, low;
+        split_nibbles_neon(vld1q_u8(src + i), &high, &low);
+        uint8x16x2_t texels = vzipq_u8(high, low);
+        uint8x16x4_t out0 = { { texels.val[0], texels.val[0], texels.val[0], texels.val[0] } };
+        uint8x16x4_t out1 = { { texels.val[1], texels.val[1], texels.val[1], texels.val[1] } };
+        vst4q_u8(dst + 8 * i, out0);
+        vst4q_u8(dst + 8 * i + 64, out1);
+    }
+#endif
+
+    for (; i < size_bytes; i++) {
+        uint8_t high = SCALE_4_8(src[i] >> 4);
+        uint8_t low = SCALE_4_8(src[i] & 0xf);
+        write_gray_texel(&dst[8 * i], high, high);
+        write_gray_texel(&dst[8 * i + 4], low, low);
+    }
+}
+
+void gfx_decode_texture_i8(uint8_t* dst, const uint8_t* src, uint32_t size_bytes) {
+    uint32_t i = 0;
+
+#if defined(TEXTURE_DECODE_SSE2)
+    for (; i + 16 <= size_bytes; i += 16) {
+        store_gray16_sse2(dst + 4 * i, _mm_loadu_si128((const __m128i*)(src + i)));
+    }
+#elif defined(TEXTURE_DECODE_NEON)
+    for (; i + 16 <= size_bytes; i += 16) {
+        uint8x16_t intensity = vld1q_u8(src + i);
+        uint8x16x4_t out = { { intensity, intensity, intensity, intensity } };
+        vst4q_u8(dst + 4 * i, out);
+    }
+#endif
+
+    for (; i < size_bytes; i++) {
+        write_gray_texel(&dst[4 * i], src[i], src[i]);
+    }
+}
+
+void gfx_decode_texture_ci4(uint8_t* dst, const uint8_t* src, uint32_t size_bytes, const uint8_t* palette) {
+    uint8_t colors[16][4];
+    expand_palette(colors, palette, 16);
+
+    for (uint32_t i = 0; i < size_bytes; i++) {
+        memcpy(&dst[8 * i], colors[src[i] >> 4], 4);
+        memcpy(&dst[8 * i + 4], colors[src[i] & 0xf], 4);
+    }
+}
+
+bool gfx_texture_ci8_uses_upper_half(const uint8_t* src, uint32_t size_bytes, uint32_t line_size_bytes,
+                                     uint32_t full_line_size_bytes) {
+    uint8_t any = 0;
+    for (uint32_t i = 0, j = 0; i < size_bytes; j += full_line_size_bytes - line_size_bytes) {
+        for (uint32_t k = 0; k < line_size_bytes && i < size_bytes; i++, k++, j++) {
+            any |= src[j];
+        }
+    }
+    return (any & 0x80) != 0;
+}
+
+void gfx_decode_texture_ci8(uint8_t* dst, const uint8_t* src, uint32_t size_bytes, uint32_t line_size_bytes,
+                            uint32_t full_line_size_bytes, const uint8_t* const palettes[2],
+                            const uint16_t palette_entries[2]) {
+    alignas(32) uint8_t colors[256][4] = {};
+    expand_palette(colors, palettes[0], std::min<uint32_t>(palette_entries[0], 128));
+    if (palettes[1] != nullptr &&
+        gfx_texture_ci8_uses_upper_half(src, size_bytes, line_size_bytes, full_line_size_bytes)) {
+        expand_palette(colors + 128, palettes[1], std::min<uint32_t>(palette_entries[1], 128));
+    }
+
+    for (uint32_t i = 0, j = 0; i < size_bytes; j += full_line_size_bytes - line_size_bytes) {
+        uint32_t k = 0;
+
+#if defined(TEXTURE_DECODE_AVX2)
+        for (; k + 8 <= line_size_bytes && i + 8 <= size_bytes; i += 8, k += 8, j += 8) {
+            __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + j)));
+            __m256i texels = _mm256_i32gather_epi32((const int*)colors, indices, 4);
+            _mm256_storeu_si256((__m256i*)(dst + 4 * i), texels);
+        }
+#endif
+
+        for (; k < line_size_bytes; i++, k++, j++) {
+            memcpy(&dst[4 * i], colors[src[j]], 4);
+        }
+    }
+}
+
+bool gfx_decode_texture(uint8_t* dst, const uint8_t* src, uint32_t size_bytes, uint8_t fmt, uint8_t siz) {
+    if (fmt == G_IM_FMT_RGBA && siz == G_IM_SIZ_16b) {
+        gfx_decode_texture_rgba16(dst, src, size_bytes);
+    } else if (fmt == G_IM_FMT_IA && siz == G_IM_SIZ_4b) {
+        gfx_decode_texture_ia4(dst, src, size_bytes);
+    } else if (fmt == G_IM_FMT_IA && siz == G_IM_SIZ_8b) {
+        gfx_decode_texture_ia8(dst, src, size_bytes);
+    } else if (fmt == G_IM_FMT_IA && siz == G_IM_SIZ_16b) {
+        gfx_decode_texture_ia16(dst, src, size_bytes);
+    } else if (fmt == G_IM_FMT_I && siz == G_IM_SIZ_4b) {
+        gfx_decode_texture_i4(dst, src, size_bytes);
+    } else if (fmt == G_IM_FMT_I && siz == G_IM_SIZ_8b) {
+        gfx_decode_texture_i8(dst, src, size_bytes);
+    } else {
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef GFX_TEXTURE_DECODE_H
+#define GFX_TEXTURE_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Converters from the N64 texel formats to RGBA32. Each one decodes size_bytes bytes of source texels, laid out
+// linearly, into dst, which must hold gfx_decoded_texture_size(siz, size_bytes) bytes. They have no dependency on the
+// RDP state, so apart from the palette formats they can be run ahead of time on any thread.
+
+size_t gfx_decoded_texture_size(uint8_t siz, uint32_t size_bytes);
+
+void gfx_decode_texture_rgba16(uint8_t* dst, const uint8_t* src, uint32_t size_bytes);
+void gfx_decode_texture_ia4(uint8_t* dst, const uint8_t* src, uint32_t size_bytes);
+void gfx_decode_texture_ia8(uint8_t* dst, const uint8_t* src, uint32_t size_bytes);
+void gfx_decode_texture_ia16(uint8_t* dst, const uint8_t* src, uint32_t size_bytes);
+void gfx_decode_texture_i4(uint8_t* dst, const uint8_t* src, uint32_t size_bytes);
+void gfx_decode_texture_i8(uint8_t* dst, const uint8_t* src, uint32_t size_bytes);
+
+// palette points to the 16 big endian RGBA16 entries selected by the tile.
+void gfx_decode_texture_ci4(uint8_t* dst, const uint8_t* src, uint32_t size_bytes, const uint8_t* palette);
+// palettes are the two 128 entry halves of the TLUT, with palette_entries[i] entries loaded into each. Entries that
+// were not loaded decode as transparent black, and the upper half is only read if a texel indexes it. Source lines are
+// line_size_bytes long, full_line_size_bytes apart.
+void gfx_decode_texture_ci8(uint8_t* dst, const uint8_t* src, uint32_t size_bytes, uint32_t line_size_bytes,
+                            uint32_t full_line_size_bytes, const uint8_t* const palettes[2],
+                            const uint16_t palette_entries[2]);
+// Whether a texel of a CI8 texture, laid out as gfx_decode_texture_ci8 reads it, indexes the upper half of the TLUT.
+bool gfx_texture_ci8_uses_upper_half(const uint8_t* src, uint32_t size_bytes, uint32_t line_size_bytes,
+                                     uint32_t full_line_size_bytes);
+
+// Decodes a linear, non palette texture in the given G_IM_FMT/G_IM_SIZ combination. Returns false for formats that
+// can not be decoded without RDP state.
+bool gfx_decode_texture(uint8_t* dst, const uint8_t* src, uint32_t size_bytes, uint8_t fmt, uint8_t siz);
+
+#endif
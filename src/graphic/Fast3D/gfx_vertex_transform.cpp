@@ -0,0 +1,405 @@
+#include "gfx_vertex_transform.h"
+
+#include <math.h>
+#include <limits>
+
+#include "misc/Utils.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VERTEX_TRANSFORM_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define VERTEX_TRANSFORM_NEON
+#endif
+
+#define CLIP_LEFT 1
+#define CLIP_RIGHT 2
+#define CLIP_BOTTOM 4
+#define CLIP_TOP 8
+#define CLIP_FAR 32
+
+static inline float adjust_x_for_aspect_ratio(float x, const GfxVertexTransformState* state) {
+    if (!state->adjust_x_for_aspect_ratio) {
+        return x;
+    }
+    return x * (4.0f / 3.0f) / state->aspect_ratio;
+}
+
+// Replaces U and V with the spherical or linear texture coordinates for the vertex normal.
+static void calculate_texture_gen(const Vtx_tn* vn, const GfxVertexTransformState* state, short& U, short& V) {
+    float dotx = 0, doty = 0;
+    dotx += vn->n[0] * state->lookat_coeffs[0][0];
+    dotx += vn->n[1] * state->lookat_coeffs[0][1];
+    dotx += vn->n[2] * state->lookat_coeffs[0][2];
+    doty += vn->n[0] * state->lookat_coeffs[1][0];
+    doty += vn->n[1] * state->lookat_coeffs[1][1];
+    doty += vn->n[2] * state->lookat_coeffs[1][2];
+
+    dotx /= 127.0f;
+    doty /= 127.0f;
+
+    dotx = Ship::Math::clamp(dotx, -1.0f, 1.0f);
+    doty = Ship::Math::clamp(doty, -1.0f, 1.0f);
+
+    if (state->geometry_mode & G_TEXTURE_GEN_LINEAR) {
+        // Not sure exactly what formula we should use to get accurate values
+        /*dotx = (2.906921f * dotx * dotx + 1.36114f) * dotx;
+        doty = (2.906921f * doty * doty + 1.36114f) * doty;
+        dotx = (dotx + 1.0f) / 4.0f;
+        doty = (doty + 1.0f) / 4.0f;*/
+        dotx = acosf(-dotx) /* M_PI */ / 4.0f;
+        doty = acosf(-doty) /* M_PI */ / 4.0f;
+    } else {
+        dotx = (dotx + 1.0f) / 4.0f;
+        doty = (doty + 1.0f) / 4.0f;
+    }
+
+    U = (int32_t)(dotx * state->texture_scaling_s);
+    V = (int32_t)(doty * state->texture_scaling_t);
+}
+
+static void transform_vertex(LoadedVertex* d, const Vtx* vtx, const GfxVertexTransformState* state) {
+    const Vtx_t* v = &vtx->v;
+    const Vtx_tn* vn = &vtx->n;
+    const float(*mp)[4] = state->mp_matrix;
+
+    float x = v->ob[0] * mp[0][0] + v->ob[1] * mp[1][0] + v->ob[2] * mp[2][0] + mp[3][0];
+    float y = v->ob[0] * mp[0][1] + v->ob[1] * mp[1][1] + v->ob[2] * mp[2][1] + mp[3][1];
+    float z = v->ob[0] * mp[0][2] + v->ob[1] * mp[1][2] + v->ob[2] * mp[2][2] + mp[3][2];
+    float w = v->ob[0] * mp[0][3] + v->ob[1] * mp[1][3] + v->ob[2] * mp[2][3] + mp[3][3];
+
+    x = adjust_x_for_aspect_ratio(x, state);
+
+    short U = v->tc[0] * state->texture_scaling_s >> 16;
+    short V = v->tc[1] * state->texture_scaling_t >> 16;
+
+    if (state->geometry_mode & G_LIGHTING) {
+        const Light_t* lights = state->lights;
+        int num_lights = state->num_lights;
+
+        int r = lights[num_lights - 1].col[0];
+        int g = lights[num_lights - 1].col[1];
+        int b = lights[num_lights - 1].col[2];
+
+        for (int i = 0; i < num_lights - 1; i++) {
+            float intensity = 0;
+            intensity += vn->n[0] * state->lights_coeffs[i][0];
+            intensity += vn->n[1] * state->lights_coeffs[i][1];
+            intensity += vn->n[2] * state->lights_coeffs[i][2];
+            intensity /= 127.0f;
+            if (intensity > 0.0f) {
+                r += intensity * lights[i].col[0];
+                g += intensity * lights[i].col[1];
+                b += intensity * lights[i].col[2];
+            }
+        }
+
+        d->color.r = r > 255 ? 255 : r;
+        d->color.g = g > 255 ? 255 : g;
+        d->color.b = b > 255 ? 255 : b;
+
+        if (state->geometry_mode & G_TEXTURE_GEN) {
+            calculate_texture_gen(vn, state, U, V);
+        }
+    } else {
+        d->color.r = v->cn[0];
+        d->color.g = v->cn[1];
+        d->color.b = v->cn[2];
+    }
+
+    d->u = U;
+    d->v = V;
+
+    // trivial clip rejection
+    d->clip_rej = 0;
+    if (x < -w) {
+        d->clip_rej |= CLIP_LEFT;
+    }
+    if (x > w) {
+        d->clip_rej |= CLIP_RIGHT;
+    }
+    if (y < -w) {
+        d->clip_rej |= CLIP_BOTTOM;
+    }
+    if (y > w) {
+        d->clip_rej |= CLIP_TOP;
+    }
+    // if (z < -w) d->clip_rej |= 16; // CLIP_NEAR
+    if (z > w) {
+        d->clip_rej |= CLIP_FAR;
+    }
+
+    d->x = x;
+    d->y = y;
+    d->z = z;
+    d->w = w;
+
+    if (state->geometry_mode & G_FOG) {
+        if (fabsf(w) < 0.001f) {
+            // To avoid division by zero
+            w = 0.001f;
+        }
+
+        float winv = 1.0f / w;
+        if (winv < 0.0f) {
+            winv = std::numeric_limits<int16_t>::max();
+        }
+
+        float fog_z = z * winv * state->fog_mul + state->fog_offset;
+        fog_z = Ship::Math::clamp(fog_z, 0.0f, 255.0f);
+        d->color.a = fog_z; // Use alpha variable to store fog factor
+    } else {
+        d->color.a = v->cn[3];
+    }
+}
+
+void gfx_transform_vertices_scalar(LoadedVertex* dst, const Vtx* src, size_t count,
+                                   const GfxVertexTransformState* state) {
+    for (size_t i = 0; i < count; i++) {
+        transform_vertex(&dst[i], &src[i], state);
+    }
+}
+
+#if defined(VERTEX_TRANSFORM_SSE2) || defined(VERTEX_TRANSFORM_NEON)
+// The 4-wide path below is written against these few operations. Each one maps to a single IEEE operation so the
+// results match the scalar path exactly; compares and selects are spelled out instead of using min/max so that NaNs
+// are handled the same way as the ternaries in transform_vertex.
+#if defined(VERTEX_TRANSFORM_SSE2)
+typedef __m128 vfloat;
+
+static inline vfloat vf_load(const float* p) {
+    return _mm_loadu_ps(p);
+}
+static inline void vf_store(float* p, vfloat a) {
+    _mm_storeu_ps(p, a);
+}
+static inline vfloat vf_set1(float f) {
+    return _mm_set1_ps(f);
+}
+static inline vfloat vf_add(vfloat a, vfloat b) {
+    return _mm_add_ps(a, b);
+}
+static inline vfloat vf_mul(vfloat a, vfloat b) {
+    return _mm_mul_ps(a, b);
+}
+static inline vfloat vf_div(vfloat a, vfloat b) {
+    return _mm_div_ps(a, b);
+}
+static inline vfloat vf_neg(vfloat a) {
+    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+static inline vfloat vf_abs(vfloat a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+}
+static inline vfloat vf_lt(vfloat a, vfloat b) {
+    return _mm_cmplt_ps(a, b);
+}
+static inline vfloat vf_gt(vfloat a, vfloat b) {
+    return _mm_cmpgt_ps(a, b);
+}
+// mask ? a : b
+static inline vfloat vf_select(vfloat mask, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+// Rounds toward zero, like a float to int conversion. Only valid for values that fit in an int32_t.
+static inline vfloat vf_trunc(vfloat a) {
+    return _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+}
+static inline void vf_store_int(int32_t* p, vfloat a) {
+    _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(a));
+}
+static inline int vf_mask_bits(vfloat mask) {
+    return _mm_movemask_ps(mask);
+}
+#elif defined(VERTEX_TRANSFORM_NEON)
+typedef float32x4_t vfloat;
+
+static inline vfloat vf_load(const float* p) {
+    return vld1q_f32(p);
+}
+static inline void vf_store(float* p, vfloat a) {
+    vst1q_f32(p, a);
+}
+static inline vfloat vf_set1(float f) {
+    return vdupq_n_f32(f);
+}
+static inline vfloat vf_add(vfloat a, vfloat b) {
+    return vaddq_f32(a, b);
+}
+static inline vfloat vf_mul(vfloat a, vfloat b) {
+    return vmulq_f32(a, b);
+}
+static inline vfloat vf_div(vfloat a, vfloat b) {
+    return vdivq_f32(a, b);
+}
+static inline vfloat vf_neg(vfloat a) {
+    return vnegq_f32(a);
+}
+static inline vfloat vf_abs(vfloat a) {
+    return vabsq_f32(a);
+}
+static inline vfloat vf_lt(vfloat a, vfloat b) {
+    return vreinterpretq_f32_u32(vcltq_f32(a, b));
+}
+static inline vfloat vf_gt(vfloat a, vfloat b) {
+    return vreinterpretq_f32_u32(vcgtq_f32(a, b));
+}
+static inline vfloat vf_select(vfloat mask, vfloat a, vfloat b) {
+    return vbslq_f32(vreinterpretq_u32_f32(mask), a, b);
+}
+static inline vfloat vf_trunc(vfloat a) {
+    return vcvtq_f32_s32(vcvtq_s32_f32(a));
+}
+static inline void vf_store_int(int32_t* p, vfloat a) {
+    vst1q_s32(p, vcvtq_s32_f32(a));
+}
+static inline int vf_mask_bits(vfloat mask) {
+    static const uint32_t weights[4] = { 1, 2, 4, 8 };
+    return vaddvq_u32(vandq_u32(vreinterpretq_u32_f32(mask), vld1q_u32(weights)));
+}
+#endif
+
+static inline int lane_bit(int bits, int lane, int flag) {
+    return (bits >> lane) & 1 ? flag : 0;
+}
+
+// Transforms four vertices at once. Every lane goes through exactly the operations transform_vertex does, in the same
+// order; only texture coordinate generation, which needs acosf, stays per vertex.
+static void transform_vertices4(LoadedVertex* d, const Vtx* src, const GfxVertexTransformState* state,
+                                const vfloat mp[4][4]) {
+    float obx[4], oby[4], obz[4];
+    for (int l = 0; l < 4; l++) {
+        obx[l] = src[l].v.ob[0];
+        oby[l] = src[l].v.ob[1];
+        obz[l] = src[l].v.ob[2];
+    }
+    vfloat ox = vf_load(obx), oy = vf_load(oby), oz = vf_load(obz);
+
+    vfloat x = vf_add(vf_add(vf_add(vf_mul(ox, mp[0][0]), vf_mul(oy, mp[1][0])), vf_mul(oz, mp[2][0])), mp[3][0]);
+    vfloat y = vf_add(vf_add(vf_add(vf_mul(ox, mp[0][1]), vf_mul(oy, mp[1][1])), vf_mul(oz, mp[2][1])), mp[3][1]);
+    vfloat z = vf_add(vf_add(vf_add(vf_mul(ox, mp[0][2]), vf_mul(oy, mp[1][2])), vf_mul(oz, mp[2][2])), mp[3][2]);
+    vfloat w = vf_add(vf_add(vf_add(vf_mul(ox, mp[0][3]), vf_mul(oy, mp[1][3])), vf_mul(oz, mp[2][3])), mp[3][3]);
+
+    if (state->adjust_x_for_aspect_ratio) {
+        x = vf_div(vf_mul(x, vf_set1(4.0f / 3.0f)), vf_set1(state->aspect_ratio));
+    }
+
+    bool lighting = (state->geometry_mode & G_LIGHTING) != 0;
+    int32_t r[4], g[4], b[4];
+    if (lighting) {
+        float nx[4], ny[4], nz[4];
+        for (int l = 0; l < 4; l++) {
+            nx[l] = src[l].n.n[0];
+            ny[l] = src[l].n.n[1];
+            nz[l] = src[l].n.n[2];
+        }
+        vfloat n0 = vf_load(nx), n1 = vf_load(ny), n2 = vf_load(nz);
+        const Light_t* lights = state->lights;
+        int num_lights = state->num_lights;
+
+        // The color channels are ints in transform_vertex. They stay small integers here, which floats hold exactly.
+        vfloat vr = vf_set1(lights[num_lights - 1].col[0]);
+        vfloat vg = vf_set1(lights[num_lights - 1].col[1]);
+        vfloat vb = vf_set1(lights[num_lights - 1].col[2]);
+        const vfloat zero = vf_set1(0.0f);
+
+        for (int i = 0; i < num_lights - 1; i++) {
+            vfloat intensity = zero;
+            intensity = vf_add(intensity, vf_mul(n0, vf_set1(state->lights_coeffs[i][0])));
+            intensity = vf_add(intensity, vf_mul(n1, vf_set1(state->lights_coeffs[i][1])));
+            intensity = vf_add(intensity, vf_mul(n2, vf_set1(state->lights_coeffs[i][2])));
+            intensity = vf_div(intensity, vf_set1(127.0f));
+            vfloat lit = vf_gt(intensity, zero);
+            vr = vf_select(lit, vf_trunc(vf_add(vr, vf_mul(intensity, vf_set1(lights[i].col[0])))), vr);
+            vg = vf_select(lit, vf_trunc(vf_add(vg, vf_mul(intensity, vf_set1(lights[i].col[1])))), vg);
+            vb = vf_select(lit, vf_trunc(vf_add(vb, vf_mul(intensity, vf_set1(lights[i].col[2])))), vb);
+        }
+
+        const vfloat max_channel = vf_set1(255.0f);
+        vf_store_int(r, vf_select(vf_gt(vr, max_channel), max_channel, vr));
+        vf_store_int(g, vf_select(vf_gt(vg, max_channel), max_channel, vg));
+        vf_store_int(b, vf_select(vf_gt(vb, max_channel), max_channel, vb));
+    }
+
+    vfloat neg_w = vf_neg(w);
+    int clip_left = vf_mask_bits(vf_lt(x, neg_w));
+    int clip_right = vf_mask_bits(vf_gt(x, w));
+    int clip_bottom = vf_mask_bits(vf_lt(y, neg_w));
+    int clip_top = vf_mask_bits(vf_gt(y, w));
+    int clip_far = vf_mask_bits(vf_gt(z, w));
+
+    bool fog = (state->geometry_mode & G_FOG) != 0;
+    int32_t fog_factor[4];
+    if (fog) {
+        // To avoid division by zero
+        vfloat min_w = vf_set1(0.001f);
+        vfloat fog_w = vf_select(vf_lt(vf_abs(w), min_w), min_w, w);
+        vfloat winv = vf_div(vf_set1(1.0f), fog_w);
+        winv = vf_select(vf_lt(winv, vf_set1(0.0f)), vf_set1(std::numeric_limits<int16_t>::max()), winv);
+
+        vfloat fog_z = vf_add(vf_mul(vf_mul(z, winv), vf_set1(state->fog_mul)), vf_set1(state->fog_offset));
+        fog_z = vf_select(vf_lt(fog_z, vf_set1(0.0f)), vf_set1(0.0f), fog_z);
+        fog_z = vf_select(vf_gt(fog_z, vf_set1(255.0f)), vf_set1(255.0f), fog_z);
+        vf_store_int(fog_factor, fog_z);
+    }
+
+    float xs[4], ys[4], zs[4], ws[4];
+    vf_store(xs, x);
+    vf_store(ys, y);
+    vf_store(zs, z);
+    vf_store(ws, w);
+
+    for (int l = 0; l < 4; l++) {
+        const Vtx_t* v = &src[l].v;
+        LoadedVertex* dl = &d[l];
+
+        short U = v->tc[0] * state->texture_scaling_s >> 16;
+        short V = v->tc[1] * state->texture_scaling_t >> 16;
+
+        if (lighting) {
+            dl->color.r = r[l];
+            dl->color.g = g[l];
+            dl->color.b = b[l];
+            if (state->geometry_mode & G_TEXTURE_GEN) {
+                calculate_texture_gen(&src[l].n, state, U, V);
+            }
+        } else {
+            dl->color.r = v->cn[0];
+            dl->color.g = v->cn[1];
+            dl->color.b = v->cn[2];
+        }
+        dl->color.a = fog ? fog_factor[l] : v->cn[3];
+
+        dl->u = U;
+        dl->v = V;
+        dl->clip_rej = lane_bit(clip_left, l, CLIP_LEFT) | lane_bit(clip_right, l, CLIP_RIGHT) |
+                       lane_bit(clip_bottom, l, CLIP_BOTTOM) | lane_bit(clip_top, l, CLIP_TOP) |
+                       lane_bit(clip_far, l, CLIP_FAR);
+        dl->x = xs[l];
+        dl->y = ys[l];
+        dl->z = zs[l];
+        dl->w = ws[l];
+    }
+}
+#endif
+
+void gfx_transform_vertices(LoadedVertex* dst, const Vtx* src, size_t count, const GfxVertexTransformState* state) {
+    size_t i = 0;
+#if defined(VERTEX_TRANSFORM_SSE2) || defined(VERTEX_TRANSFORM_NEON)
+    if (count >= 4) {
+        vfloat mp[4][4];
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                mp[row][col] = vf_set1(state->mp_matrix[row][col]);
+            }
+        }
+        for (; i + 4 <= count; i += 4) {
+            transform_vertices4(&dst[i], &src[i], state, mp);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        transform_vertex(&dst[i], &src[i], state);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef GFX_VERTEX_TRANSFORM_H
+#define GFX_VERTEX_TRANSFORM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libultraship/libultra/gbi.h"
+
+struct RGBA {
+    uint8_t r, g, b, a;
+};
+
+struct LoadedVertex {
+    float x, y, z, w;
+    float u, v;
+    struct RGBA color;
+    uint8_t clip_rej;
+};
+
+// The parts of the RSP state that G_VTX reads. lights_coeffs and lookat_coeffs must already be up to date for the
+// current modelview matrix when G_LIGHTING is set.
+struct GfxVertexTransformState {
+    const float (*mp_matrix)[4];
+    bool adjust_x_for_aspect_ratio;
+    float aspect_ratio;
+
+    uint32_t geometry_mode;
+    uint8_t num_lights; // includes ambient light
+    const Light_t* lights;
+    const float (*lights_coeffs)[3];
+    const float (*lookat_coeffs)[3];
+
+    uint16_t texture_scaling_s, texture_scaling_t;
+    int16_t fog_mul, fog_offset;
+};
+
+// Transforms, lights and clip classifies count vertices into dst. Vertices are processed four at a time with SSE2 or
+// AArch64 NEON where available, giving the same results as the scalar path bit for bit.
+void gfx_transform_vertices(struct LoadedVertex* dst, const Vtx* src, size_t count,
+                            const struct GfxVertexTransformState* state);
+
+// Transforms every vertex with the scalar path only. Used to check the vector path against.
+void gfx_transform_vertices_scalar(struct LoadedVertex* dst, const Vtx* src, size_t count,
+                                   const struct GfxVertexTransformState* state);
+
+#endif
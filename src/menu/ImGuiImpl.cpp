@@ -19,6 +19,7 @@
 #include "core/bridge/consolevariablebridge.h"
 #include "menu/GameOverlay.h"
 #include "resource/type/Texture.h"
+#include "graphic/Fast3D/gfx_command_buffer.h"
 #include "graphic/Fast3D/gfx_pc.h"
 #include "resource/OtrFile.h"
 #include <stb/stb_image.h>
@@ -253,6 +254,13 @@ void ImGuiBackendInit() {
                                 static_cast<ID3D11DeviceContext*>(impl.Dx11.DeviceContext));
             break;
 #endif
+        case Backend::HEADLESS: {
+            // Nothing is drawn, but ImGui still needs a built font atlas to lay out frames
+            unsigned char* pixels;
+            int width, height;
+            io->Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+            break;
+        }
         default:
             break;
     }
@@ -328,6 +336,10 @@ void ImGuiBackendNewFrame() {
             ImGui_ImplDX11_NewFrame();
             break;
 #endif
+        case Backend::HEADLESS:
+            io->DisplaySize = ImVec2(impl.Headless.Width, impl.Headless.Height);
+            io->DeltaTime = 1.0f / 60.0f;
+            break;
         default:
             break;
     }
@@ -692,6 +704,33 @@ void DrawMainMenuAndCalculateGameSize(void) {
         ImGui::Text("Platform: Unknown");
 #endif
         ImGui::Text("Status: %.3f ms/frame (%.1f FPS)", 1000.0f / framerate, framerate);
+        const GfxTextureDecodeStats* decodeStats = gfx_get_texture_decode_stats();
+        ImGui::Text("Texture decodes: %u (%u async), %.2f ms, %.2f ms waited", decodeStats->decodes,
+                    decodeStats->async_decodes, decodeStats->decode_ms, decodeStats->wait_ms);
+        const GfxTextureCacheStats* cacheStats = gfx_get_texture_cache_stats();
+        ImGui::Text("Texture cache: %u hits, %u shared, %u misses, %u evicted", cacheStats->hits,
+                    cacheStats->content_hits, cacheStats->misses, cacheStats->evictions);
+        ImGui::Text("Shared textures: %u, %.1f MB", cacheStats->textures,
+                    cacheStats->resident_bytes / (1024.0 * 1024.0));
+        const GfxRetainedMeshStats* meshStats = gfx_get_retained_mesh_stats();
+        ImGui::Text("Retained meshes: %u replayed, %u recorded, %u fell back", meshStats->replays,
+                    meshStats->captures, meshStats->fallbacks);
+        ImGui::Text("Retained mesh memory: %u meshes, %.1f MB", meshStats->meshes,
+                    meshStats->mesh_bytes / (1024.0 * 1024.0));
+        const GfxCompiledDisplayListStats* dlStats = gfx_get_compiled_display_list_stats();
+        ImGui::Text("Compiled display lists: %u run, %u compiled, %u interpreted", dlStats->runs, dlStats->compiles,
+                    dlStats->interpreted);
+        const GfxRenderStateStats* stateStats = gfx_get_render_state_stats();
+        ImGui::Text("Flushes: %u (%u under 4 triangles), %u avoided, %u rectangles", stateStats->flushes,
+                    stateStats->small_flushes, stateStats->avoided_flushes, stateStats->rectangles);
+        const GfxSubmissionStats* submissionStats = gfx_get_submission_stats();
+        ImGui::Text("Threaded submission: %u calls, %u syncs, %.2f ms waited", submissionStats->commands,
+                    submissionStats->syncs, submissionStats->wait_ms);
+        const std::shared_ptr<ResourceMgr> resourceMgr = Window::GetInstance()->GetResourceManager();
+        ImGui::Text("Queued loads: %zu blocking, %zu prefetch, %zu background",
+                    resourceMgr->GetLoadQueueDepth(ResourceLoadPriority::RenderBlocking),
+                    resourceMgr->GetLoadQueueDepth(ResourceLoadPriority::Prefetch),
+                    resourceMgr->GetLoadQueueDepth(ResourceLoadPriority::Background));
         ImGui::End();
         ImGui::PopStyleColor();
     }
@@ -19,6 +19,7 @@ enum class Backend {
     SDL_OPENGL,
     SDL_METAL,
     GX2,
+    HEADLESS,
 };
 
 enum class Dialogues {
@@ -47,6 +48,10 @@ typedef struct {
             uint32_t Width;
             uint32_t Height;
         } Gx2;
+        struct {
+            uint32_t Width;
+            uint32_t Height;
+        } Headless;
     };
 } WindowImpl;
 
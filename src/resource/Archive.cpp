@@ -75,6 +75,7 @@ std::shared_ptr<OtrFile> Archive::LoadFileFromHandle(const std::string& filePath
         mpqHandle = mMainMpq;
     }
 
+    const std::lock_guard<std::mutex> lock(mReadMutex);
     bool attempt = SFileOpenFileEx(mpqHandle, filePath.c_str(), 0, &fileHandle);
 
     if (!attempt) {
@@ -246,6 +247,10 @@ const std::string* Archive::HashToString(uint64_t hash) const {
     return it != mHashes.end() ? &it->second : nullptr;
 }
 
+size_t Archive::GetHashCount() const {
+    return mHashes.size();
+}
+
 bool Archive::Load(bool enableWriting, bool generateCrcMap) {
     return LoadMainMPQ(enableWriting, generateCrcMap) && LoadPatchMPQs();
 }
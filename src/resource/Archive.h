@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <string>
 #include <vector>
@@ -37,6 +38,7 @@ class Archive : public std::enable_shared_from_this<Archive> {
     std::vector<SFILE_FIND_DATA> ListFiles(const std::string& searchMask) const;
     bool HasFile(const std::string& searchMask) const;
     const std::string* HashToString(uint64_t hash) const;
+    size_t GetHashCount() const;
     std::vector<uint32_t> GetGameVersions();
     void PushGameVersion(uint32_t newGameVersion);
 
@@ -54,6 +56,8 @@ class Archive : public std::enable_shared_from_this<Archive> {
     std::vector<uint32_t> mGameVersions;
     std::unordered_map<uint64_t, std::string> mHashes;
     HANDLE mMainMpq;
+    // StormLib handles can not be read from by several loader threads at once
+    std::mutex mReadMutex;
 
     bool LoadMainMPQ(bool enableWriting, bool generateCrcMap);
     bool LoadPatchMPQs();
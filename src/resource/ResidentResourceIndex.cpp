@@ -0,0 +1,88 @@
+#include "ResidentResourceIndex.h"
+
+namespace Ship {
+
+ResidentResourceIndex::ResidentResourceIndex(size_t expectedEntries) : mUsedSlots(0) {
+    // Keep the table at most three quarters full so that probe chains stay short.
+    size_t capacity = 1024;
+    while (capacity < expectedEntries + expectedEntries / 3) {
+        capacity <<= 1;
+    }
+
+    mSlots = std::make_unique<Slot[]>(capacity);
+    mMask = capacity - 1;
+    mMaxUsedSlots = capacity - capacity / 4;
+}
+
+uint64_t ResidentResourceIndex::NormalizeHash(uint64_t hash) {
+    return hash == 0 ? ~0ULL : hash;
+}
+
+Resource* ResidentResourceIndex::Find(uint64_t hash) const {
+    hash = NormalizeHash(hash);
+
+    for (size_t i = hash & mMask;; i = (i + 1) & mMask) {
+        const uint64_t slotHash = mSlots[i].Hash.load(std::memory_order_acquire);
+
+        if (slotHash == hash) {
+            return mSlots[i].Value.load(std::memory_order_acquire);
+        }
+
+        // The table is never full, so every probe is guaranteed to end on an empty slot.
+        if (slotHash == 0) {
+            return nullptr;
+        }
+    }
+}
+
+bool ResidentResourceIndex::Insert(uint64_t hash, Resource* resource) {
+    hash = NormalizeHash(hash);
+
+    for (size_t i = hash & mMask;; i = (i + 1) & mMask) {
+        const uint64_t slotHash = mSlots[i].Hash.load(std::memory_order_relaxed);
+
+        if (slotHash == hash) {
+            mSlots[i].Value.store(resource, std::memory_order_release);
+            return true;
+        }
+
+        if (slotHash == 0) {
+            if (mUsedSlots >= mMaxUsedSlots) {
+                // Out of room. Callers still have the string keyed cache to fall back on.
+                return false;
+            }
+
+            // Publish the value before the key so a reader that sees the key also sees the value.
+            mSlots[i].Value.store(resource, std::memory_order_relaxed);
+            mSlots[i].Hash.store(hash, std::memory_order_release);
+            mUsedSlots++;
+            return true;
+        }
+    }
+}
+
+void ResidentResourceIndex::Remove(uint64_t hash) {
+    hash = NormalizeHash(hash);
+
+    for (size_t i = hash & mMask;; i = (i + 1) & mMask) {
+        const uint64_t slotHash = mSlots[i].Hash.load(std::memory_order_relaxed);
+
+        if (slotHash == hash) {
+            mSlots[i].Value.store(nullptr, std::memory_order_release);
+            return;
+        }
+
+        if (slotHash == 0) {
+            return;
+        }
+    }
+}
+
+void ResidentResourceIndex::Clear() {
+    // Keys are kept so that a reader racing with the clear still walks valid probe chains.
+    for (size_t i = 0; i <= mMask; i++) {
+        mSlots[i].Value.store(nullptr, std::memory_order_release);
+    }
+}
+
+} // namespace Ship
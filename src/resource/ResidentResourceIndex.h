@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+namespace Ship {
+class Resource;
+
+// Fixed capacity open addressing table mapping the CRC64 of a resource path to the resident resource. Lookups are
+// lock-free so the display list interpreter can resolve OTR references without going through the string keyed cache.
+// Writers must be serialized externally (ResourceMgr does this under its cache mutex). Entries are never moved: removing
+// a resource only clears its value, which leaves the key behind as a tombstone so probe chains stay intact.
+class ResidentResourceIndex {
+  public:
+    ResidentResourceIndex(size_t expectedEntries);
+
+    Resource* Find(uint64_t hash) const;
+    bool Insert(uint64_t hash, Resource* resource);
+    void Remove(uint64_t hash);
+    void Clear();
+
+  private:
+    struct Slot {
+        std::atomic<uint64_t> Hash = 0;
+        std::atomic<Resource*> Value = nullptr;
+    };
+
+    // Zero marks an empty slot, so a path hashing to zero is stored under this key instead.
+    static uint64_t NormalizeHash(uint64_t hash);
+
+    std::unique_ptr<Slot[]> mSlots;
+    size_t mMask;
+    size_t mUsedSlots;
+    size_t mMaxUsedSlots;
+};
+} // namespace Ship
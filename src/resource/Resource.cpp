@@ -3,8 +3,17 @@
 #include "resource/ResourceMgr.h"
 #include <spdlog/spdlog.h>
 #include "libultraship/libultra/gbi.h"
+#include <StrHash64.h>
 
 namespace Ship {
+// Notes that the instructions of a display list were patched or reverted in place, so that what the renderer compiled
+// from them is compiled again
+static void DisplayListChanged(Resource* res) {
+    if (res->Type == ResourceType::DisplayList) {
+        static_cast<DisplayList*>(res)->Revision++;
+    }
+}
+
 void Resource::RegisterResourceAddressPatch(uint64_t crc, uint32_t instructionIndex, intptr_t originalData) {
     ResourceAddressPatch patch;
     patch.ResourceCrc = crc;
@@ -12,10 +21,19 @@ void Resource::RegisterResourceAddressPatch(uint64_t crc, uint32_t instructionIn
     patch.OriginalData = originalData;
 
     Patches.push_back(patch);
+    DisplayListChanged(this);
 }
 
 Resource::~Resource() {
+    uint64_t ownCrc = CRC64(Path.c_str());
+
     for (size_t i = 0; i < Patches.size(); i++) {
+        // A patch to this resource's own instructions only ever applied to this instance. Those instructions have
+        // already been destroyed with the derived class, and the instance of the same path cached now has its own.
+        if (Patches[i].ResourceCrc == ownCrc) {
+            continue;
+        }
+
         const std::string* hashStr = ResourceManager->HashToString(Patches[i].ResourceCrc);
         if (hashStr == nullptr) {
             continue;
@@ -27,6 +45,7 @@ Resource::~Resource() {
 
             Gfx* gfx = &((Gfx*)res->Instructions.data())[Patches[i].InstructionIndex];
             gfx->words.w1 = Patches[i].OriginalData;
+            DisplayListChanged(res);
         }
     }
 
@@ -3,7 +3,7 @@
 #include "ResourceMgr.h"
 #include "Resource.h"
 #include "OtrFile.h"
-#include "binarytools/MemoryStream.h"
+#include "binarytools/MemorySpanStream.h"
 #include "binarytools/BinaryReader.h"
 #include "factory/TextureFactory.h"
 #include "factory/VertexFactory.h"
@@ -11,6 +11,7 @@
 #include "factory/BlobFactory.h"
 #include "factory/DisplayListFactory.h"
 #include "factory/MatrixFactory.h"
+#include "type/Texture.h"
 
 namespace Ship {
 ResourceLoader::ResourceLoader(std::shared_ptr<Window> context) : mContext(context) {
@@ -35,6 +36,14 @@ bool ResourceLoader::RegisterResourceFactory(ResourceType resourceType, std::sha
     return true;
 }
 
+void ResourceLoader::SetPredecodeTextures(bool predecode) {
+    mPredecodeTextures = predecode;
+}
+
+bool ResourceLoader::GetPredecodeTextures() {
+    return mPredecodeTextures;
+}
+
 std::shared_ptr<Window> ResourceLoader::GetContext() {
     return mContext;
 }
@@ -43,7 +52,8 @@ std::shared_ptr<Resource> ResourceLoader::LoadResource(std::shared_ptr<OtrFile>
     std::shared_ptr<Resource> result = nullptr;
 
     if (fileToLoad != nullptr) {
-        auto stream = std::make_shared<MemoryStream>(fileToLoad->Buffer.data(), fileToLoad->Buffer.size());
+        // Parse straight out of the archive buffer. fileToLoad outlives the reader, so nothing needs to be copied.
+        auto stream = std::make_shared<MemorySpanStream>(fileToLoad->Buffer.data(), fileToLoad->Buffer.size());
         auto reader = std::make_shared<BinaryReader>(stream);
 
         // OTR HEADER BEGIN
@@ -72,6 +82,12 @@ std::shared_ptr<Resource> ResourceLoader::LoadResource(std::shared_ptr<OtrFile>
             result->Type = resourceType;
             result->Path = fileToLoad->Path;
             result->ResourceManager = GetContext()->GetResourceManager();
+
+            // Resources are loaded on the resource manager's worker threads, so converting textures to RGBA32 here
+            // keeps the conversion out of frame time.
+            if (resourceType == ResourceType::Texture && mPredecodeTextures) {
+                std::static_pointer_cast<Texture>(result)->DecodeImageData();
+            }
         } else {
             if (fileToLoad != nullptr) {
                 SPDLOG_ERROR("Failed to load resource of type {} \"{}\"", (uint32_t)resourceType, fileToLoad->Path);
@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <unordered_map>
+#include <atomic>
 #include "ResourceType.h"
 #include "ResourceFactory.h"
 #include "Resource.h"
@@ -17,6 +18,8 @@ class ResourceLoader {
     std::shared_ptr<Window> GetContext();
     std::shared_ptr<Resource> LoadResource(std::shared_ptr<OtrFile> fileToLoad);
     bool RegisterResourceFactory(ResourceType resourceType, std::shared_ptr<ResourceFactory> factory);
+    void SetPredecodeTextures(bool predecode);
+    bool GetPredecodeTextures();
 
   protected:
     void RegisterGlobalResourceFactories();
@@ -24,5 +27,6 @@ class ResourceLoader {
   private:
     std::shared_ptr<Window> mContext;
     std::unordered_map<ResourceType, std::shared_ptr<ResourceFactory>> mFactories;
+    std::atomic<bool> mPredecodeTextures = false;
 };
 } // namespace Ship
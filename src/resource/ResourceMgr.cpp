@@ -3,24 +3,31 @@
 #include "OtrFile.h"
 #include "Archive.h"
 #include "GameVersions.h"
+#include "type/DisplayList.h"
 #include <algorithm>
 #include <thread>
 #include <Utils/StringHelper.h>
 #include <StormLib.h>
+#include <StrHash64.h>
 
 namespace Ship {
 
+// One loader per core the render thread is not using
+static size_t DefaultLoaderThreadCount() {
+#if defined(__SWITCH__) || defined(__WIIU__)
+    return 1;
+#else
+    return std::max(2U, std::thread::hardware_concurrency()) - 1;
+#endif
+}
+
 ResourceMgr::ResourceMgr(std::shared_ptr<Window> context, const std::string& mainPath, const std::string& patchesPath,
                          const std::unordered_set<uint32_t>& validHashes)
     : mContext(context) {
     mResourceLoader = std::make_shared<ResourceLoader>(context);
     mArchive = std::make_shared<Archive>(mainPath, patchesPath, validHashes, false);
-#if defined(__SWITCH__) || defined(__WIIU__)
-    size_t threadCount = 1;
-#else
-    size_t threadCount = std::min(1U, std::thread::hardware_concurrency() - 1);
-#endif
-    mThreadPool = std::make_shared<BS::thread_pool>(threadCount);
+    mResidentIndex = std::make_unique<ResidentResourceIndex>(mArchive->GetHashCount());
+    mThreadPool = std::make_shared<BS::thread_pool>(DefaultLoaderThreadCount());
 
     if (!DidLoadSuccessfully()) {
         // Nothing ever unpauses the thread pool since nothing will ever try to load the archive again.
@@ -33,12 +40,8 @@ ResourceMgr::ResourceMgr(std::shared_ptr<Window> context, const std::vector<std:
     : mContext(context) {
     mResourceLoader = std::make_shared<ResourceLoader>(context);
     mArchive = std::make_shared<Archive>(otrFiles, validHashes, false);
-#if defined(__SWITCH__) || defined(__WIIU__)
-    size_t threadCount = 1;
-#else
-    size_t threadCount = std::min(1U, std::thread::hardware_concurrency() - 1);
-#endif
-    mThreadPool = std::make_shared<BS::thread_pool>(threadCount);
+    mResidentIndex = std::make_unique<ResidentResourceIndex>(mArchive->GetHashCount());
+    mThreadPool = std::make_shared<BS::thread_pool>(DefaultLoaderThreadCount());
 
     if (!DidLoadSuccessfully()) {
         // Nothing ever unpauses the thread pool since nothing will ever try to load the archive again.
@@ -50,6 +53,49 @@ ResourceMgr::~ResourceMgr() {
     SPDLOG_INFO("destruct ResourceMgr");
 }
 
+// Sets how many threads load resources, or restores the default of one per core but one when threadCount is 0
+void ResourceMgr::SetLoaderThreadCount(size_t threadCount) {
+    mThreadPool->reset(threadCount != 0 ? threadCount : DefaultLoaderThreadCount());
+}
+
+size_t ResourceMgr::GetLoadQueueDepth(ResourceLoadPriority priority) {
+    const std::lock_guard<std::mutex> lock(mLoadQueueMutex);
+    return mLoadQueues[(size_t)priority].size();
+}
+
+template <typename T>
+std::shared_future<T> ResourceMgr::QueueLoad(ResourceLoadPriority priority, std::function<T()> load) {
+    auto task = std::make_shared<std::packaged_task<T()>>(std::move(load));
+    auto future = task->get_future().share();
+
+    {
+        const std::lock_guard<std::mutex> lock(mLoadQueueMutex);
+        mLoadQueues[(size_t)priority].push([task] { (*task)(); });
+    }
+    mThreadPool->push_task(&ResourceMgr::RunNextLoad, this);
+
+    return future;
+}
+
+void ResourceMgr::RunNextLoad() {
+    std::function<void()> load;
+
+    {
+        const std::lock_guard<std::mutex> lock(mLoadQueueMutex);
+        for (auto& queue : mLoadQueues) {
+            if (!queue.empty()) {
+                load = std::move(queue.front());
+                queue.pop();
+                break;
+            }
+        }
+    }
+
+    if (load) {
+        load();
+    }
+}
+
 bool ResourceMgr::DidLoadSuccessfully() {
     return mArchive != nullptr && mArchive->IsMainMPQValid();
 }
@@ -65,9 +111,13 @@ std::shared_ptr<OtrFile> ResourceMgr::LoadFileProcess(const std::string& fileToL
 }
 
 std::shared_ptr<Resource> ResourceMgr::LoadResourceProcess(const std::string& fileToLoad) {
+    return LoadResourceAndPrefetch(fileToLoad, DISPLAY_LIST_PREFETCH_DEPTH);
+}
+
+std::shared_ptr<Resource> ResourceMgr::LoadResourceAndPrefetch(const std::string& fileToLoad, uint32_t prefetchDepth) {
     if (OtrSignatureCheck(fileToLoad.c_str())) {
         auto newFilePath = fileToLoad.substr(7);
-        return LoadResourceProcess(newFilePath);
+        return LoadResourceAndPrefetch(newFilePath, prefetchDepth);
     }
 
     // While waiting in the queue, another thread could have loaded the resource.
@@ -79,14 +129,30 @@ std::shared_ptr<Resource> ResourceMgr::LoadResourceProcess(const std::string& fi
 
     auto file = LoadFileProcess(fileToLoad);
     auto resource = GetResourceLoader()->LoadResource(file);
-    auto cachedResource = GetCachedResource(fileToLoad);
+    if (resource != nullptr && resource->Type == ResourceType::DisplayList) {
+        LinkDisplayList(std::static_pointer_cast<DisplayList>(resource), CRC64(fileToLoad.c_str()));
+        PrefetchDisplayListChildren(std::static_pointer_cast<DisplayList>(resource), prefetchDepth);
+    }
+
+    // Resource destructors look other resources up in the cache, so a replaced dirty resource must outlive the lock.
+    std::shared_ptr<Resource> replaced;
 
     {
         // Another thread could have loaded the resource while we were processing, so we want to check before setting to
         // the cache.
         const std::lock_guard<std::mutex> lock(mMutex);
-        if (cachedResource == nullptr) {
-            mResourceCache[fileToLoad] = resource;
+        auto& shard = GetResourceCacheShard(fileToLoad);
+        auto shardLock = LockExclusive(shard);
+        auto& cachedResource = shard.Resources[fileToLoad];
+
+        if (cachedResource == nullptr || cachedResource->IsDirty) {
+            replaced = std::move(cachedResource);
+            cachedResource = resource;
+            if (resource != nullptr) {
+                mResidentIndex->Insert(CRC64(fileToLoad.c_str()), resource.get());
+            } else if (replaced != nullptr) {
+                mResidentIndex->Remove(CRC64(fileToLoad.c_str()));
+            }
         } else {
             // If another thread has already loaded this resource, discard the work we already did and return from
             // cache.
@@ -103,6 +169,113 @@ std::shared_ptr<Resource> ResourceMgr::LoadResourceProcess(const std::string& fi
     return resource;
 }
 
+// Resolves the OTR references of a display list that has just loaded, before the renderer can see it. Vertex and
+// texture commands get the address of their data written into w1, recorded as patches like the ones gfx_run_dl makes.
+// Matrix commands have no word to hold it, but their resources are loaded so the renderer finds them resident.
+void ResourceMgr::LinkDisplayList(std::shared_ptr<DisplayList> displayList, uint64_t crc) {
+    auto& instructions = displayList->Instructions;
+    std::vector<std::pair<size_t, uint64_t>> references;
+
+    for (size_t i = 0; i + 1 < instructions.size(); i++) {
+        uint8_t opcode = (uint8_t)(instructions[i].words.w0 >> 24);
+
+        if (opcode == G_VTX_OTR || opcode == G_SETTIMG_OTR || opcode == G_MTX_OTR) {
+            references.emplace_back(i, ((uint64_t)instructions[i + 1].words.w0 << 32) + instructions[i + 1].words.w1);
+        }
+        if (opcode == G_SETTIMG_OTR || opcode == G_DL_OTR || opcode == G_VTX_OTR || opcode == G_BRANCH_Z_OTR ||
+            opcode == G_MARKER || opcode == G_MTX_OTR) {
+            i++;
+        }
+    }
+
+    // Queue everything first so idle workers load the resources this one has not got to yet. This one then loads the
+    // rest itself, claiming each before a worker starts it, and waits only for the loads a worker has already started.
+    // Those are vertices, textures and matrices, which link nothing, so waiting for them can not deadlock.
+    struct LinkLoad {
+        std::shared_ptr<std::atomic<bool>> Claimed;
+        std::shared_future<std::shared_ptr<Resource>> Future;
+    };
+    std::unordered_map<uint64_t, std::shared_ptr<Resource>> linked;
+    std::unordered_map<uint64_t, LinkLoad> loads;
+    for (const auto& [index, hash] : references) {
+        const std::string* name = HashToString(hash);
+        if (name == nullptr || linked.find(hash) != linked.end()) {
+            continue;
+        }
+
+        auto& resource = linked[hash] = GetCachedResource(*name);
+        if (resource == nullptr) {
+            auto claimed = std::make_shared<std::atomic<bool>>(false);
+            auto future = QueueLoad<std::shared_ptr<Resource>>(
+                ResourceLoadPriority::Prefetch, [this, claimed, path = *name]() -> std::shared_ptr<Resource> {
+                    return claimed->exchange(true) ? nullptr : LoadResourceProcess(path);
+                });
+            loads.emplace(hash, LinkLoad{ claimed, future });
+        }
+    }
+    for (auto& [hash, load] : loads) {
+        linked[hash] = load.Claimed->exchange(true) ? load.Future.get() : LoadResourceProcess(*HashToString(hash));
+    }
+    for (const auto& [hash, resource] : linked) {
+        if (resource != nullptr) {
+            displayList->LinkedResources.push_back(resource);
+        }
+    }
+
+    for (const auto& [index, hash] : references) {
+        auto linkedFind = linked.find(hash);
+        Resource* resource = linkedFind != linked.end() ? linkedFind->second.get() : nullptr;
+        if (resource == nullptr || resource->GetPointer() == nullptr) {
+            continue;
+        }
+
+        Gfx* command = &instructions[index];
+        uint8_t opcode = (uint8_t)(command->words.w0 >> 24);
+        uintptr_t data = (uintptr_t)resource->GetPointer();
+
+        // w1 of G_VTX_OTR is an offset into the vertices, and of G_SETTIMG_OTR zero, until patched
+        if (opcode == G_VTX_OTR && command->words.w1 <= 0xFFFFF) {
+            displayList->RegisterResourceAddressPatch(crc, index, command->words.w1);
+            command->words.w1 = data + command->words.w1;
+        } else if (opcode == G_SETTIMG_OTR && command->words.w1 == 0) {
+            displayList->RegisterResourceAddressPatch(crc, index, command->words.w1);
+            command->words.w1 = data;
+        }
+    }
+}
+
+// Queues the display lists this one calls or branches to, and the ones those call down to depth levels, so the first
+// frame that draws them does not stop to load them one at a time. Each brings its vertices, textures and matrices with
+// it when it is linked.
+void ResourceMgr::PrefetchDisplayListChildren(std::shared_ptr<DisplayList> displayList, uint32_t depth) {
+    if (depth == 0) {
+        return;
+    }
+
+    auto& instructions = displayList->Instructions;
+    std::unordered_set<uint64_t> queued;
+
+    for (size_t i = 0; i + 1 < instructions.size(); i++) {
+        uint8_t opcode = (uint8_t)(instructions[i].words.w0 >> 24);
+
+        // Only the push form of G_DL_OTR names a display list, the other jumps to a segmented address
+        if (opcode == G_BRANCH_Z_OTR || (opcode == G_DL_OTR && ((instructions[i].words.w0 >> 16) & 1) == 0)) {
+            uint64_t hash = ((uint64_t)instructions[i + 1].words.w0 << 32) + instructions[i + 1].words.w1;
+            const std::string* name = HashToString(hash);
+
+            if (name != nullptr && queued.insert(hash).second && GetCachedResource(*name) == nullptr) {
+                QueueLoad<std::shared_ptr<Resource>>(ResourceLoadPriority::Prefetch, [this, depth, path = *name] {
+                    return LoadResourceAndPrefetch(path, depth - 1);
+                });
+            }
+        }
+        if (opcode == G_SETTIMG_OTR || opcode == G_DL_OTR || opcode == G_VTX_OTR || opcode == G_BRANCH_Z_OTR ||
+            opcode == G_MARKER || opcode == G_MTX_OTR) {
+            i++;
+        }
+    }
+}
+
 std::vector<uint32_t> ResourceMgr::GetGameVersions() {
     return mArchive->GetGameVersions();
 }
@@ -111,18 +284,21 @@ void ResourceMgr::PushGameVersion(uint32_t newGameVersion) {
     mArchive->PushGameVersion(newGameVersion);
 }
 
-std::shared_future<std::shared_ptr<OtrFile>> ResourceMgr::LoadFileAsync(const std::string& filePath) {
-    return mThreadPool->submit(&ResourceMgr::LoadFileProcess, this, filePath).share();
+std::shared_future<std::shared_ptr<OtrFile>> ResourceMgr::LoadFileAsync(const std::string& filePath,
+                                                                        ResourceLoadPriority priority) {
+    return QueueLoad<std::shared_ptr<OtrFile>>(priority, [this, filePath] { return LoadFileProcess(filePath); });
 }
 
 std::shared_ptr<OtrFile> ResourceMgr::LoadFile(const std::string& filePath) {
-    return LoadFileAsync(filePath).get();
+    // The caller is waiting for it, so rather than queue it behind other loads it is loaded on the calling thread
+    return LoadFileProcess(filePath);
 }
 
-std::shared_future<std::shared_ptr<Resource>> ResourceMgr::LoadResourceAsync(const std::string& filePath) {
+std::shared_future<std::shared_ptr<Resource>> ResourceMgr::LoadResourceAsync(const std::string& filePath,
+                                                                            ResourceLoadPriority priority) {
     if (OtrSignatureCheck(filePath.c_str())) {
         auto newFilePath = filePath.substr(7);
-        return LoadResourceAsync(newFilePath);
+        return LoadResourceAsync(newFilePath, priority);
     }
 
     auto cacheCheck = GetCachedResource(filePath);
@@ -134,19 +310,52 @@ std::shared_future<std::shared_ptr<Resource>> ResourceMgr::LoadResourceAsync(con
 
     const auto newFilePath = std::string(filePath);
 
-    return mThreadPool->submit(&ResourceMgr::LoadResourceProcess, this, newFilePath);
+    return QueueLoad<std::shared_ptr<Resource>>(priority,
+                                                [this, newFilePath] { return LoadResourceProcess(newFilePath); });
 }
 
 std::shared_ptr<Resource> ResourceMgr::LoadResource(const std::string& filePath) {
-    return LoadResourceAsync(filePath).get();
+    // The caller is waiting for it, so rather than queue it behind other loads it is loaded on the calling thread
+    return LoadResourceProcess(filePath);
+}
+
+ResourceMgr::ResourceCacheShard& ResourceMgr::GetResourceCacheShard(const std::string& filePath) {
+    return mResourceCache[std::hash<std::string>{}(filePath) % RESOURCE_CACHE_SHARD_COUNT];
+}
+
+std::shared_lock<std::shared_mutex> ResourceMgr::LockShared(ResourceCacheShard& shard) {
+    std::shared_lock<std::shared_mutex> lock(shard.Mutex, std::try_to_lock);
+
+    if (!lock.owns_lock()) {
+        mResourceCacheContentionCount.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+
+    return lock;
+}
+
+std::unique_lock<std::shared_mutex> ResourceMgr::LockExclusive(ResourceCacheShard& shard) {
+    std::unique_lock<std::shared_mutex> lock(shard.Mutex, std::try_to_lock);
+
+    if (!lock.owns_lock()) {
+        mResourceCacheContentionCount.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+
+    return lock;
+}
+
+uint64_t ResourceMgr::GetResourceCacheContentionCount() {
+    return mResourceCacheContentionCount.load(std::memory_order_relaxed);
 }
 
 std::shared_ptr<Resource> ResourceMgr::GetCachedResource(const std::string& filePath) {
-    const std::lock_guard<std::mutex> lock(mMutex);
+    auto& shard = GetResourceCacheShard(filePath);
+    auto lock = LockShared(shard);
 
-    auto resCacheFind = mResourceCache.find(filePath);
+    auto resCacheFind = shard.Resources.find(filePath);
 
-    if (resCacheFind == mResourceCache.end()) {
+    if (resCacheFind == shard.Resources.end()) {
         return nullptr;
     }
 
@@ -161,15 +370,25 @@ std::shared_ptr<Resource> ResourceMgr::GetCachedResource(const std::string& file
     return resCacheFind->second;
 }
 
+Resource* ResourceMgr::GetResidentResource(uint64_t hash) {
+    Resource* resource = mResidentIndex->Find(hash);
+
+    if (resource == nullptr || resource->IsDirty) {
+        return nullptr;
+    }
+
+    return resource;
+}
+
 std::shared_ptr<std::vector<std::shared_future<std::shared_ptr<Resource>>>>
-ResourceMgr::CacheDirectoryAsync(const std::string& searchMask) {
+ResourceMgr::CacheDirectoryAsync(const std::string& searchMask, ResourceLoadPriority priority) {
     auto loadedList = std::make_shared<std::vector<std::shared_future<std::shared_ptr<Resource>>>>();
     auto fileList = ListFiles(searchMask);
     loadedList->reserve(fileList->size());
 
     for (size_t i = 0; i < fileList->size(); i++) {
         auto fileName = std::string(fileList->operator[](i));
-        auto future = LoadResourceAsync(fileName);
+        auto future = LoadResourceAsync(fileName, priority);
         loadedList->push_back(future);
     }
 
@@ -219,7 +438,7 @@ std::shared_ptr<std::vector<std::string>> ResourceMgr::ListFiles(const std::stri
 }
 
 void ResourceMgr::InvalidateResourceCache() {
-    mResourceCache.clear();
+    UnloadAllResources();
 }
 
 const std::string* ResourceMgr::HashToString(uint64_t hash) {
@@ -239,11 +458,38 @@ std::shared_ptr<Window> ResourceMgr::GetContext() {
 }
 
 size_t ResourceMgr::UnloadResource(const std::string& filePath) {
-    return mResourceCache.erase(filePath);
+    // Resource destructors look other resources up in the cache, so the unloaded resource must outlive the lock.
+    std::shared_ptr<Resource> unloaded;
+
+    {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        auto& shard = GetResourceCacheShard(filePath);
+        auto shardLock = LockExclusive(shard);
+        auto resCacheFind = shard.Resources.find(filePath);
+
+        if (resCacheFind == shard.Resources.end()) {
+            return 0;
+        }
+
+        mResidentIndex->Remove(CRC64(filePath.c_str()));
+        unloaded = std::move(resCacheFind->second);
+        shard.Resources.erase(resCacheFind);
+    }
+
+    return 1;
 }
 
 void ResourceMgr::UnloadAllResources() {
-    mResourceCache.clear();
+    std::array<std::unordered_map<std::string, std::shared_ptr<Resource>>, RESOURCE_CACHE_SHARD_COUNT> unloaded;
+
+    {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        mResidentIndex->Clear();
+        for (size_t i = 0; i < RESOURCE_CACHE_SHARD_COUNT; i++) {
+            auto shardLock = LockExclusive(mResourceCache[i]);
+            unloaded[i].swap(mResourceCache[i].Resources);
+        }
+    }
 }
 
 bool ResourceMgr::OtrSignatureCheck(const char* fileName) {
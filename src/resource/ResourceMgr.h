@@ -3,17 +3,26 @@
 #include <unordered_map>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <array>
+#include <functional>
 #include <queue>
 #include "core/Window.h"
 #include "Resource.h"
 #include "ResourceLoader.h"
 #include "Archive.h"
+#include "ResidentResourceIndex.h"
 #include "thread-pool/BS_thread_pool.hpp"
 
 namespace Ship {
 class Window;
+class DisplayList;
 struct OtrFile;
 
+// Order in which queued loads run. A load someone is waiting on goes before loads ahead of need.
+enum class ResourceLoadPriority { RenderBlocking, Prefetch, Background, Count };
+
 // Resource manager caches any and all files it comes across into memory. This will be unoptimal in the future when
 // modifications have gigabytes of assets. It works with the original game's assets because the entire ROM is 64MB and
 // fits into RAM of any semi-modern PC.
@@ -34,17 +43,25 @@ class ResourceMgr {
     void InvalidateResourceCache();
     std::vector<uint32_t> GetGameVersions();
     void PushGameVersion(uint32_t newGameVersion);
-    std::shared_future<std::shared_ptr<OtrFile>> LoadFileAsync(const std::string& filePath);
+    void SetLoaderThreadCount(size_t threadCount);
+    size_t GetLoadQueueDepth(ResourceLoadPriority priority);
+    std::shared_future<std::shared_ptr<OtrFile>>
+    LoadFileAsync(const std::string& filePath, ResourceLoadPriority priority = ResourceLoadPriority::RenderBlocking);
     std::shared_ptr<OtrFile> LoadFile(const std::string& filePath);
     std::shared_ptr<Resource> GetCachedResource(const std::string& filePath);
+    Resource* GetResidentResource(uint64_t hash);
+    uint64_t GetResourceCacheContentionCount();
     std::shared_ptr<Resource> LoadResource(const std::string& filePath);
     std::shared_ptr<Resource> LoadResourceProcess(const std::string& fileToLoad);
     size_t UnloadResource(const std::string& filePath);
     void UnloadAllResources();
-    std::shared_future<std::shared_ptr<Resource>> LoadResourceAsync(const std::string& filePath);
+    std::shared_future<std::shared_ptr<Resource>>
+    LoadResourceAsync(const std::string& filePath,
+                      ResourceLoadPriority priority = ResourceLoadPriority::RenderBlocking);
     std::shared_ptr<std::vector<std::shared_ptr<Resource>>> CacheDirectory(const std::string& searchMask);
     std::shared_ptr<std::vector<std::shared_future<std::shared_ptr<Resource>>>>
-    CacheDirectoryAsync(const std::string& searchMask);
+    CacheDirectoryAsync(const std::string& searchMask,
+                        ResourceLoadPriority priority = ResourceLoadPriority::Background);
     size_t DirtyDirectory(const std::string& searchMask);
     std::shared_ptr<std::vector<std::string>> ListFiles(const std::string& searchMask);
     bool OtrSignatureCheck(const char* fileName);
@@ -52,13 +69,40 @@ class ResourceMgr {
 
   protected:
     std::shared_ptr<OtrFile> LoadFileProcess(const std::string& fileToLoad);
+    std::shared_ptr<Resource> LoadResourceAndPrefetch(const std::string& fileToLoad, uint32_t prefetchDepth);
+    void LinkDisplayList(std::shared_ptr<DisplayList> displayList, uint64_t crc);
+    void PrefetchDisplayListChildren(std::shared_ptr<DisplayList> displayList, uint32_t depth);
+    template <typename T> std::shared_future<T> QueueLoad(ResourceLoadPriority priority, std::function<T()> load);
+    void RunNextLoad();
 
   private:
+    // The resource cache is split into shards, each behind its own reader/writer lock, so that lookups from the render
+    // thread only ever share a lock with other readers and only contend with workers inserting into the same shard.
+    static constexpr size_t RESOURCE_CACHE_SHARD_COUNT = 16;
+    // Levels of display lists below one being loaded that are queued to load with it
+    static constexpr uint32_t DISPLAY_LIST_PREFETCH_DEPTH = 3;
+
+    struct ResourceCacheShard {
+        std::shared_mutex Mutex;
+        std::unordered_map<std::string, std::shared_ptr<Resource>> Resources;
+    };
+
+    ResourceCacheShard& GetResourceCacheShard(const std::string& filePath);
+    std::shared_lock<std::shared_mutex> LockShared(ResourceCacheShard& shard);
+    std::unique_lock<std::shared_mutex> LockExclusive(ResourceCacheShard& shard);
+
     std::shared_ptr<Window> mContext;
-    std::unordered_map<std::string, std::shared_ptr<Resource>> mResourceCache;
+    std::array<ResourceCacheShard, RESOURCE_CACHE_SHARD_COUNT> mResourceCache;
+    std::atomic<uint64_t> mResourceCacheContentionCount = 0;
     std::shared_ptr<ResourceLoader> mResourceLoader;
     std::shared_ptr<Archive> mArchive;
+    std::unique_ptr<ResidentResourceIndex> mResidentIndex;
     std::shared_ptr<BS::thread_pool> mThreadPool;
+    // Loads waiting for a worker, by priority. Every load queued also queues one RunNextLoad on the thread pool, which
+    // runs whichever load is first in the most urgent queue.
+    std::array<std::queue<std::function<void()>>, (size_t)ResourceLoadPriority::Count> mLoadQueues;
+    std::mutex mLoadQueueMutex;
+    // Serializes cache writers and updates to the resident index. Always taken before any shard lock.
     std::mutex mMutex;
 };
 } // namespace Ship
@@ -1,5 +1,6 @@
 #include "resource/factory/ArrayFactory.h"
 #include "resource/type/Array.h"
+#include "resource/factory/VertexFactory.h"
 #include "spdlog/spdlog.h"
 
 namespace Ship {
@@ -30,22 +31,12 @@ void ArrayFactoryV0::ParseFileBinary(std::shared_ptr<BinaryReader> reader, std::
     array->ArrayType = (ArrayResourceType)reader->ReadUInt32();
     array->ArrayCount = reader->ReadUInt32();
 
-    for (uint32_t i = 0; i < array->ArrayCount; i++) {
-        if (array->ArrayType == ArrayResourceType::Vertex) {
-            // OTRTODO: Implement Vertex arrays as just a vertex resource.
-            Vtx data;
-            data.v.ob[0] = reader->ReadInt16();
-            data.v.ob[1] = reader->ReadInt16();
-            data.v.ob[2] = reader->ReadInt16();
-            data.v.flag = reader->ReadUInt16();
-            data.v.tc[0] = reader->ReadInt16();
-            data.v.tc[1] = reader->ReadInt16();
-            data.v.cn[0] = reader->ReadUByte();
-            data.v.cn[1] = reader->ReadUByte();
-            data.v.cn[2] = reader->ReadUByte();
-            data.v.cn[3] = reader->ReadUByte();
-            array->Vertices.push_back(data);
-        } else {
+    if (array->ArrayType == ArrayResourceType::Vertex) {
+        // OTRTODO: Implement Vertex arrays as just a vertex resource.
+        array->Vertices.resize(array->ArrayCount);
+        VertexFactoryV0::ReadVertices(reader, array->Vertices.data(), array->ArrayCount);
+    } else {
+        for (uint32_t i = 0; i < array->ArrayCount; i++) {
             array->ArrayScalarType = (ScalarType)reader->ReadUInt32();
 
             int iter = 1;
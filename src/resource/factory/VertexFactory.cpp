@@ -2,6 +2,15 @@
 #include "resource/type/Vertex.h"
 #include "spdlog/spdlog.h"
 
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VERTEX_SWAP_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
 namespace Ship {
 std::shared_ptr<Resource> VertexFactory::ReadResource(uint32_t version, std::shared_ptr<BinaryReader> reader) {
     auto resource = std::make_shared<Vertex>();
@@ -28,21 +37,52 @@ void VertexFactoryV0::ParseFileBinary(std::shared_ptr<BinaryReader> reader, std:
     ResourceVersionFactory::ParseFileBinary(reader, vertex);
 
     uint32_t count = reader->ReadUInt32();
-    vertex->VertexList.reserve(count);
-
-    for (uint32_t i = 0; i < count; i++) {
-        Vtx data;
-        data.v.ob[0] = reader->ReadInt16();
-        data.v.ob[1] = reader->ReadInt16();
-        data.v.ob[2] = reader->ReadInt16();
-        data.v.flag = reader->ReadUInt16();
-        data.v.tc[0] = reader->ReadInt16();
-        data.v.tc[1] = reader->ReadInt16();
-        data.v.cn[0] = reader->ReadUByte();
-        data.v.cn[1] = reader->ReadUByte();
-        data.v.cn[2] = reader->ReadUByte();
-        data.v.cn[3] = reader->ReadUByte();
-        vertex->VertexList.push_back(data);
+    vertex->VertexList.resize(count);
+    ReadVertices(reader, vertex->VertexList.data(), count);
+}
+
+// A vertex is stored exactly like Vtx_t in memory: six 16-bit fields followed by four color bytes. Only the first
+// 12 bytes of every 16 need their byte order swapped.
+static_assert(sizeof(Vtx) == 16, "Vtx must match the on-disk vertex layout");
+
+void VertexFactoryV0::ReadVertices(std::shared_ptr<BinaryReader> reader, Vtx* vertices, uint32_t count) {
+    reader->Read((char*)vertices, count * sizeof(Vtx));
+
+    if (reader->GetEndianness() == Endianness::Native) {
+        return;
+    }
+
+    uint8_t* data = (uint8_t*)vertices;
+    uint32_t i = 0;
+
+#if defined(__SSSE3__) || defined(__AVX__)
+    const __m128i shuffle = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 12, 13, 14, 15);
+    for (; i < count; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 16));
+        _mm_storeu_si128((__m128i*)(data + i * 16), _mm_shuffle_epi8(v, shuffle));
+    }
+#elif defined(VERTEX_SWAP_SSE2)
+    // No pshufb without SSSE3, so swap every 16-bit lane with shifts and keep the color lanes from the source.
+    const __m128i keep = _mm_setr_epi32(0, 0, 0, -1);
+    for (; i < count; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 16));
+        __m128i swapped = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_or_si128(_mm_and_si128(keep, v), _mm_andnot_si128(keep, swapped));
+        _mm_storeu_si128((__m128i*)(data + i * 16), v);
+    }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    static const uint8_t shuffle[16] = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 12, 13, 14, 15 };
+    const uint8x16_t table = vld1q_u8(shuffle);
+    for (; i < count; i++) {
+        vst1q_u8(data + i * 16, vqtbl1q_u8(vld1q_u8(data + i * 16), table));
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint16_t* fields = (uint16_t*)(data + i * 16);
+        for (int j = 0; j < 6; j++) {
+            fields[j] = BSWAP16(fields[j]);
+        }
     }
 }
 } // namespace Ship
@@ -2,6 +2,7 @@
 
 #include "resource/Resource.h"
 #include "resource/ResourceFactory.h"
+#include "libultraship/libultra/gbi.h"
 
 namespace Ship {
 
@@ -13,5 +14,8 @@ class VertexFactory : public ResourceFactory {
 class VertexFactoryV0 : public ResourceVersionFactory {
   public:
     void ParseFileBinary(std::shared_ptr<BinaryReader> reader, std::shared_ptr<Resource> resource) override;
+
+    // Reads count packed vertices in one go and byte swaps them in place if the file is not in native byte order.
+    static void ReadVertices(std::shared_ptr<BinaryReader> reader, Vtx* vertices, uint32_t count);
 };
 } // namespace Ship
@@ -8,4 +8,14 @@ void* DisplayList::GetPointer() {
 size_t DisplayList::GetPointerSize() {
     return Instructions.size() * sizeof(Gfx);
 }
+
+bool DisplayList::HasDirtyLinks() {
+    for (const auto& resource : LinkedResources) {
+        if (resource->IsDirty) {
+            return true;
+        }
+    }
+
+    return false;
+}
 } // namespace Ship
@@ -1,15 +1,27 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include "resource/Resource.h"
 #include "libultraship/libultra/gbi.h"
 
+// Defined by the renderer, which compiles display lists the first time they run
+struct GfxCompiledDisplayList;
+
 namespace Ship {
 class DisplayList : public Resource {
   public:
     void* GetPointer();
     size_t GetPointerSize();
 
+    // Whether a resource the OTR commands were linked to has been marked dirty since
+    bool HasDirtyLinks();
+
     std::vector<Gfx> Instructions;
+    // Bumped whenever Instructions are patched or reverted in place, so what the renderer made from them is redone
+    uint32_t Revision = 0;
+    // Resources the OTR commands were linked to when the display list loaded, kept loaded as long as it is
+    std::vector<std::shared_ptr<Resource>> LinkedResources;
+    std::shared_ptr<GfxCompiledDisplayList> Compiled;
 };
 } // namespace Ship
@@ -1,4 +1,6 @@
 #include "resource/type/Texture.h"
+#include "libultraship/libultra/gbi.h"
+#include "graphic/Fast3D/gfx_texture_decode.h"
 
 namespace Ship {
 void* Texture::GetPointer() {
@@ -9,6 +11,61 @@ size_t Texture::GetPointerSize() {
     return ImageDataSize;
 }
 
+bool Texture::GetImageFormat(uint8_t& fmt, uint8_t& siz) {
+    switch (Type) {
+        case TextureType::RGBA32bpp:
+            fmt = G_IM_FMT_RGBA;
+            siz = G_IM_SIZ_32b;
+            return true;
+        case TextureType::RGBA16bpp:
+            fmt = G_IM_FMT_RGBA;
+            siz = G_IM_SIZ_16b;
+            return true;
+        case TextureType::Palette4bpp:
+            fmt = G_IM_FMT_CI;
+            siz = G_IM_SIZ_4b;
+            return true;
+        case TextureType::Palette8bpp:
+            fmt = G_IM_FMT_CI;
+            siz = G_IM_SIZ_8b;
+            return true;
+        case TextureType::Grayscale4bpp:
+            fmt = G_IM_FMT_I;
+            siz = G_IM_SIZ_4b;
+            return true;
+        case TextureType::Grayscale8bpp:
+            fmt = G_IM_FMT_I;
+            siz = G_IM_SIZ_8b;
+            return true;
+        case TextureType::GrayscaleAlpha4bpp:
+            fmt = G_IM_FMT_IA;
+            siz = G_IM_SIZ_4b;
+            return true;
+        case TextureType::GrayscaleAlpha8bpp:
+            fmt = G_IM_FMT_IA;
+            siz = G_IM_SIZ_8b;
+            return true;
+        case TextureType::GrayscaleAlpha16bpp:
+            fmt = G_IM_FMT_IA;
+            siz = G_IM_SIZ_16b;
+            return true;
+        default:
+            return false;
+    }
+}
+
+void Texture::DecodeImageData() {
+    uint8_t fmt, siz;
+
+    // RGBA32 textures are uploaded as is and palette textures depend on the TLUT, so neither can be decoded here.
+    if (ImageData == nullptr || !GetImageFormat(fmt, siz) || fmt == G_IM_FMT_CI || siz == G_IM_SIZ_32b) {
+        return;
+    }
+
+    DecodedImageData.resize(gfx_decoded_texture_size(siz, ImageDataSize));
+    gfx_decode_texture(DecodedImageData.data(), ImageData, ImageDataSize, fmt, siz);
+}
+
 Texture::~Texture() {
     if (ImageData != nullptr) {
         delete ImageData;
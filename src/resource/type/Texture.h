@@ -2,6 +2,7 @@
 
 #include "resource/Resource.h"
 #include "libultraship/libultra/types.h"
+#include <vector>
 
 namespace Ship {
 enum class TextureType {
@@ -26,6 +27,12 @@ class Texture : public Resource {
     uint16_t Width, Height;
     uint32_t ImageDataSize;
     uint8_t* ImageData = nullptr;
+    // RGBA32 copy of ImageData, filled on the loader thread when texture pre-decoding is enabled. Palette textures need
+    // the TLUT that is bound at draw time, so they are never pre-decoded.
+    std::vector<uint8_t> DecodedImageData;
+
+    bool GetImageFormat(uint8_t& fmt, uint8_t& siz);
+    void DecodeImageData();
 
     ~Texture();
 };